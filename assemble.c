@@ -1,21 +1,33 @@
+#define _POSIX_C_SOURCE 200112L
+
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
 
+#ifndef _WIN32
+	#include <unistd.h>
+	#include <sys/mman.h>
+#endif
+
 #include "assemble.h"
+#include "macro.h"
+#include "parallel.h"
 
-#define IC_BASE 100
-#define MEMORY_SIZE (1 << 21)
 #define LINE_LEN 81
+#define WORD_RECORD_LEN 15 /* "%07d %06x\n" */
+#define PARALLEL_DUMP_MIN_WORDS (1 << 16)
+#define DUMP_CHUNK_WORDS (1 << 14)
+#define DATA_SPILL_NODES 4096
 
 static int IC;
 static int DC;
 
 /* Code/data assembly table --------------------------------------------- */
 
-/* A machine word node in list */ 
+/* A machine word node in list, repeated `count` times */ 
 typedef struct assembly_node_t {
     assembly_t assembly;
+    int count;
     struct assembly_node_t *next;
 } assembly_node_t;
 
@@ -25,13 +37,373 @@ static assembly_node_t *code_tail = NULL;
 static assembly_node_t *data_head = NULL;
 static assembly_node_t *data_tail = NULL;
 
+/* Streaming --------------------------------------------- */
+
+static int streaming = 0;
+/* The object file code words are written to as they are added, once the code is streamed */
+static FILE *code_stream = NULL;
+/* Temporary file of the data runs before data_head, as (value, count) pairs */
+static FILE *data_spill = NULL;
+static int n_data_nodes = 0;
+
+/* Source lines --------------------------------------------- */
+
+/* A range of words assembled from the same line of the expanded file */
+typedef struct line_range_t {
+    int address; /* Data addresses are relative to the data section */
+    int count;
+    int line_number;
+    struct line_range_t *next;
+} line_range_t;
+
+static int line_number = 0;
+/* Ranges are recorded only for debug files, so memory does not grow with the code otherwise */
+static int line_tracking = 0;
+
+/* Linked lists of code/data line ranges */
+static line_range_t *code_lines_head = NULL;
+static line_range_t *code_lines_tail = NULL;
+static line_range_t *data_lines_head = NULL;
+static line_range_t *data_lines_tail = NULL;
+
+void set_output_streaming(int enabled) {
+    streaming = enabled;
+}
+
+/* Moves the data runs before the last one to the spill file, as the last one may still be extended */
+static ErrorCode spill_data() {
+    while (data_head != data_tail) {
+        assembly_node_t *next = data_head->next;
+        int record[2];
+
+        if (!data_spill) {
+            data_spill = tmpfile();
+            if (!data_spill) {
+                return ERR_OUT_OF_MEMORY;
+            }
+        }
+        record[0] = (int)data_head->assembly.data.value;
+        record[1] = data_head->count;
+        if (fwrite(record, sizeof(int), 2, data_spill) != 2) {
+            return ERR_OUT_OF_MEMORY;
+        }
+        free(data_head);
+        data_head = next;
+        n_data_nodes--;
+    }
+    return SUCCESS;
+}
+
+ErrorCode stream_code(FILE *file) {
+    char line[LINE_LEN];
+
+    sprintf(line, "%7d %-6d\n", IC - IC_BASE, DC);
+    if (fputs(line, file) == EOF) {
+        return ERR_FILE_CANNOT_CREATE;
+    }
+    code_stream = file;
+    return SUCCESS;
+}
+
+void set_line_number(int number) {
+    line_number = number;
+}
+
+void set_line_tracking(int enabled) {
+    line_tracking = enabled;
+}
+
+/* Records that words at the given address come from the current line */
+static ErrorCode add_line_range(line_range_t **head, line_range_t **tail, int address, int count) {
+    line_range_t *range;
+
+    if (!line_tracking) {
+        return SUCCESS;
+    }
+
+    /* Extend the last range if it is of the same line */
+    if (*tail && (*tail)->line_number == line_number && (*tail)->address + (*tail)->count == address) {
+        (*tail)->count += count;
+        return SUCCESS;
+    }
+
+    range = (line_range_t *)malloc(sizeof(line_range_t));
+    if (!range) {
+        return ERR_OUT_OF_MEMORY;
+    }
+    range->address = address;
+    range->count = count;
+    range->line_number = line_number;
+    range->next = NULL;
+
+    if (!*head) {
+        *head = range;
+    }
+    else {
+        (*tail)->next = range;
+    }
+    *tail = range;
+    return SUCCESS;
+}
+
+/* Writes line range records, with addresses moved by the given offset */
+static void dump_line_ranges(FILE *file, line_range_t *range, int offset) {
+    char line[LINE_LEN];
+    int source_line, macro_line;
+    char *macro;
+
+    for (; range; range = range->next) {
+        if (get_line_origin(range->line_number, &source_line, &macro, &macro_line) != SUCCESS) {
+            continue;
+        }
+        if (macro) {
+            sprintf(line, "lines %07d %d %d %s %d\n", range->address + offset, range->count, source_line, macro, macro_line);
+        }
+        else {
+            sprintf(line, "lines %07d %d %d\n", range->address + offset, range->count, source_line);
+        }
+        fputs(line, file);
+    }
+}
+
+void dump_lines(FILE *file, char *filename) {
+    fprintf(file, "file %s\n", filename);
+    dump_line_ranges(file, code_lines_head, 0);
+    dump_line_ranges(file, data_lines_head, IC);
+}
+
+/* Frees a list of line ranges */
+static void purge_line_ranges(line_range_t *range) {
+    while (range) {
+        line_range_t *next = range->next;
+        free(range);
+        range = next;
+    }
+}
+
+/* Data pooling --------------------------------------------- */
+
+#define POOL_BUCKETS 4096
+
+/* A block of data words already in the data section, or the suffix of one */
+typedef struct pool_entry_t {
+    unsigned int hash;
+    int *values;             /* Points into the values of the whole block */
+    int count;
+    int address;
+    int is_block;            /* Nonzero for the entry owning the values */
+    struct pool_entry_t *next;
+} pool_entry_t;
+
+static int pool_enabled = 0;
+static pool_entry_t *pool[POOL_BUCKETS];
+static int pooled_words = 0;
+
+/* The last shared block, which must be stored in place if the next data directive continues it */
+static pool_entry_t *pending_block = NULL;
+static int pending_line = 0; /* Source line of the directive that shared it */
+
+void set_data_pooling(int enabled) {
+    pool_enabled = enabled;
+}
+
+int get_pooled_words() {
+    return pooled_words;
+}
+
+/* FNV-1a hash of a sequence of words */
+static unsigned int hash_words(int *values, int count) {
+    unsigned int hash = 2166136261u;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        hash = (hash ^ (unsigned int)values[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/* Finds a stored block or suffix with the same words */
+static pool_entry_t *find_pooled(int *values, int count) {
+    unsigned int hash = hash_words(values, count);
+    pool_entry_t *entry;
+
+    for (entry = pool[hash % POOL_BUCKETS]; entry; entry = entry->next) {
+        if (entry->hash == hash && entry->count == count &&
+            memcmp(entry->values, values, count * sizeof(int)) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/* Adds a stored block and all of its suffixes to the pool */
+static ErrorCode add_pooled(int *values, int count, int address) {
+    int *copy;
+    int i;
+
+    copy = (int *)malloc(count * sizeof(int));
+    if (!copy) {
+        return ERR_OUT_OF_MEMORY;
+    }
+    memcpy(copy, values, count * sizeof(int));
+
+    for (i = 0; i < count; i++) {
+        pool_entry_t *entry;
+        unsigned int hash;
+
+        /* An earlier copy of the suffix is as good as this one */
+        if (i > 0 && find_pooled(copy + i, count - i)) {
+            continue;
+        }
+
+        entry = (pool_entry_t *)malloc(sizeof(pool_entry_t));
+        if (!entry) {
+            if (i == 0) {
+                free(copy);
+            }
+            return ERR_OUT_OF_MEMORY;
+        }
+        hash = hash_words(copy + i, count - i);
+        entry->hash = hash;
+        entry->values = copy + i;
+        entry->count = count - i;
+        entry->address = address + i;
+        entry->is_block = (i == 0);
+        entry->next = pool[hash % POOL_BUCKETS];
+        pool[hash % POOL_BUCKETS] = entry;
+    }
+    return SUCCESS;
+}
+
+/* Appends a block of words to the data section */
+static ErrorCode store_data_block(int *values, int count) {
+    assembly_t assembly;
+    ErrorCode error;
+    int i;
+
+    assembly.data.value = 0;
+    for (i = 0; i < count; i++) {
+        assembly.data.value = values[i];
+        error = add_data(assembly);
+        if (error != SUCCESS) {
+            return error;
+        }
+    }
+    return SUCCESS;
+}
+
+ErrorCode add_data_block(int *values, int count, int can_share, int *address) {
+    pool_entry_t *entry;
+    ErrorCode error;
+
+    if (count == 0) {
+        *address = DC;
+        return SUCCESS;
+    }
+    if (pool_enabled && can_share && (entry = find_pooled(values, count))) {
+        *address = entry->address;
+        pending_block = entry;
+        pending_line = line_number;
+        pooled_words += count;
+        return SUCCESS;
+    }
+
+    *address = DC;
+    error = store_data_block(values, count);
+    if (error != SUCCESS || !pool_enabled) {
+        return error;
+    }
+    return add_pooled(values, count, *address);
+}
+
+ErrorCode unshare_data_block(int *address) {
+    pool_entry_t *entry = pending_block;
+    ErrorCode error;
+    int continuing_line = line_number;
+
+    *address = -1;
+    if (!entry) {
+        return SUCCESS;
+    }
+
+    /* The copy belongs to the line of the directive that shared the block */
+    *address = DC;
+    pooled_words -= entry->count;
+    line_number = pending_line;
+    error = store_data_block(entry->values, entry->count);
+    line_number = continuing_line;
+    if (error != SUCCESS) {
+        return error;
+    }
+    return add_pooled(entry->values, entry->count, *address);
+}
+
+/* Frees the pool */
+static void purge_pool() {
+    int i;
+
+    for (i = 0; i < POOL_BUCKETS; i++) {
+        pool_entry_t *entry = pool[i];
+        while (entry) {
+            pool_entry_t *next = entry->next;
+            if (entry->is_block) {
+                free(entry->values);
+            }
+            free(entry);
+            entry = next;
+        }
+        pool[i] = NULL;
+    }
+    pending_block = NULL;
+    pooled_words = 0;
+}
+
+/* Code/data words --------------------------------------------- */
+
+/* Formats a single fixed width "%07d %06x\n" record, without a zero terminator */
+static void format_word(char *record, int address, unsigned int value) {
+    static const char hex[] = "0123456789abcdef";
+    int i;
+
+    for (i = 6; i >= 0; i--) {
+        record[i] = '0' + address % 10;
+        address /= 10;
+    }
+    record[7] = ' ';
+    for (i = 13; i >= 8; i--) {
+        record[i] = hex[value & 0xf];
+        value >>= 4;
+    }
+    record[14] = '\n';
+}
+
 ErrorCode add_code(assembly_t assembly) {
+    assembly_node_t *node;
+
+    /* Record the source line of the word */
+    if (add_line_range(&code_lines_head, &code_lines_tail, IC, 1) != SUCCESS) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    /* Streamed code goes straight to the object file, in address order */
+    if (code_stream) {
+        char record[WORD_RECORD_LEN];
+
+        format_word(record, IC, assembly.data.value);
+        if (fwrite(record, WORD_RECORD_LEN, 1, code_stream) != 1) {
+            return ERR_FILE_CANNOT_CREATE;
+        }
+        IC++;
+        return is_exceeded_RAM() ? ERR_EXCEEDED_RAM : SUCCESS;
+    }
+
     /* Allocate and insert a new node */
-    assembly_node_t *node = (assembly_node_t *)malloc(sizeof(assembly_node_t));
+    node = (assembly_node_t *)malloc(sizeof(assembly_node_t));
     if (!node) {
         return ERR_OUT_OF_MEMORY;
     }
     node->assembly = assembly;
+    node->count = 1;
     node->next = NULL;
 
     /* If the list is empty, set both head and tail to the new node */
@@ -55,12 +427,39 @@ ErrorCode add_code(assembly_t assembly) {
 }
 
 ErrorCode add_data(assembly_t assembly) {
+    return add_data_run(assembly, 1);
+}
+
+ErrorCode add_data_run(assembly_t assembly, int count) {
+    assembly_node_t *node;
+
+    /* Words after a shared block are not its continuation */
+    pending_block = NULL;
+
+    /* Check if the memory exceeds the maximum allowed size */
+    if (count > MEMORY_SIZE - IC - DC) {
+        return ERR_EXCEEDED_RAM;
+    }
+
+    /* Record the source line of the words */
+    if (add_line_range(&data_lines_head, &data_lines_tail, DC, count) != SUCCESS) {
+        return ERR_OUT_OF_MEMORY;
+    }
+
+    /* Extend the last run if it repeats the same word */
+    if (data_tail && data_tail->assembly.data.value == assembly.data.value) {
+        data_tail->count += count;
+        DC += count;
+        return SUCCESS;
+    }
+
     /* Allocate and insert a new node */
-    assembly_node_t *node = (assembly_node_t *)malloc(sizeof(assembly_node_t));
+    node = (assembly_node_t *)malloc(sizeof(assembly_node_t));
     if (!node) {
         return ERR_OUT_OF_MEMORY;
     }
     node->assembly = assembly;
+    node->count = count;
     node->next = NULL;
 
     /* If the list is empty, set both head and tail to the new node */
@@ -74,14 +473,17 @@ ErrorCode add_data(assembly_t assembly) {
         data_tail = node;
     }
 
-    /* Increment the Instruction Counter */
-    DC++;
-    /* Check if the memory exceeds the maximum allowed size */
-    if (is_exceeded_RAM()) {
-        return ERR_EXCEEDED_RAM;
+    /* Increment the Data Counter */
+    DC += count;
+
+    /* When streaming, only the latest data runs are kept in memory */
+    n_data_nodes++;
+    if (streaming && n_data_nodes > DATA_SPILL_NODES) {
+        return spill_data();
     }
     return SUCCESS;
 }
+
 void set_reg(assembly_t *assembly, int reg, int i, int number_of_operands) {
 	/* With two operands, the first one is osource, otherwise it is destination */
 	if (number_of_operands == 2 && i == 0) {
@@ -133,20 +535,168 @@ int is_exceeded_RAM() {
     return (IC + DC > MEMORY_SIZE);
 }
 
+/* Parallel object writer ---------------------------------- */
+
+/* Word image shared by the parallel writer tasks */
+typedef struct {
+    assembly_node_t **nodes; /* Code nodes followed by data runs */
+    int *first_word;         /* Index of the first word of each node */
+    int n_nodes;
+    int n_words;
+    char *output;            /* Start of the first word record */
+} dump_image_t;
+
+/* Formats one chunk of words into its own slice of the output */
+static void dump_chunk(void *context, int chunk) {
+    dump_image_t *image = (dump_image_t *)context;
+    int word = chunk * DUMP_CHUNK_WORDS;
+    int end = word + DUMP_CHUNK_WORDS;
+    int low = 0;
+    int high = image->n_nodes - 1;
+
+    if (end > image->n_words) {
+        end = image->n_words;
+    }
+
+    /* Find the node holding the first word of the chunk */
+    while (low < high) {
+        int middle = (low + high + 1) / 2;
+        if (image->first_word[middle] <= word) {
+            low = middle;
+        }
+        else {
+            high = middle - 1;
+        }
+    }
+
+    for (; word < end; word++) {
+        while (word >= image->first_word[low] + image->nodes[low]->count) {
+            low++;
+        }
+        format_word(
+            image->output + (long)word * WORD_RECORD_LEN,
+            IC_BASE + word,
+            image->nodes[low]->assembly.data.value
+        );
+    }
+}
+
+/* Formats the code and data sections on all cores directly into the file.
+   Every record has a fixed width, so each word's offset is known in advance.
+   Returns 1 if the sections were written, 0 to fall back to a sequential dump. */
+static int dump_parallel(FILE *file) {
+    dump_image_t image;
+    assembly_node_t *current;
+    int n_chunks;
+    int i;
+    char *buffer;
+
+    /* Index all nodes by their first word */
+    image.n_nodes = 0;
+    for (current = code_head; current; current = current->next) {
+        image.n_nodes++;
+    }
+    for (current = data_head; current; current = current->next) {
+        image.n_nodes++;
+    }
+    image.nodes = (assembly_node_t **)malloc(image.n_nodes * sizeof(assembly_node_t *));
+    image.first_word = (int *)malloc(image.n_nodes * sizeof(int));
+    if (!image.nodes || !image.first_word) {
+        free(image.nodes);
+        free(image.first_word);
+        return 0;
+    }
+    image.n_words = 0;
+    i = 0;
+    for (current = code_head; current; current = current->next, i++) {
+        image.nodes[i] = current;
+        image.first_word[i] = image.n_words;
+        image.n_words += current->count;
+    }
+    for (current = data_head; current; current = current->next, i++) {
+        image.nodes[i] = current;
+        image.first_word[i] = image.n_words;
+        image.n_words += current->count;
+    }
+    n_chunks = (image.n_words + DUMP_CHUNK_WORDS - 1) / DUMP_CHUNK_WORDS;
+
+#ifndef _WIN32
+    /* Size the file once and format straight into a shared mapping */
+    {
+        long offset;
+        long size;
+        char *map;
+
+        fflush(file);
+        offset = ftell(file);
+        size = offset + (long)image.n_words * WORD_RECORD_LEN;
+        if (offset >= 0 && ftruncate(fileno(file), size) == 0) {
+            map = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(file), 0);
+            if (map != (char *)MAP_FAILED) {
+                image.output = map + offset;
+                parallel_for(n_chunks, dump_chunk, &image);
+                munmap(map, size);
+                fseek(file, 0, SEEK_END);
+                free(image.nodes);
+                free(image.first_word);
+                return 1;
+            }
+        }
+    }
+#endif
+
+    /* No mapping: format into a memory buffer and write it at once */
+    buffer = (char *)malloc((long)image.n_words * WORD_RECORD_LEN);
+    if (buffer) {
+        image.output = buffer;
+        parallel_for(n_chunks, dump_chunk, &image);
+        fwrite(buffer, WORD_RECORD_LEN, image.n_words, file);
+        free(buffer);
+    }
+    free(image.nodes);
+    free(image.first_word);
+    return buffer != NULL;
+}
+
+/* Writes the spilled data runs, from the given address */
+static void dump_spilled_data(FILE *file, int *address) {
+    char line[LINE_LEN];
+    int record[2];
+    int i;
+
+    rewind(data_spill);
+    while (fread(record, sizeof(int), 2, data_spill) == 2) {
+        for (i = 0; i < record[1]; i++) {
+            sprintf(line, "%07d %06x\n", *address, record[0]);
+            fputs(line, file);
+            (*address)++;
+        }
+    }
+}
+
 void purge_and_dump_assembly(FILE *file) {
     assembly_node_t *current;
     char line[LINE_LEN];
-    int address;
+    int address = IC_BASE;
 
+    /* A streamed object file already has the header and the code section */
+    if (file && file == code_stream) {
+        address = IC;
+    }
     /* Print the current IC and DC values */
-    if (file) {
+    else if (file) {
         sprintf(line, "%7d %-6d\n", IC - IC_BASE, DC);
         fputs(line, file);
+
+        /* Large images are formatted in parallel, the lists are only freed below */
+        if (!data_spill && IC - IC_BASE + DC >= PARALLEL_DUMP_MIN_WORDS && dump_parallel(file)) {
+            file = NULL;
+        }
     }
+    code_stream = NULL;
     
     /* Print the code section*/
     current = code_head;
-    address = IC_BASE;
     while (current) {
         assembly_node_t *next = current->next;
 
@@ -163,21 +713,43 @@ void purge_and_dump_assembly(FILE *file) {
     code_head = NULL;
     code_tail = NULL;
 
-    /* Print the data section*/
+    /* Print the data section, expanding runs, from the spilled runs on */
+    if (data_spill) {
+        if (file) {
+            dump_spilled_data(file, &address);
+        }
+        fclose(data_spill);
+        data_spill = NULL;
+    }
     current = data_head;
     while (current) {
         assembly_node_t *next = current->next;
+        int i;
 
-        if (file) {
-            sprintf(line, "%07d %06x\n", address, current->assembly.data.value);
-            fputs(line, file);
+        for (i = 0; i < current->count; i++) {
+            if (file) {
+                sprintf(line, "%07d %06x\n", address, current->assembly.data.value);
+                fputs(line, file);
+            }
+            address++;
         }
 
         free(current);
         current = next;
-        address++;
     }
     /* Reset the data list */
     data_head = NULL;
     data_tail = NULL;
+    n_data_nodes = 0;
+
+    /* Reset the data pool */
+    purge_pool();
+
+    /* Reset the source lines */
+    purge_line_ranges(code_lines_head);
+    purge_line_ranges(data_lines_head);
+    code_lines_head = NULL;
+    code_lines_tail = NULL;
+    data_lines_head = NULL;
+    data_lines_tail = NULL;
 }
@@ -5,6 +5,9 @@
 #include "error_codes.h"
 #include "language.h"
 
+#define IC_BASE 100
+#define MEMORY_SIZE (1 << 21)
+
 /* A machine word definition */ 
 typedef union {
 	struct{
@@ -39,6 +42,86 @@ Adds data to the data section.
 */
 ErrorCode add_data(assembly_t assembly);
 
+/** 
+Adds a run of identical words to the data section.
+The run is stored as a single entry and is only expanded when dumped.
+	@param assembly: The assembly_t object containing the word to repeat.
+	@param count: The number of times the word is repeated.
+	@return: Error code indicating success or failure.
+*/
+ErrorCode add_data_run(assembly_t assembly, int count);
+
+/**
+Enables or disables data pooling.
+With pooling, a labeled data block that already exists in the data section, either as a whole
+or as the suffix of an earlier block, is not stored again, and its label points at the earlier copy.
+Pooled data is shared between labels, so the program must not modify it.
+	@param enabled: Nonzero to enable pooling.
+*/
+void set_data_pooling(int enabled);
+
+/**
+Adds the words of a single data directive to the data section.
+	@param values: The words of the block.
+	@param count: The number of words in the block.
+	@param can_share: Nonzero if the block may be shared with an earlier copy (only labeled blocks).
+	@param address: Output - the data address of the block.
+	@return: Error code indicating success or failure.
+*/
+ErrorCode add_data_block(int *values, int count, int can_share, int *address);
+
+/**
+Stores the last shared block in place after all, since the following data directive continues it.
+	@param address: Output - the new data address of the block, or -1 if it was not shared.
+	@return: Error code indicating success or failure.
+*/
+ErrorCode unshare_data_block(int *address);
+
+/**
+Returns the number of data words saved by pooling.
+*/
+int get_pooled_words();
+
+/**
+Enables or disables streaming of the object file, for images too large to keep in memory.
+While streaming, only the latest data runs are kept in memory, and the earlier ones are
+moved to a temporary file. Code words are written to the object file as they are added,
+once stream_code is called.
+	@param enabled: Nonzero to enable streaming.
+*/
+void set_output_streaming(int enabled);
+
+/**
+Starts writing code words to the object file as they are added, in address order.
+Writes the header of the object file by the IC and DC of the first process, so it is called
+after the first process and before the second process. purge_and_dump_assembly then
+writes only the data section to the same file.
+	@param file: The object file.
+	@return: Error code indicating success or failure.
+*/
+ErrorCode stream_code(FILE *file);
+
+/**
+Sets the line of the expanded file that the following code and data words are assembled from.
+	@param line_number: The line number in the expanded file.
+*/
+void set_line_number(int line_number);
+
+/**
+Enables or disables recording the source lines of the code and data words, for dump_lines.
+Disabled by default, so memory does not grow with the size of the code.
+	@param enabled: Nonzero to record the source lines.
+*/
+void set_line_tracking(int enabled);
+
+/**
+Writes the source line records of the code and data sections to a debug file.
+Each record maps a range of addresses to its source line, and to the macro it was expanded from.
+	@param file: The file pointer where the records will be written.
+	@param filename: The name of the source file.
+*/
+void dump_lines(FILE *file, char *filename);
+
 /**
 Sets the register value for an operand.
 	@param assembly: A pointer to the assembly structure.
@@ -93,7 +176,7 @@ Checks if the system's memory (RAM) has been exceeded.
 int is_exceeded_RAM();
 
 /** 
-Dumps the assembly code to a specified file.
+Dumps the assembly code to a specified file, and frees the code, data and source lines.
 	@param file: The file pointer where the assembly code will be written.
 */
 void purge_and_dump_assembly(FILE *file);
@@ -0,0 +1,581 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+	#include <unistd.h>
+	#include <pthread.h>
+#endif
+
+#include "error_codes.h"
+#include "utils.h"
+#include "macro.h"
+#include "process.h"
+#include "symbols.h"
+#include "optimize.h"
+#include "output.h"
+#include "build.h"
+
+/* A message or an error of the expand stage, kept to be reported in order */
+typedef struct report_t {
+	char *message;          /* The message, or NULL for an error */
+	ErrorCode error;
+	char *filename;
+	int line_number;
+	char *error_context;
+	struct report_t *next;
+} report_t;
+
+/* A file between the stages of a build */
+typedef struct {
+	char *base;
+	build_options_t *options;
+	int is_deferred;        /* Nonzero if reports of the expand stage are kept */
+	int error;              /* Nonzero if building failed */
+	macro_state_t *macros;  /* Macro tables of the expanded file */
+	output_batch_t outputs; /* Its outputs, reported once written */
+	report_t *reports;
+	report_t *last_report;
+} build_unit_t;
+
+/* Adds a report to the kept reports of a file */
+static void add_report(build_unit_t *unit, report_t *report) {
+	if (unit->last_report) {
+		unit->last_report->next = report;
+	}
+	else {
+		unit->reports = report;
+	}
+	unit->last_report = report;
+}
+
+/**
+Writes a dependency file for make.
+The output files depend on the source and on the included library files, which are also
+written as targets without prerequisites, so make does not fail when a library is removed.
+The external symbols the file uses are set in an EXTERNS variable of the output files, so a build
+can relink without assembling again when only the addresses of these symbols change.
+*/
+static void write_dependencies(FILE *file, char *base, build_options_t *options) {
+	char filename[MAX_FILE_NAME];
+	char targets[4 * MAX_FILE_NAME + 4];
+
+	get_filename(base, "ob", targets);
+	if (has_extern()) {
+		get_filename(base, "ext", filename);
+		strcat(strcat(targets, " "), filename);
+	}
+	if (has_entry()) {
+		get_filename(base, "ent", filename);
+		strcat(strcat(targets, " "), filename);
+	}
+	if (options->debug) {
+		get_filename(base, "dbg", filename);
+		strcat(strcat(targets, " "), filename);
+	}
+
+	get_filename(base, "as", filename);
+	fprintf(file, "%s: %s", targets, filename);
+	dump_included_libraries(file, " %s");
+	fprintf(file, "\n%s: EXTERNS :=", targets);
+	dump_extern_names(file);
+	fprintf(file, "\n");
+	dump_included_libraries(file, "\n%s:\n");
+}
+
+/* Reports a message of a file, or keeps it to be reported in order */
+static void report_message(build_unit_t *unit, const char *format, char *argument) {
+	report_t *report;
+
+	if (!unit->is_deferred) {
+		printf(format, argument);
+		return;
+	}
+	report = (report_t *)calloc(1, sizeof(report_t));
+	if (!report) {
+		return;
+	}
+	report->message = (char *)malloc(strlen(format) + strlen(argument) + 1);
+	if (report->message) {
+		sprintf(report->message, format, argument);
+	}
+	add_report(unit, report);
+}
+
+/* Reports the kept messages and errors of a file */
+static void replay_reports(build_unit_t *unit) {
+	report_t *report = unit->reports;
+
+	while (report) {
+		report_t *next = report->next;
+		if (report->message) {
+			fputs(report->message, stdout);
+		}
+		else if (report->filename) {
+			print_error(report->error, report->filename, report->line_number, report->error_context);
+		}
+		free(report->message);
+		free(report->filename);
+		free(report->error_context);
+		free(report);
+		report = next;
+	}
+	unit->reports = NULL;
+	unit->last_report = NULL;
+}
+
+/* Expands the macros of a file into its .am file */
+static int expand_file(build_unit_t *unit)
+{
+    FILE *source, *destination;
+	char source_filename[MAX_FILE_NAME];
+	char destination_filename[MAX_FILE_NAME];
+    int error = SUCCESS;
+
+	/* Open source file */
+	if (is_filename_too_long(unit->base)) {
+		is_error(ERR_FILE_NAME_TOO_LONG, NULL, unit->base, 0, NULL);
+		return 1;
+	}
+	get_filename(unit->base, "as", source_filename);
+	report_message(unit, "Building file %s...\n", source_filename);
+	source = fopen(source_filename, "r");
+	if (!source) {
+		is_error(ERR_FILE_NOT_EXIST, NULL, source_filename, 0, NULL);
+		return 1;
+	}
+	setvbuf(source, NULL, _IOFBF, IO_BUFFER_SIZE);
+
+	/* Create file for processed macros */
+	get_filename(unit->base, "am", destination_filename);
+	destination = open_output(destination_filename);
+	if (!destination) {
+		is_error(ERR_FILE_CANNOT_CREATE, NULL, destination_filename, 0, NULL);
+		fclose (source);
+		return 1;
+	}
+
+	/* Process macros and write the results */
+	report_message(unit, "Processing macros...\n", "");
+	set_line_origins(unit->options->debug);
+	error = macro_process(source_filename, source, destination);
+	fclose (source);
+	
+	/* Error during macro processing: delete .am file and continue to next file */
+	if (error) {
+		discard_output(destination);
+		unlink(destination_filename);
+		purge_macros();
+		return 1;
+	}
+	if (is_error(close_output(destination), NULL, destination_filename, 0, NULL)) {
+		purge_macros();
+		return 1;
+	}
+	return 0;
+}
+
+/* Opens an output file, and reports an error if it cannot be created */
+static FILE *create_output(char *filename, int *error_state)
+{
+	FILE *file = open_output(filename);
+
+	if (!file) {
+		is_error(ERR_FILE_CANNOT_CREATE, error_state, filename, 0, NULL);
+	}
+	return file;
+}
+
+/* Assembles the expanded file and submits the output files */
+static int assemble_file(build_unit_t *unit)
+{
+    FILE *source, *destination, *object;
+	char *base = unit->base;
+	build_options_t *options = unit->options;
+	char source_filename[MAX_FILE_NAME];
+	char destination_filename[MAX_FILE_NAME];
+	char message[LINE_LEN];
+    int error = SUCCESS;
+	int error_state = 0;
+
+	set_data_pooling(options->pool_data);
+	set_output_streaming(options->stream_output);
+	set_line_tracking(options->debug);
+
+	/* First process: resolve symbols */
+	get_filename(base, "am", source_filename);
+	source = fopen(source_filename, "r");
+	if (!source) {
+		is_error(ERR_FILE_NOT_EXIST, NULL, source_filename, 0, NULL);
+		purge_macros();
+		return 1;
+	}
+	
+	report_message(unit, "Resolving symbols...\n", "");
+	/* Error during first process: continue to next file */
+	error = first_process(source_filename, source);
+	if (error) {
+		fclose (source);
+		purge_and_dump_assembly(NULL);
+		purge_macros();
+		purge_symbols();
+		return 1;
+	}
+
+	/* Optimize the code, and resolve the symbols again by the new addresses */
+	if (options->optimize) {
+		FILE *optimized = tmpfile();
+		int words_saved, cycles_saved;
+
+		report_message(unit, "Optimizing...\n", "");
+		fseek (source, 0, SEEK_SET);
+		error = optimized ? 
+			optimize_process(source_filename, source, optimized, &words_saved, &cycles_saved) :
+			is_error(ERR_FILE_CANNOT_CREATE, NULL, source_filename, 0, NULL);
+		fclose (source);
+		purge_and_dump_assembly(NULL);
+		purge_symbols();
+		if (error) {
+			if (optimized) {
+				fclose(optimized);
+			}
+			purge_macros();
+			return 1;
+		}
+		sprintf(message, "Saved %d words and %d cycles.\n", words_saved, cycles_saved);
+		report_message(unit, "%s", message);
+
+		source = optimized;
+		fseek (source, 0, SEEK_SET);
+		error = first_process(source_filename, source);
+		if (error) {
+			fclose (source);
+			purge_and_dump_assembly(NULL);
+			purge_macros();
+			purge_symbols();
+			return 1;
+		}
+	}
+
+	/* When streaming, the code is written to the object file during the second process */
+	object = NULL;
+	if (options->stream_output) {
+		get_filename(base, "ob", destination_filename);
+		object = open_output(destination_filename);
+		if (!object || is_error(stream_code(object), NULL, destination_filename, 0, NULL)) {
+			if (object) {
+				discard_output(object);
+			}
+			else {
+				is_error(ERR_FILE_CANNOT_CREATE, NULL, destination_filename, 0, NULL);
+			}
+			fclose (source);
+			purge_and_dump_assembly(NULL);
+			purge_macros();
+			purge_symbols();
+			return 1;
+		}
+	}
+
+	/* Second process of the same file - seek to start */
+	fseek (source, 0, SEEK_SET);
+	report_message(unit, "Assembling...\n", "");
+	error = second_process(source_filename, source);
+	/* Error during second process: do not create output files */
+	if (error) {
+		fclose (source);
+		if (object) {
+			discard_output(object);
+		}
+		purge_and_dump_assembly(NULL);
+		purge_macros();
+		purge_symbols();
+		return 1;
+	}
+
+	fclose (source);
+
+	if (get_pooled_words() > 0) {
+		sprintf(message, "Pooled %d data words.\n", get_pooled_words());
+		report_message(unit, "%s", message);
+	}
+	
+	/* Dump all files */
+	report_message(unit, "Generating output files...\n", "");
+
+	/* If requested, generate a debug file, before the code is freed */
+	if (options->debug) {
+		get_filename(base, "as", source_filename);
+		get_filename(base, "dbg", destination_filename);
+		destination = create_output(destination_filename, &error_state);
+		if (destination) {
+			dump_lines(destination, source_filename);
+			dump_symbols(destination);
+			submit_output(destination, &unit->outputs);
+		}
+	}
+
+	/* A streamed object file only needs the data section */
+	if (object) {
+		purge_and_dump_assembly(object);
+		submit_output(object, &unit->outputs);
+	}
+	else {
+		get_filename(base, "ob", destination_filename);
+		destination = create_output(destination_filename, &error_state);
+		purge_and_dump_assembly(destination);
+		if (destination) {
+			submit_output(destination, &unit->outputs);
+		}
+	}
+
+	/* If external symbols exist, generate an extern file */
+	if (has_extern()) {
+		get_filename(base, "ext", destination_filename);
+		destination = create_output(destination_filename, &error_state);
+		if (destination) {
+			dump_extern(destination);
+			submit_output(destination, &unit->outputs);
+		}
+	}
+
+	/* If entry symbols exist, generate an entry file */
+	if (has_entry()) {
+		get_filename(base, "ent", destination_filename);
+		destination = create_output(destination_filename, &error_state);
+		if (destination) {
+			dump_entry(destination);
+			submit_output(destination, &unit->outputs);
+		}
+	}
+
+	/* If requested, generate a dependency file */
+	if (options->dependencies) {
+		get_filename(base, "d", destination_filename);
+		destination = create_output(destination_filename, &error_state);
+		if (destination) {
+			write_dependencies(destination, base, options);
+			submit_output(destination, &unit->outputs);
+		}
+	}
+
+	/* Clean up stored macros and symbols before moving to the next file */
+	purge_macros();
+	purge_symbols();
+	return error_state ? 1 : 0;
+}
+
+/* Reports a file once its outputs are written. Returns 0 if the file was built, 1 otherwise */
+static int finish_file(build_unit_t *unit)
+{
+	wait_batch(&unit->outputs);
+	replay_reports(unit);
+	if (is_error(unit->outputs.error, NULL, unit->outputs.filename, 0, NULL)) {
+		unit->error = 1;
+	}
+	if (!unit->error) {
+		printf("Done file.\n");
+	}
+	return unit->error;
+}
+
+int build_file(char *base, build_options_t *options)
+{
+	build_unit_t unit;
+
+	memset(&unit, 0, sizeof(build_unit_t));
+	unit.base = base;
+	unit.options = options;
+	init_batch(&unit.outputs);
+	if (expand_file(&unit)) {
+		return 1;
+	}
+	unit.error = assemble_file(&unit);
+	return finish_file(&unit);
+}
+
+/* Pipeline ------------------------------------------------ */
+
+#ifndef _WIN32
+
+/* Number of expanded files waiting to be assembled before the expand stage waits */
+#define PIPELINE_DEPTH 4
+
+/* State of a pipelined build */
+typedef struct {
+	build_unit_t *units;
+	int n_files;
+	int n_expanded;         /* Files expanded so far */
+	int n_assembled;        /* Files taken by the assemble stage so far */
+	double expand_seconds;  /* Time the expand stage was busy */
+	pthread_mutex_t lock;
+	pthread_cond_t expanded;
+	pthread_cond_t assembled;
+} pipeline_t;
+
+/* Keeps an error of the expand stage, to be reported in order */
+static void defer_error(void *context, ErrorCode error, char *filename, int line_number, char *error_context) {
+	report_t *report = (report_t *)calloc(1, sizeof(report_t));
+
+	if (!report) {
+		return;
+	}
+	report->error = error;
+	report->filename = my_strdup(filename);
+	report->line_number = line_number;
+	report->error_context = error_context ? my_strdup(error_context) : NULL;
+	add_report((build_unit_t *)context, report);
+}
+
+/* Expand stage body: expands the files in order, up to PIPELINE_DEPTH files ahead of the assemble stage */
+static void *run_expand_stage(void *argument) {
+	pipeline_t *pipeline = (pipeline_t *)argument;
+	double start;
+	int i;
+
+	/* Expanding uses macro tables of its own, while the assemble stage uses the tables of the previous files */
+	use_thread_macros();
+	for (i = 0; i < pipeline->n_files; i++) {
+		build_unit_t *unit = &pipeline->units[i];
+
+		pthread_mutex_lock(&pipeline->lock);
+		while (i - pipeline->n_assembled >= PIPELINE_DEPTH) {
+			pthread_cond_wait(&pipeline->assembled, &pipeline->lock);
+		}
+		pthread_mutex_unlock(&pipeline->lock);
+
+		start = get_seconds();
+		set_error_handler(defer_error, unit);
+		unit->error = expand_file(unit);
+		unit->macros = detach_macros();
+		set_error_handler(NULL, NULL);
+		pipeline->expand_seconds += get_seconds() - start;
+
+		pthread_mutex_lock(&pipeline->lock);
+		pipeline->n_expanded++;
+		pthread_cond_signal(&pipeline->expanded);
+		pthread_mutex_unlock(&pipeline->lock);
+	}
+	return NULL;
+}
+
+/* Runs the pipeline, the calling thread is the assemble stage.
+   A file is reported once its outputs are written, in order, while the next files are assembled.
+   Returns 0 if all the files were built, 1 otherwise. */
+static int run_pipeline(pipeline_t *pipeline) {
+	pthread_t expand_thread;
+	double start = get_seconds();
+	double assemble_seconds = 0;
+	double waiting = 0;
+	double elapsed, assemble_start;
+	int n_finished = 0;
+	int failed = 0;
+	int i;
+
+	if (pthread_create(&expand_thread, NULL, run_expand_stage, pipeline) != 0) {
+		for (i = 0; i < pipeline->n_files; i++) {
+			failed |= build_file(pipeline->units[i].base, pipeline->units[i].options);
+		}
+		return failed;
+	}
+
+	set_background_output(1);
+	for (i = 0; i < pipeline->n_files; i++) {
+		build_unit_t *unit = &pipeline->units[i];
+
+		/* Take the next file in order, the number of files ready is the occupancy of the queue */
+		pthread_mutex_lock(&pipeline->lock);
+		waiting += pipeline->n_expanded - i;
+		while (pipeline->n_expanded <= i) {
+			pthread_cond_wait(&pipeline->expanded, &pipeline->lock);
+		}
+		pthread_mutex_unlock(&pipeline->lock);
+
+		assemble_start = get_seconds();
+		if (unit->macros) {
+			attach_macros(unit->macros);
+			unit->macros = NULL;
+		}
+		if (!unit->error) {
+			set_error_handler(defer_error, unit);
+			unit->error = assemble_file(unit);
+			set_error_handler(NULL, NULL);
+		}
+		purge_macros();
+		assemble_seconds += get_seconds() - assemble_start;
+
+		pthread_mutex_lock(&pipeline->lock);
+		pipeline->n_assembled++;
+		pthread_cond_signal(&pipeline->assembled);
+		pthread_mutex_unlock(&pipeline->lock);
+
+		/* Report the files whose outputs were written */
+		while (n_finished <= i && is_batch_written(&pipeline->units[n_finished].outputs)) {
+			failed |= finish_file(&pipeline->units[n_finished++]);
+		}
+	}
+	pthread_join(expand_thread, NULL);
+	set_background_output(0);
+	while (n_finished < pipeline->n_files) {
+		failed |= finish_file(&pipeline->units[n_finished++]);
+	}
+
+	/* Report how busy each stage was, the stage that is always busy limits the build */
+	elapsed = get_seconds() - start;
+	if (elapsed > 0) {
+		printf("Pipeline: expand %.0f%% busy, assemble %.0f%% busy, write %.0f%% busy, %.1f expanded files waiting on average.\n",
+			100 * pipeline->expand_seconds / elapsed,
+			100 * assemble_seconds / elapsed,
+			100 * get_writer_seconds() / elapsed,
+			waiting / pipeline->n_files);
+	}
+	return failed;
+}
+
+#endif /* _WIN32 */
+
+int build_files(char **files, build_options_t *options, int n_files) {
+	int failed = 0;
+	int i;
+
+#ifndef _WIN32
+	/* Several files are built as a pipeline: the next files are expanded and the outputs of
+	   the previous files are written, while a file is assembled */
+	if (n_files > 1) {
+		pipeline_t pipeline;
+
+		pipeline.units = (build_unit_t *)calloc(n_files, sizeof(build_unit_t));
+		if (pipeline.units) {
+			for (i = 0; i < n_files; i++) {
+				pipeline.units[i].base = files[i];
+				pipeline.units[i].options = &options[i];
+				pipeline.units[i].is_deferred = 1;
+				init_batch(&pipeline.units[i].outputs);
+			}
+			pipeline.n_files = n_files;
+			pipeline.n_expanded = 0;
+			pipeline.n_assembled = 0;
+			pipeline.expand_seconds = 0;
+			pthread_mutex_init(&pipeline.lock, NULL);
+			pthread_cond_init(&pipeline.expanded, NULL);
+			pthread_cond_init(&pipeline.assembled, NULL);
+
+			failed = run_pipeline(&pipeline);
+
+			pthread_mutex_destroy(&pipeline.lock);
+			pthread_cond_destroy(&pipeline.expanded);
+			pthread_cond_destroy(&pipeline.assembled);
+			free(pipeline.units);
+			return failed;
+		}
+	}
+#endif
+
+	/* Build each file, an error in a file does not stop the next ones */
+	for (i = 0; i < n_files; i++) {
+		failed |= build_file(files[i], &options[i]);
+	}
+	return failed;
+}
@@ -0,0 +1,34 @@
+#ifndef BUILD_H
+#define BUILD_H
+
+/* Options of building a file */
+typedef struct {
+	int debug;      /* Write a debug file (-g) */
+	int optimize;   /* Run the peephole optimizer (-O) */
+	int pool_data;  /* Share repeated data blocks (-P) */
+	int dependencies; /* Write a dependency file (-M) */
+	int stream_output; /* Write code words to the object file as they are assembled (-S) */
+} build_options_t;
+
+/**
+Builds a single source file: expands its macros, resolves its symbols and assembles it,
+then writes the output files next to it.
+All the tables are purged before returning, so files can be built one after the other.
+	@param base: The file name without the .as extension.
+	@param options: The build options.
+	@return: 0 if the file was built, 1 if there was an error.
+*/
+int build_file(char *base, build_options_t *options);
+
+/**
+Builds files one after the other, as build_file does, with the output in the same order.
+Several files are built as a pipeline of three stages, each on its own thread:
+expanding the macros of the next files, assembling a file, and writing the outputs of the previous files.
+	@param files: The file names without the .as extension.
+	@param options: The build options of each file.
+	@param n_files: The number of files.
+	@return: 0 if all the files were built, 1 otherwise.
+*/
+int build_files(char **files, build_options_t *options, int n_files);
+
+#endif /* BUILD_H */
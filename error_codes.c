@@ -1,6 +1,42 @@
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+	#include <pthread.h>
+#endif
+
 #include "error_codes.h"
 
+/* Handler of reported errors, errors are printed if there is none */
+typedef struct {
+	error_handler_t handler;
+	void *context;
+} error_handler_state_t;
+
+#ifndef _WIN32
+/* Each thread has its own handler */
+static pthread_key_t handler_key;
+static pthread_once_t handler_key_once = PTHREAD_ONCE_INIT;
+
+static void create_handler_key() {
+	pthread_key_create(&handler_key, free);
+}
+#else
+static error_handler_state_t error_handler = { NULL, NULL };
+#endif
+
+/* Returns the handler of the calling thread, or NULL if it has none */
+static error_handler_state_t *get_error_handler() {
+#ifndef _WIN32
+	pthread_once(&handler_key_once, create_handler_key);
+	return (error_handler_state_t *)pthread_getspecific(handler_key);
+#else
+	return &error_handler;
+#endif
+}
+
 int is_error(ErrorCode error, int * error_state, char *filename, int line_number, char *error_context) {
 	if (error == SUCCESS) {
 		return 0;
@@ -14,61 +50,115 @@ int is_error(ErrorCode error, int * error_state, char *filename, int line_number
 	return 1;
 }
 
-void print_error(ErrorCode error, char *filename, int line_number, char *error_context)
+const char *get_error_message(ErrorCode error)
 {
-	/* Print error file & line */
-	printf("error: %s", filename);
-	if (line_number > 0) {
-		printf(" line %d", line_number);
-	}
-	printf(": ");
-	
-	/* Print error details */
 	switch(error)
 	{
-		case ERR_FILE_NOT_EXIST: printf("file does not exist"); break;
-		case ERR_FILE_NAME_TOO_LONG: printf("file name is too long"); break;
-		case ERR_FILE_CANNOT_CREATE: printf("cannot create file"); break;
-		case ERR_OUT_OF_MEMORY: printf("out of memory"); break;
-		case ERR_INTERNAL_ASSERT: printf("internal error"); break;
-		case ERR_COMMA_MISSING: printf("missing comma"); break;
-		case ERR_COMMA_EXTRA: printf("extra comma"); break;
-		case ERR_LINE_TOO_LONG: printf("line is too long"); break;
-		case ERR_TRAILING_TEXT: printf("invalid trailing text"); break;
-		case ERR_EXCEEDED_RAM: printf("RAM size exceeded"); break;
+		case ERR_FILE_NOT_EXIST: return "file does not exist";
+		case ERR_FILE_NAME_TOO_LONG: return "file name is too long";
+		case ERR_FILE_CANNOT_CREATE: return "cannot create file";
+		case ERR_OUT_OF_MEMORY: return "out of memory";
+		case ERR_INTERNAL_ASSERT: return "internal error";
+		case ERR_COMMA_MISSING: return "missing comma";
+		case ERR_COMMA_EXTRA: return "extra comma";
+		case ERR_LINE_TOO_LONG: return "line is too long";
+		case ERR_TRAILING_TEXT: return "invalid trailing text";
+		case ERR_EXCEEDED_RAM: return "RAM size exceeded";
 
 		/* Macro errors */
-		case ERR_MACRO_REDEFINITION: printf("macro redefinition"); break;
-		case ERR_MACRO_ILLEGAL_NAME: printf("illegal macro name"); break;
-		case ERR_MACRO_NAME_TOO_LONG: printf("macro name is too long"); break;
-		case ERR_MACRO_RESERVED: printf("macro name is a reserved word"); break;
-		case ERR_MACRO_MISSING_NAME: printf("macro name is missing"); break;
+		case ERR_MACRO_REDEFINITION: return "macro redefinition";
+		case ERR_MACRO_ILLEGAL_NAME: return "illegal macro name";
+		case ERR_MACRO_NAME_TOO_LONG: return "macro name is too long";
+		case ERR_MACRO_RESERVED: return "macro name is a reserved word";
+		case ERR_MACRO_MISSING_NAME: return "macro name is missing";
 
 		/* Symbol errors */
-		case ERR_SYMBOL_ILLEGAL_NAME: printf("illegal symbol name"); break;
-		case ERR_SYMBOL_NAME_TOO_LONG: printf("symbol name is too long"); break;
-		case ERR_SYMBOL_REDEFINITION: printf("symbol redefinition"); break;
-		case ERR_SYMBOL_UNDEFINED: printf("symbol is undefined"); break;
-		case ERR_SYMBOL_RESERVED: printf("symbol name is a reserved word"); break;
-		case ERR_SYMBOL_ILLEGAL: printf("illegal symbol on empty line"); break;
-		case ERR_SYMBOL_AS_MACRO: printf("symbol and macro have the same name"); break;
-		case ERR_SYMBOL_ENTRY_UNDEFINED: printf("illegal entry, symbol is undefined"); break;
+		case ERR_SYMBOL_ILLEGAL_NAME: return "illegal symbol name";
+		case ERR_SYMBOL_NAME_TOO_LONG: return "symbol name is too long";
+		case ERR_SYMBOL_REDEFINITION: return "symbol redefinition";
+		case ERR_SYMBOL_UNDEFINED: return "symbol is undefined";
+		case ERR_SYMBOL_RESERVED: return "symbol name is a reserved word";
+		case ERR_SYMBOL_ILLEGAL: return "illegal symbol on empty line";
+		case ERR_SYMBOL_AS_MACRO: return "symbol and macro have the same name";
+		case ERR_SYMBOL_ENTRY_UNDEFINED: return "illegal entry, symbol is undefined";
 
 		/* String errors */
-		case ERR_STRING_ILLEGAL: printf("illegal string"); break;
+		case ERR_STRING_ILLEGAL: return "illegal string";
 
 		/* Operand errors */
-		case ERR_OPERAND_MISSING: printf("missing operand"); break;
+		case ERR_OPERAND_MISSING: return "missing operand";
 
 		/* Number errors */
-		case ERR_NUMBER_ILLEGAL: printf("illegal number"); break;
-		case ERR_NUMBER_OUT_OF_RANGE: printf("number is out of range"); break;
+		case ERR_NUMBER_ILLEGAL: return "illegal number";
+		case ERR_NUMBER_OUT_OF_RANGE: return "number is out of range";
 
 		/* Instruction errors */
-		case ERR_INSTRUCTION_ADDRESSING_NOT_ALLOWED: printf("addressing method is not allowed"); break;
-		case ERR_INSTRUCTION_INVALID: printf("invalid instruction"); break;
+		case ERR_INSTRUCTION_ADDRESSING_NOT_ALLOWED: return "addressing method is not allowed";
+		case ERR_INSTRUCTION_INVALID: return "invalid instruction";
+
+		/* Object errors */
+		case ERR_OBJECT_ILLEGAL: return "illegal object file";
+
+		/* Library errors */
+		case ERR_LIBRARY_ILLEGAL: return "illegal library";
+		case ERR_LIBRARY_ILLEGAL_LINE: return "only macros and external declarations are allowed in a library";
 
-		default: printf("unknown error %d", error); break;
+		/* Runtime errors */
+		case ERR_RUNTIME_ILLEGAL_INSTRUCTION: return "illegal instruction";
+		case ERR_RUNTIME_ILLEGAL_ADDRESS: return "illegal address";
+		case ERR_RUNTIME_EXTERNAL: return "unresolved external reference";
+		case ERR_RUNTIME_STACK_OVERFLOW: return "stack overflow";
+		case ERR_RUNTIME_STACK_UNDERFLOW: return "return with an empty stack";
+		case ERR_RUNTIME_LIMIT: return "instruction limit reached";
+
+		default: return NULL;
+	}
+}
+
+void set_error_handler(error_handler_t handler, void *context)
+{
+	error_handler_state_t *state = get_error_handler();
+
+#ifndef _WIN32
+	if (!state) {
+		if (!handler) {
+			return;
+		}
+		state = (error_handler_state_t *)malloc(sizeof(error_handler_state_t));
+		if (!state || pthread_setspecific(handler_key, state) != 0) {
+			free(state);
+			return;
+		}
+	}
+#endif
+	state->handler = handler;
+	state->context = context;
+}
+
+void print_error(ErrorCode error, char *filename, int line_number, char *error_context)
+{
+	const char *message = get_error_message(error);
+	error_handler_state_t *state = get_error_handler();
+
+	/* Errors are passed to the handler instead of being printed */
+	if (state && state->handler) {
+		state->handler(state->context, error, filename, line_number, error_context);
+		return;
+	}
+
+	/* Print error file & line */
+	printf("error: %s", filename);
+	if (line_number > 0) {
+		printf(" line %d", line_number);
+	}
+	printf(": ");
+	
+	/* Print error details */
+	if (message) {
+		printf("%s", message);
+	}
+	else {
+		printf("unknown error %d", error);
 	}
 
 	/* Print error context, If accepted */
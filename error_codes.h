@@ -46,10 +46,42 @@ typedef enum {
 
     /* Instruction errors */
     ERR_INSTRUCTION_ADDRESSING_NOT_ALLOWED,
-    ERR_INSTRUCTION_INVALID
+    ERR_INSTRUCTION_INVALID,
+
+    /* Object errors */
+    ERR_OBJECT_ILLEGAL,
+
+    /* Library errors */
+    ERR_LIBRARY_ILLEGAL,
+    ERR_LIBRARY_ILLEGAL_LINE,
+
+    /* Runtime errors */
+    ERR_RUNTIME_ILLEGAL_INSTRUCTION,
+    ERR_RUNTIME_ILLEGAL_ADDRESS,
+    ERR_RUNTIME_EXTERNAL,
+    ERR_RUNTIME_STACK_OVERFLOW,
+    ERR_RUNTIME_STACK_UNDERFLOW,
+    ERR_RUNTIME_LIMIT
 
 } ErrorCode;
 
+/* A handler of reported errors, see set_error_handler */
+typedef void (*error_handler_t)(void *context, ErrorCode error, char *filename, int line_number, char *error_context);
+
+/**
+Returns the description of an error code.
+    @param error The error code.
+    @return The error description, or NULL for an unknown error code.
+*/
+const char *get_error_message(ErrorCode error);
+
+/**
+Sets a handler that receives the errors reported by the calling thread instead of printing them.
+    @param handler The error handler, or NULL to print errors again.
+    @param context A pointer passed as is to the handler.
+*/
+void set_error_handler(error_handler_t handler, void *context);
+
 /**
 Prints a detailed error message based on the given error code.
     @param error The error code.
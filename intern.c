@@ -0,0 +1,264 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+	#include <pthread.h>
+#endif
+
+#include "language.h"
+#include "intern.h"
+
+#define INITIAL_SLOTS 1024
+#define ARENA_BLOCK_SIZE 65536
+#define NAME_CHUNK_SIZE 4096  /* Names per chunk */
+#define MAX_NAME_CHUNKS 1024
+
+/* An interned name, never changed once it has an id */
+typedef struct {
+	char *text;
+	unsigned int hash;
+} name_t;
+
+/* Open addressing table of name ids by hash, at most half full */
+typedef struct {
+	name_id_t *slots;
+	unsigned int n_slots;
+	int n_ids;
+} name_table_t;
+
+/* Names by id, in chunks that are never moved, so names are read without locking */
+static name_t *name_chunks[MAX_NAME_CHUNKS];
+static int n_names = 0;
+
+/* Ids 0 to n_reserved - 1 are the reserved words, added before any other name */
+static int n_reserved = 0;
+
+/* All the names, changed only with the lock held */
+static name_table_t shared_table;
+
+/* The texts of the names are stored one after the other in blocks that are never freed */
+static char *arena = NULL;
+static size_t arena_left = 0;
+
+#ifndef _WIN32
+static pthread_mutex_t names_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t names_once = PTHREAD_ONCE_INIT;
+static pthread_key_t table_key;
+	#define LOCK_NAMES() pthread_mutex_lock(&names_lock)
+	#define UNLOCK_NAMES() pthread_mutex_unlock(&names_lock)
+#else
+	#define LOCK_NAMES()
+	#define UNLOCK_NAMES()
+#endif
+
+#define NAME(id) (&name_chunks[(id) / NAME_CHUNK_SIZE][(id) % NAME_CHUNK_SIZE])
+
+/* FNV-1a hash of a name */
+static unsigned int hash_name(char *name) {
+	unsigned int hash = 2166136261u;
+
+	while (*name) {
+		hash = (hash ^ (unsigned char)*name++) * 16777619u;
+	}
+	return hash;
+}
+
+/* Returns the slot of a name in a table, or the empty slot where it belongs */
+static unsigned int find_slot(name_table_t *table, char *name, unsigned int hash) {
+	unsigned int slot = hash & (table->n_slots - 1);
+
+	while (table->slots[slot] != NO_NAME) {
+		name_t *entry = NAME(table->slots[slot]);
+		if (entry->hash == hash && strcmp(entry->text, name) == 0) {
+			break;
+		}
+		slot = (slot + 1) & (table->n_slots - 1);
+	}
+	return slot;
+}
+
+/* Looks up a name in a table */
+static name_id_t find_in_table(name_table_t *table, char *name, unsigned int hash) {
+	if (table->n_slots == 0) {
+		return NO_NAME;
+	}
+	return table->slots[find_slot(table, name, hash)];
+}
+
+/* Adds a name id to a table that does not hold it, doubling the table when half full */
+static int add_to_table(name_table_t *table, name_id_t id) {
+	name_t *entry = NAME(id);
+
+	if ((unsigned int)table->n_ids * 2 >= table->n_slots) {
+		unsigned int capacity = table->n_slots ? table->n_slots * 2 : INITIAL_SLOTS;
+		name_id_t *old_slots = table->slots;
+		unsigned int old_n_slots = table->n_slots;
+		unsigned int i;
+
+		table->slots = (name_id_t *)malloc(capacity * sizeof(name_id_t));
+		if (!table->slots) {
+			table->slots = old_slots;
+			return 0;
+		}
+		table->n_slots = capacity;
+		for (i = 0; i < capacity; i++) {
+			table->slots[i] = NO_NAME;
+		}
+		for (i = 0; i < old_n_slots; i++) {
+			if (old_slots[i] != NO_NAME) {
+				name_t *moved = NAME(old_slots[i]);
+				table->slots[find_slot(table, moved->text, moved->hash)] = old_slots[i];
+			}
+		}
+		free(old_slots);
+	}
+	table->slots[find_slot(table, entry->text, entry->hash)] = id;
+	table->n_ids++;
+	return 1;
+}
+
+/* Copies a name text into the arena */
+static char *store_text(char *name) {
+	size_t length = strlen(name) + 1;
+	char *text;
+
+	if (length > arena_left) {
+		size_t size = length > ARENA_BLOCK_SIZE ? length : ARENA_BLOCK_SIZE;
+		arena = (char *)malloc(size);
+		if (!arena) {
+			arena_left = 0;
+			return NULL;
+		}
+		arena_left = size;
+	}
+	text = arena;
+	memcpy(text, name, length);
+	arena += length;
+	arena_left -= length;
+	return text;
+}
+
+/* Adds a new name to the shared table, with the lock held */
+static name_id_t add_name(char *name, unsigned int hash) {
+	name_id_t id = n_names;
+	name_t *entry;
+
+	if (id / NAME_CHUNK_SIZE >= MAX_NAME_CHUNKS) {
+		return NO_NAME;
+	}
+	if (!name_chunks[id / NAME_CHUNK_SIZE]) {
+		name_chunks[id / NAME_CHUNK_SIZE] = (name_t *)malloc(NAME_CHUNK_SIZE * sizeof(name_t));
+		if (!name_chunks[id / NAME_CHUNK_SIZE]) {
+			return NO_NAME;
+		}
+	}
+	entry = NAME(id);
+	entry->text = store_text(name);
+	if (!entry->text) {
+		return NO_NAME;
+	}
+	entry->hash = hash;
+	if (!add_to_table(&shared_table, id)) {
+		return NO_NAME;
+	}
+	n_names++;
+	return id;
+}
+
+/* Adds the reserved words first, so a name is reserved by its id alone */
+static void add_reserved_names() {
+	char *word;
+
+	while ((word = get_reserved_word(n_reserved)) && add_name(word, hash_name(word)) != NO_NAME) {
+		n_reserved++;
+	}
+}
+
+/* Thread tables ------------------------------------------------ */
+
+#ifndef _WIN32
+
+/* Frees the table of an exiting thread */
+static void free_thread_table(void *table) {
+	free(((name_table_t *)table)->slots);
+	free(table);
+}
+
+static void init_names() {
+	pthread_key_create(&table_key, free_thread_table);
+	add_reserved_names();
+}
+
+/* Returns the lookup table of the calling thread, with the names it already met, or NULL if out of memory.
+   Each thread looks up names in its own table, and takes the lock only for names it meets first. */
+static name_table_t *get_thread_table() {
+	name_table_t *table;
+
+	pthread_once(&names_once, init_names);
+	table = (name_table_t *)pthread_getspecific(table_key);
+	if (!table) {
+		table = (name_table_t *)calloc(1, sizeof(name_table_t));
+		if (table && pthread_setspecific(table_key, table) != 0) {
+			free(table);
+			table = NULL;
+		}
+	}
+	return table;
+}
+
+#else
+
+/* A single thread looks up the shared table */
+static name_table_t *get_thread_table() {
+	if (shared_table.n_slots == 0) {
+		add_reserved_names();
+	}
+	return NULL;
+}
+
+#endif
+
+/* Looks up a name, adding it when asked to */
+static name_id_t lookup_name(char *name, int can_add) {
+	unsigned int hash = hash_name(name);
+	name_table_t *table = get_thread_table();
+	name_id_t id;
+
+	if (table) {
+		id = find_in_table(table, name, hash);
+		if (id != NO_NAME) {
+			return id;
+		}
+	}
+
+	/* First time the thread meets the name */
+	LOCK_NAMES();
+	id = find_in_table(&shared_table, name, hash);
+	if (id == NO_NAME && can_add) {
+		id = add_name(name, hash);
+	}
+	UNLOCK_NAMES();
+
+	if (table && id != NO_NAME && !add_to_table(table, id)) {
+		return NO_NAME;
+	}
+	return id;
+}
+
+name_id_t intern_name(char *name) {
+	return lookup_name(name, 1);
+}
+
+name_id_t find_name(char *name) {
+	return lookup_name(name, 0);
+}
+
+char *get_name(name_id_t id) {
+	return NAME(id)->text;
+}
+
+int is_reserved_name(name_id_t id) {
+	return id >= 0 && id < n_reserved;
+}
@@ -0,0 +1,44 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+/* A small integer standing for an interned name */
+typedef int name_id_t;
+
+/* Returned when a name is not interned */
+#define NO_NAME (-1)
+
+/**
+Interns a name: returns the id of the name, adding it to the pool on first use.
+Equal names get the same id, so names are compared by their ids.
+The pool is shared by all threads, and names stay in it until the process exits,
+so only names that are defined or referenced should be interned.
+Each thread looks names up in a table of its own, the pool is locked only when
+a thread meets a name for the first time.
+	@param name: The name.
+	@return: The id of the name, or NO_NAME if out of memory.
+*/
+name_id_t intern_name(char *name);
+
+/**
+Looks up the id of a name, without adding it.
+	@param name: The name.
+	@return: The id of the name, or NO_NAME if it was never interned.
+*/
+name_id_t find_name(char *name);
+
+/**
+Returns the text of an interned name.
+	@param id: The id of the name.
+	@return: The name, valid until the process exits.
+*/
+char *get_name(name_id_t id);
+
+/**
+Checks if an interned name is a reserved word of the language.
+The reserved words are interned before any other name, so they are found without being added.
+	@param id: The id of the name, or NO_NAME.
+	@return: 1 if the name is reserved, 0 otherwise.
+*/
+int is_reserved_name(name_id_t id);
+
+#endif /* INTERN_H */
@@ -0,0 +1,364 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+	#include <unistd.h>
+	#include <fcntl.h>
+	#include <poll.h>
+	#include <sys/types.h>
+	#include <sys/stat.h>
+	#include <sys/wait.h>
+#endif
+
+#include "error_codes.h"
+#include "utils.h"
+#include "output.h"
+#include "jobs.h"
+
+/* Time to wait for a job slot before checking for finished workers, in milliseconds */
+#define SLOT_POLL_MS 10
+
+/* A file to build */
+typedef struct {
+	int index;              /* Index of the file in the input list */
+	long size;              /* Size of its source, 0 if it cannot be read */
+} job_t;
+
+#ifndef _WIN32
+
+/* A running worker process */
+typedef struct {
+	pid_t pid;
+	int index;              /* Index of the file it builds */
+	FILE *output;           /* Its standard output */
+	int counts_fd;          /* Read end of the pipe it reports its unchanged outputs on */
+	int has_slot;           /* Nonzero if it holds a job slot of the jobserver */
+	char slot;              /* The token of its job slot */
+} worker_t;
+
+/* The jobserver of GNU make, if the assembler runs under one */
+typedef struct {
+	int read_fd;
+	int write_fd;
+	int is_fifo;            /* Nonzero if the descriptors were opened from a named pipe */
+} jobserver_t;
+
+/**
+Finds the jobserver in MAKEFLAGS.
+Make passes either "--jobserver-auth=R,W" with inherited pipe descriptors, or "--jobserver-auth=fifo:PATH".
+Older versions use "--jobserver-fds=R,W". Descriptors that were not inherited, as make closes them
+for commands it does not consider recursive, are ignored.
+Tokens are read without blocking, as make and its other jobs may take a token between poll and read.
+The pipe is shared with them, so it is opened again for a description of our own that can be
+non-blocking; if that fails, only the slot make gave the assembler itself is used.
+*/
+static int open_jobserver(jobserver_t *jobserver) {
+	char path[MAX_FILE_NAME];
+	char *flags = getenv("MAKEFLAGS");
+	char *auth;
+	size_t length;
+
+	jobserver->read_fd = -1;
+	jobserver->write_fd = -1;
+	jobserver->is_fifo = 0;
+	if (!flags) {
+		return 0;
+	}
+	auth = strstr(flags, "--jobserver-auth=");
+	if (auth) {
+		auth += strlen("--jobserver-auth=");
+	}
+	else if ((auth = strstr(flags, "--jobserver-fds=")) != NULL) {
+		auth += strlen("--jobserver-fds=");
+	}
+	else {
+		return 0;
+	}
+
+	if (strncmp(auth, "fifo:", 5) == 0) {
+		auth += 5;
+		length = strcspn(auth, " ");
+		if (length >= MAX_FILE_NAME) {
+			return 0;
+		}
+		strncpy(path, auth, length);
+		path[length] = '\0';
+		jobserver->read_fd = open(path, O_RDWR | O_NONBLOCK);
+		if (jobserver->read_fd < 0) {
+			return 0;
+		}
+		jobserver->write_fd = jobserver->read_fd;
+		jobserver->is_fifo = 1;
+		return 1;
+	}
+
+	if (sscanf(auth, "%d,%d", &jobserver->read_fd, &jobserver->write_fd) != 2 ||
+		fcntl(jobserver->read_fd, F_GETFD) == -1 || fcntl(jobserver->write_fd, F_GETFD) == -1) {
+		jobserver->read_fd = -1;
+		jobserver->write_fd = -1;
+		return 0;
+	}
+	sprintf(path, "/dev/fd/%d", jobserver->read_fd);
+	jobserver->read_fd = open(path, O_RDONLY | O_NONBLOCK);
+	if (jobserver->read_fd >= 0 && !(fcntl(jobserver->read_fd, F_GETFL) & O_NONBLOCK)) {
+		/* Opened as a duplicate, which shares the blocking mode */
+		close(jobserver->read_fd);
+		jobserver->read_fd = -1;
+	}
+	if (jobserver->read_fd < 0) {
+		jobserver->write_fd = -1;
+		return 0;
+	}
+	return 1;
+}
+
+/**
+Takes a job slot for a new worker.
+The first worker uses the slot make gave the assembler itself. Any other worker needs a token
+from the jobserver, which is waited for a short while only, so finished workers are not left waiting.
+The caller tries again after checking for finished workers.
+*/
+static int take_slot(jobserver_t *jobserver, worker_t *worker, int running) {
+	struct pollfd poll_fd;
+
+	worker->has_slot = 0;
+	if (running == 0 || jobserver->read_fd < 0) {
+		return 1;
+	}
+	poll_fd.fd = jobserver->read_fd;
+	poll_fd.events = POLLIN;
+	if (poll(&poll_fd, 1, SLOT_POLL_MS) <= 0) {
+		return 0;
+	}
+	/* Another job may have taken the token since */
+	if (read(jobserver->read_fd, &worker->slot, 1) != 1) {
+		return 0;
+	}
+	worker->has_slot = 1;
+	return 1;
+}
+
+/* Gives the job slot of a finished worker back to the jobserver */
+static void give_slot(jobserver_t *jobserver, worker_t *worker) {
+	if (worker->has_slot) {
+		while (write(jobserver->write_fd, &worker->slot, 1) != 1) {
+		}
+		worker->has_slot = 0;
+	}
+}
+
+/* Copies the output of a finished worker to the standard output, and adds the outputs it kept */
+static void report_worker(worker_t *worker) {
+	char buffer[4096];
+	size_t length;
+	int unchanged;
+
+	rewind(worker->output);
+	while ((length = fread(buffer, 1, sizeof(buffer), worker->output)) > 0) {
+		fwrite(buffer, 1, length, stdout);
+	}
+	fflush(stdout);
+	fclose(worker->output);
+	worker->output = NULL;
+
+	/* Nothing is read if the worker did not finish */
+	if (read(worker->counts_fd, &unchanged, sizeof(int)) == sizeof(int)) {
+		add_unchanged_outputs(unchanged);
+	}
+	close(worker->counts_fd);
+}
+
+/**
+Starts a worker process that builds a single file, with its output kept in a temporary file.
+The worker writes the number of outputs it kept to a pipe, which holds it till the worker is reported.
+*/
+static int start_worker(worker_t *worker, char *base, build_options_t *options) {
+	int counts[2];
+
+	worker->output = tmpfile();
+	if (!worker->output) {
+		return 0;
+	}
+	if (pipe(counts) != 0) {
+		fclose(worker->output);
+		worker->output = NULL;
+		return 0;
+	}
+	fflush(stdout);
+	worker->pid = fork();
+	if (worker->pid == 0) {
+		int status;
+		/* The count copied from the parent is already added there */
+		int unchanged = get_unchanged_outputs();
+		close(counts[0]);
+		dup2(fileno(worker->output), STDOUT_FILENO);
+		status = build_file(base, options);
+		fflush(stdout);
+		unchanged = get_unchanged_outputs() - unchanged;
+		if (write(counts[1], &unchanged, sizeof(int)) != sizeof(int)) {
+			status = 1;
+		}
+		_exit(status);
+	}
+	close(counts[1]);
+	if (worker->pid < 0) {
+		close(counts[0]);
+		fclose(worker->output);
+		worker->output = NULL;
+		return 0;
+	}
+	worker->counts_fd = counts[0];
+	return 1;
+}
+
+#endif /* _WIN32 */
+
+/* Orders jobs by decreasing source size, then by input order */
+static int compare_jobs(const void *a, const void *b) {
+	const job_t *first = (const job_t *)a;
+	const job_t *second = (const job_t *)b;
+
+	if (first->size != second->size) {
+		return first->size > second->size ? -1 : 1;
+	}
+	return first->index - second->index;
+}
+
+/* Lists the files to build, largest source first */
+static job_t *schedule_jobs(char **files, int n_files) {
+	char source[MAX_FILE_NAME];
+	job_t *jobs;
+	int i;
+
+	jobs = (job_t *)malloc(n_files * sizeof(job_t));
+	if (!jobs) {
+		return NULL;
+	}
+	for (i = 0; i < n_files; i++) {
+		jobs[i].index = i;
+		jobs[i].size = 0;
+		if (is_filename_too_long(files[i])) {
+			continue;
+		}
+		get_filename(files[i], "as", source);
+#ifndef _WIN32
+		{
+			struct stat info;
+			if (stat(source, &info) == 0) {
+				jobs[i].size = (long)info.st_size;
+			}
+		}
+#else
+		{
+			FILE *file = fopen(source, "r");
+			if (file) {
+				fseek(file, 0, SEEK_END);
+				jobs[i].size = ftell(file);
+				fclose(file);
+			}
+		}
+#endif
+	}
+	qsort(jobs, n_files, sizeof(job_t), compare_jobs);
+	return jobs;
+}
+
+#ifndef _WIN32
+
+int jobs_process(char **files, build_options_t *options, int n_files, int n_jobs) {
+	jobserver_t jobserver;
+	worker_t *workers;
+	job_t *jobs;
+	int running = 0;
+	int failed = 0;
+	int next = 0;
+	int i;
+
+	if (n_files == 0) {
+		return 0;
+	}
+	if (n_jobs > n_files) {
+		n_jobs = n_files;
+	}
+	jobs = schedule_jobs(files, n_files);
+	workers = (worker_t *)calloc(n_jobs, sizeof(worker_t));
+	if (!jobs || !workers) {
+		is_error(ERR_OUT_OF_MEMORY, NULL, "jobs", 0, NULL);
+		free(jobs);
+		free(workers);
+		return 1;
+	}
+	open_jobserver(&jobserver);
+
+	while (next < n_files || running > 0) {
+		int status;
+		pid_t pid;
+
+		/* Start the next file while there is a free worker and a job slot for it */
+		if (next < n_files && running < n_jobs) {
+			worker_t *worker = NULL;
+			for (i = 0; i < n_jobs && !worker; i++) {
+				if (workers[i].pid == 0) {
+					worker = &workers[i];
+				}
+			}
+			if (take_slot(&jobserver, worker, running)) {
+				int index = jobs[next++].index;
+				worker->index = index;
+				if (start_worker(worker, files[index], &options[index])) {
+					running++;
+				}
+				else {
+					/* No process for it: build the file here */
+					give_slot(&jobserver, worker);
+					worker->pid = 0;
+					failed |= build_file(files[index], &options[index]);
+				}
+				continue;
+			}
+		}
+
+		/* Wait for a worker to finish, without waiting while more files could start */
+		pid = waitpid(-1, &status, (next < n_files && running < n_jobs) ? WNOHANG : 0);
+		if (pid < 0) {
+			break;
+		}
+		for (i = 0; i < n_jobs && pid > 0; i++) {
+			if (workers[i].pid == pid) {
+				report_worker(&workers[i]);
+				give_slot(&jobserver, &workers[i]);
+				workers[i].pid = 0;
+				running--;
+				failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+			}
+		}
+	}
+
+	if (jobserver.read_fd >= 0) {
+		close(jobserver.read_fd);
+	}
+	free(workers);
+	free(jobs);
+	return failed;
+}
+
+#else /* _WIN32 */
+
+/* No worker processes: the files are built one after the other, in the same order */
+int jobs_process(char **files, build_options_t *options, int n_files, int n_jobs) {
+	job_t *jobs = schedule_jobs(files, n_files);
+	int failed = 0;
+	int i;
+
+	for (i = 0; i < n_files; i++) {
+		int index = jobs ? jobs[i].index : i;
+		failed |= build_file(files[index], &options[index]);
+	}
+	free(jobs);
+	return failed;
+}
+
+#endif /* _WIN32 */
@@ -0,0 +1,20 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include "build.h"
+
+/**
+Builds files on worker processes, one file per process, with up to n_jobs processes at a time.
+The files are started largest source first, so a large file does not start last and leave the
+other workers idle. The output of each file is kept together, and files are reported as they finish.
+When run by GNU make with a jobserver, each worker after the first takes a job slot from make,
+and gives it back when it finishes, so the build shares the processors with the other steps of make.
+	@param files: The file names without the .as extension.
+	@param options: The build options of each file.
+	@param n_files: The number of files.
+	@param n_jobs: The maximum number of worker processes.
+	@return: 0 if all the files were built, 1 otherwise.
+*/
+int jobs_process(char **files, build_options_t *options, int n_files, int n_jobs);
+
+#endif /* JOBS_H */
@@ -0,0 +1,313 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "json.h"
+
+#define MAX_DEPTH 64
+
+static json_t *parse_value(const char **text, int depth);
+
+/* Skips whitespace between tokens */
+static void skip_spaces(const char **text) {
+	while (**text && isspace((unsigned char)**text)) {
+		(*text)++;
+	}
+}
+
+/* Allocates an empty value of the given type */
+static json_t *new_value(json_type_t type) {
+	json_t *value = (json_t *)calloc(1, sizeof(json_t));
+	if (value) {
+		value->type = type;
+	}
+	return value;
+}
+
+/* Returns the value of a hex digit, or -1 */
+static int hex_digit(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+	if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+	return -1;
+}
+
+/* Parses a quoted string into a new zero terminated UTF-8 string */
+static char *parse_string(const char **text) {
+	const char *pos = *text + 1;
+	const char *end = pos;
+	char *string, *out;
+
+	/* Find the closing quote, the unescaped string is never longer than the quoted one */
+	while (*end && *end != '"') {
+		end += (*end == '\\' && end[1]) ? 2 : 1;
+	}
+	string = (char *)malloc(end - pos + 1);
+	if (!string) {
+		return NULL;
+	}
+
+	out = string;
+	while (*pos && *pos != '"') {
+		if (*pos != '\\') {
+			*out++ = *pos++;
+			continue;
+		}
+		pos++;
+		switch (*pos) {
+			case '"': *out++ = '"'; break;
+			case '\\': *out++ = '\\'; break;
+			case '/': *out++ = '/'; break;
+			case 'b': *out++ = '\b'; break;
+			case 'f': *out++ = '\f'; break;
+			case 'n': *out++ = '\n'; break;
+			case 'r': *out++ = '\r'; break;
+			case 't': *out++ = '\t'; break;
+			case 'u': {
+				unsigned int code = 0;
+				int i;
+				for (i = 1; i <= 4; i++) {
+					int digit = hex_digit(pos[i]);
+					if (digit < 0) {
+						free(string);
+						return NULL;
+					}
+					code = code * 16 + digit;
+				}
+				pos += 4;
+
+				/* Surrogate pairs are outside the assembler's character set */
+				if (code >= 0xd800 && code <= 0xdfff) {
+					*out++ = '?';
+				}
+				else if (code < 0x80) {
+					*out++ = (char)code;
+				}
+				else if (code < 0x800) {
+					*out++ = (char)(0xc0 | (code >> 6));
+					*out++ = (char)(0x80 | (code & 0x3f));
+				}
+				else {
+					*out++ = (char)(0xe0 | (code >> 12));
+					*out++ = (char)(0x80 | ((code >> 6) & 0x3f));
+					*out++ = (char)(0x80 | (code & 0x3f));
+				}
+				break;
+			}
+			default:
+				free(string);
+				return NULL;
+		}
+		pos++;
+	}
+	if (*pos != '"') {
+		free(string);
+		return NULL;
+	}
+	*out = '\0';
+	*text = pos + 1;
+	return string;
+}
+
+/* Parses the elements of an array or the members of an object */
+static json_t *parse_container(const char **text, int depth, json_type_t type) {
+	char close = type == JSON_ARRAY ? ']' : '}';
+	json_t *container = new_value(type);
+	json_t *tail = NULL;
+
+	if (!container) {
+		return NULL;
+	}
+	(*text)++;
+	skip_spaces(text);
+	if (**text == close) {
+		(*text)++;
+		return container;
+	}
+
+	while (1) {
+		json_t *element;
+		char *key = NULL;
+
+		/* Object members start with their name */
+		if (type == JSON_OBJECT) {
+			skip_spaces(text);
+			if (**text != '"' || !(key = parse_string(text))) {
+				json_free(container);
+				return NULL;
+			}
+			skip_spaces(text);
+			if (**text != ':') {
+				free(key);
+				json_free(container);
+				return NULL;
+			}
+			(*text)++;
+		}
+
+		element = parse_value(text, depth + 1);
+		if (!element) {
+			free(key);
+			json_free(container);
+			return NULL;
+		}
+		element->key = key;
+		if (tail) {
+			tail->next = element;
+		}
+		else {
+			container->child = element;
+		}
+		tail = element;
+
+		skip_spaces(text);
+		if (**text == ',') {
+			(*text)++;
+			continue;
+		}
+		if (**text == close) {
+			(*text)++;
+			return container;
+		}
+		json_free(container);
+		return NULL;
+	}
+}
+
+static json_t *parse_value(const char **text, int depth) {
+	json_t *value = NULL;
+
+	if (depth > MAX_DEPTH) {
+		return NULL;
+	}
+	skip_spaces(text);
+
+	switch (**text) {
+		case '{':
+			return parse_container(text, depth, JSON_OBJECT);
+		case '[':
+			return parse_container(text, depth, JSON_ARRAY);
+		case '"':
+			value = new_value(JSON_STRING);
+			if (value && !(value->string = parse_string(text))) {
+				free(value);
+				value = NULL;
+			}
+			return value;
+		case 't':
+		case 'f':
+		case 'n':
+			if (strncmp(*text, "true", 4) == 0) {
+				value = new_value(JSON_BOOL);
+				*text += 4;
+				if (value) {
+					value->number = 1;
+				}
+			}
+			else if (strncmp(*text, "false", 5) == 0) {
+				value = new_value(JSON_BOOL);
+				*text += 5;
+			}
+			else if (strncmp(*text, "null", 4) == 0) {
+				value = new_value(JSON_NULL);
+				*text += 4;
+			}
+			return value;
+		default: {
+			char *end;
+			double number = strtod(*text, &end);
+			if (end == *text) {
+				return NULL;
+			}
+			*text = end;
+			value = new_value(JSON_NUMBER);
+			if (value) {
+				value->number = number;
+			}
+			return value;
+		}
+	}
+}
+
+json_t *json_parse(const char *text) {
+	json_t *value = parse_value(&text, 0);
+
+	/* Nothing but whitespace may follow the value */
+	skip_spaces(&text);
+	if (value && *text) {
+		json_free(value);
+		return NULL;
+	}
+	return value;
+}
+
+json_t *json_get(json_t *object, const char *key) {
+	json_t *member;
+
+	if (!object || object->type != JSON_OBJECT) {
+		return NULL;
+	}
+	for (member = object->child; member; member = member->next) {
+		if (strcmp(member->key, key) == 0) {
+			return member;
+		}
+	}
+	return NULL;
+}
+
+int json_get_int(json_t *object, const char *key, int fallback) {
+	json_t *member = json_get(object, key);
+	if (!member || member->type != JSON_NUMBER) {
+		return fallback;
+	}
+	return (int)member->number;
+}
+
+char *json_get_string(json_t *object, const char *key) {
+	json_t *member = json_get(object, key);
+	if (!member || member->type != JSON_STRING) {
+		return NULL;
+	}
+	return member->string;
+}
+
+void json_free(json_t *value) {
+	while (value) {
+		json_t *next = value->next;
+		json_free(value->child);
+		free(value->string);
+		free(value->key);
+		free(value);
+		value = next;
+	}
+}
+
+void json_write_string(FILE *file, const char *string) {
+	fputc('"', file);
+	for (; *string; string++) {
+		unsigned char c = (unsigned char)*string;
+		if (c == '"' || c == '\\') {
+			fputc('\\', file);
+			fputc(c, file);
+		}
+		else if (c == '\n') {
+			fputs("\\n", file);
+		}
+		else if (c == '\t') {
+			fputs("\\t", file);
+		}
+		else if (c < 0x20) {
+			fprintf(file, "\\u%04x", c);
+		}
+		else {
+			fputc(c, file);
+		}
+	}
+	fputc('"', file);
+}
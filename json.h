@@ -0,0 +1,71 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stdio.h>
+
+/* JSON value types */
+typedef enum {
+	JSON_NULL,
+	JSON_BOOL,
+	JSON_NUMBER,
+	JSON_STRING,
+	JSON_ARRAY,
+	JSON_OBJECT
+} json_type_t;
+
+/* A parsed JSON value. Array elements and object members are linked lists of values. */
+typedef struct json_t {
+	json_type_t type;
+	double number;          /* Number value, or 1/0 for a boolean */
+	char *string;           /* String value */
+	char *key;              /* Member name, inside an object */
+	struct json_t *child;   /* First element or member */
+	struct json_t *next;    /* Next element or member */
+} json_t;
+
+/**
+Parses a JSON text.
+	@param text: The zero terminated text.
+	@return: The parsed value, or NULL if the text is not valid JSON or out of memory.
+*/
+json_t *json_parse(const char *text);
+
+/**
+Returns a member of an object.
+	@param object: The object, may be NULL.
+	@param key: The member name.
+	@return: The member value, or NULL if there is no such member.
+*/
+json_t *json_get(json_t *object, const char *key);
+
+/**
+Returns the number value of a member of an object.
+	@param object: The object, may be NULL.
+	@param key: The member name.
+	@param fallback: The value returned if there is no such number member.
+	@return: The number value.
+*/
+int json_get_int(json_t *object, const char *key, int fallback);
+
+/**
+Returns the string value of a member of an object.
+	@param object: The object, may be NULL.
+	@param key: The member name.
+	@return: The string value, or NULL if there is no such string member.
+*/
+char *json_get_string(json_t *object, const char *key);
+
+/**
+Frees a parsed value.
+	@param value: The value, may be NULL.
+*/
+void json_free(json_t *value);
+
+/**
+Writes a string as a quoted JSON string.
+	@param file: The file pointer where the string will be written.
+	@param string: The string.
+*/
+void json_write_string(FILE *file, const char *string);
+
+#endif /* JSON_H */
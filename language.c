@@ -48,6 +48,28 @@ ErrorCode get_instruction(char *name, instruction_t **instruction) {
 	return ERR_INSTRUCTION_INVALID;
 }
 
+ErrorCode get_instruction_by_index(int index, instruction_t **instruction) {
+	int n = sizeof(instructions)/sizeof(instruction_t);
+	if (index < 0 || index >= n) {
+		return ERR_INSTRUCTION_INVALID;
+	}
+	*instruction = &instructions[index];
+	return SUCCESS;
+}
+
+ErrorCode get_instruction_by_code(int opcode, int funct, instruction_t **instruction) {
+	int i;
+	int n = sizeof(instructions)/sizeof(instruction_t);
+	/* Search for instruction in the array */
+	for (i = 0; i < n; i++) {
+		if (instructions[i].opcode == opcode && instructions[i].funct == funct) {
+			*instruction = &instructions[i];
+			return SUCCESS;
+		}
+	}
+	return ERR_INSTRUCTION_INVALID;
+}
+
 int is_label(char *word) {
 	return word[strlen(word) -1] == ':';
 }
@@ -60,6 +82,14 @@ int is_string(char *word) {
 	return strcmp(word, ".string") == 0;
 }
 
+int is_fill(char *word) {
+	return strcmp(word, ".fill") == 0;
+}
+
+int is_space(char *word) {
+	return strcmp(word, ".space") == 0;
+}
+
 int is_extern(char *word) {
 	return strcmp(word, ".extern") == 0;
 }
@@ -68,15 +98,42 @@ int is_entry(char *word) {
 	return strcmp(word, ".entry") == 0;
 }
 
+int is_include(char *word) {
+	return strcmp(word, ".include") == 0;
+}
+
+/* Reserved words that are not instruction names */
+static char *keywords[] = {
+	"r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7",
+	"data", "string", "fill", "space", "extern", "entry", "include", "mcro"
+};
+
 int is_reserved_word(char *word) {
-	return 
-		is_instruction(word) ||
-		is_register(word, NULL) ||
-		strcmp(word, "data") == 0 ||
-		strcmp(word, "string") == 0 ||
-		strcmp(word, "extern") == 0 ||
-		strcmp(word, "entry") == 0 ||
-		strcmp(word, "mcro") == 0;
+	int i;
+	int n = sizeof(keywords)/sizeof(char *);
+
+	if (is_instruction(word)) {
+		return 1;
+	}
+	for (i = 0; i < n; i++) {
+		if (strcmp(word, keywords[i]) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+char *get_reserved_word(int index) {
+	int n_instructions = sizeof(instructions)/sizeof(instruction_t);
+	int n_keywords = sizeof(keywords)/sizeof(char *);
+
+	if (index < 0 || index >= n_instructions + n_keywords) {
+		return NULL;
+	}
+	if (index < n_instructions) {
+		return instructions[index].name;
+	}
+	return keywords[index - n_instructions];
 }
 
 int is_register(char *word, int *reg) {
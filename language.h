@@ -22,6 +22,17 @@ typedef enum {
 	REG = 3
 } addressing_t;
 
+/* Directives */
+typedef enum {
+	DIRECTIVE_DATA,
+	DIRECTIVE_STRING,
+	DIRECTIVE_FILL,
+	DIRECTIVE_SPACE,
+	DIRECTIVE_EXTERN,
+	DIRECTIVE_ENTRY,
+	DIRECTIVE_INCLUDE
+} directive_t;
+
 /* Assembly instruction */
 typedef struct instruction_t {
 	char *name;
@@ -46,6 +57,23 @@ Retrieves the instruction structure associated with a given instruction name.
 */
 ErrorCode get_instruction(char *name, instruction_t **instruction);
 
+/**
+Retrieves the instruction structure at an index of the instructions table, as stored in tokens.
+	@param index The index of the instruction.
+	@param instruction Pointer to store the retrieved instruction structure.
+	@return ErrorCode indicating success or failure.
+*/
+ErrorCode get_instruction_by_index(int index, instruction_t **instruction);
+
+/**
+Retrieves the instruction structure associated with an encoded opcode and funct.
+	@param opcode The instruction opcode.
+	@param funct The instruction function code.
+	@param instruction Pointer to store the retrieved instruction structure.
+	@return ErrorCode indicating success or failure.
+*/
+ErrorCode get_instruction_by_code(int opcode, int funct, instruction_t **instruction);
+
 /**
 Checks if the given word represents a register.
 	@param word The word to check.
@@ -75,6 +103,20 @@ Checks if the given word represents a string directive.
 */
 int is_string(char *word);
 
+/**
+Checks if the given word represents a fill directive.
+	@param word The word to check.
+	@return 1 if the word is a fill directive, 0 otherwise.
+*/
+int is_fill(char *word);
+
+/**
+Checks if the given word represents a space directive.
+	@param word The word to check.
+	@return 1 if the word is a space directive, 0 otherwise.
+*/
+int is_space(char *word);
+
 /**
 Checks if the given word is an "extern" directive.
 	@param word The word to check.
@@ -89,6 +131,13 @@ Checks if the given word is an "entry" directive.
 */
 int is_entry(char *word);
 
+/**
+Checks if the given word is an "include" directive.
+	@param word The word to check.
+	@return 1 if the word is an "include" directive, 0 otherwise.
+*/
+int is_include(char *word);
+
 /**
 Checks if the given word is a reserved keyword in the assembly language.
 	@param word The word to check.
@@ -96,6 +145,13 @@ Checks if the given word is a reserved keyword in the assembly language.
 */
 int is_reserved_word(char *word);
 
+/**
+Lists the reserved keywords of the assembly language, one by one.
+	@param index The index of the word, from 0.
+	@return The reserved word, or NULL past the last one.
+*/
+char *get_reserved_word(int index);
+
 /**
 Validates if the given addressing method is allowed for an instruction operand.
 	@param addressing The addressing method used.
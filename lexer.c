@@ -0,0 +1,97 @@
+#include <string.h>
+#include <ctype.h>
+
+#include "lexer.h"
+
+/* The tokenizer starts each word in state 1, state 0 is the state of words that match no pattern */
+#define LEXER_START 1
+
+void tokenize_line(char *line, token_line_t *tokens) {
+	int pos = 0;
+	int n = 0;
+
+	tokens->line = line;
+	tokens->next = 0;
+	tokens->pos = 0;
+	while (line[pos] && n < LINE_LEN) {
+		token_t *token;
+
+		if (isspace((unsigned char)line[pos])) {
+			pos++;
+			continue;
+		}
+
+		token = &tokens->tokens[n++];
+		token->start = (unsigned char)pos;
+		token->value = 0;
+		if (line[pos] == ',') {
+			token->type = TOKEN_COMMA;
+			pos++;
+		}
+		else {
+			/* Run the word through the tokenizer, its type is that of the state at its end */
+			unsigned int state = LEXER_START;
+			while (line[pos] && !isspace((unsigned char)line[pos]) && line[pos] != ',') {
+				state = lexer_transitions[state * lexer_n_classes + lexer_char_classes[(unsigned char)line[pos]]];
+				pos++;
+			}
+			token->type = lexer_accepts[state].type;
+			token->value = lexer_accepts[state].value;
+		}
+		token->length = (unsigned char)(pos - token->start);
+	}
+	tokens->n_tokens = n;
+}
+
+/* Moves the rest of the line to the next token, or to the end of the line, as skipping spaces does */
+static void skip_to_next(token_line_t *tokens) {
+	if (tokens->next < tokens->n_tokens) {
+		tokens->pos = tokens->tokens[tokens->next].start;
+	}
+	else {
+		tokens->pos = (int)strlen(tokens->line);
+	}
+}
+
+ErrorCode next_token(token_line_t *tokens, char *word, token_t *token, int is_last) {
+	token_t *next;
+
+	/* check for an unexpected comma */
+	if (tokens->line[tokens->pos] == ',') {
+		return ERR_COMMA_EXTRA;
+	}
+
+	/* No word before a comma or the end of the line */
+	if (tokens->next == tokens->n_tokens || tokens->tokens[tokens->next].type == TOKEN_COMMA) {
+		*word = '\0';
+		token->type = TOKEN_NONE;
+		token->value = 0;
+		skip_to_next(tokens);
+	}
+	else {
+		next = &tokens->tokens[tokens->next++];
+		memcpy(word, tokens->line + next->start, next->length);
+		word[next->length] = '\0';
+		*token = *next;
+		skip_to_next(tokens);
+	}
+
+	/* If this is the last word, check for trailing text */
+	if (is_last == LAST_WORD && tokens->next < tokens->n_tokens) {
+		return ERR_TRAILING_TEXT;
+	}
+	return SUCCESS;
+}
+
+ErrorCode next_comma(token_line_t *tokens) {
+	if (tokens->next == tokens->n_tokens || tokens->tokens[tokens->next].type != TOKEN_COMMA) {
+		return ERR_COMMA_MISSING;
+	}
+	tokens->next++;
+	skip_to_next(tokens);
+	return SUCCESS;
+}
+
+int has_more_tokens(token_line_t *tokens) {
+	return tokens->next < tokens->n_tokens;
+}
@@ -0,0 +1,83 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include "error_codes.h"
+#include "utils.h"
+
+/* Token types, the word types are listed with their patterns in tokens.spec */
+typedef enum {
+	TOKEN_NONE = 0,     /* No word */
+	TOKEN_WORD,         /* A word that matches no pattern */
+	TOKEN_COMMA,
+	TOKEN_LABEL,
+	TOKEN_DIRECTIVE,
+	TOKEN_MNEMONIC,
+	TOKEN_REGISTER,
+	TOKEN_IMMEDIATE,
+	TOKEN_RELATIVE,
+	TOKEN_STRING,
+	TOKEN_NUMBER,
+	TOKEN_IDENTIFIER
+} token_type_t;
+
+/* A token of a line, 4 bytes */
+typedef struct {
+	unsigned char type;     /* token_type_t */
+	unsigned char value;    /* Instruction index, register number or directive_t, by type */
+	unsigned char start;    /* Offset of the token in the line */
+	unsigned char length;
+} token_t;
+
+/* The tokens of a line, read in order as get_word and get_comma read the line */
+typedef struct {
+	char *line;
+	token_t tokens[LINE_LEN];
+	int n_tokens;
+	int next;               /* Index of the next token */
+	int pos;                /* Offset of the rest of the line */
+} token_line_t;
+
+/* Type and value of the words accepted by each tokenizer state */
+typedef struct {
+	unsigned char type;
+	unsigned char value;
+} lexer_accept_t;
+
+/* Tokenizer tables, generated by tokgen from tokens.spec */
+extern const int lexer_n_classes;
+extern const unsigned char lexer_char_classes[256];
+extern const unsigned char lexer_transitions[];
+extern const lexer_accept_t lexer_accepts[];
+
+/**
+Splits a line into tokens in a single pass, classifying each word by the tokenizer tables.
+	@param line: The line, shorter than LINE_LEN.
+	@param tokens: Output - the tokens of the line, with the first token next.
+*/
+void tokenize_line(char *line, token_line_t *tokens);
+
+/**
+Takes the next word, with the same results and errors as get_word on the rest of the line.
+	@param tokens: The tokens of the line.
+	@param word: Buffer to store the word, empty if there is no word before a comma or the end of the line.
+	@param token: Output - the token of the word, of type TOKEN_NONE if there is no word.
+	@param is_last: Indicates if this is the last word.
+	@return SUCCESS if a word found, error otherwise.
+*/
+ErrorCode next_token(token_line_t *tokens, char *word, token_t *token, int is_last);
+
+/**
+Takes the next comma, with the same results and errors as get_comma on the rest of the line.
+	@param tokens: The tokens of the line.
+	@return SUCCESS if a comma found, error otherwise.
+*/
+ErrorCode next_comma(token_line_t *tokens);
+
+/**
+Checks if any tokens are left in the line.
+	@param tokens: The tokens of the line.
+	@return 1 if there are more tokens, 0 otherwise.
+*/
+int has_more_tokens(token_line_t *tokens);
+
+#endif /* LEXER_H */
@@ -0,0 +1,327 @@
+#define _POSIX_C_SOURCE 200809L
+
+/* Calls are serialized with POSIX threads, and the phases exchange POSIX memory streams */
+#ifdef _WIN32
+	#error "libassembler needs POSIX threads and memory streams"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "utils.h"
+#include "macro.h"
+#include "process.h"
+#include "symbols.h"
+#include "libassembler.h"
+
+/* The assembler modules keep their tables in module state, calls take turns */
+static pthread_mutex_t assembler_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* A memory buffer, written through a memory stream */
+typedef struct {
+	char *data;
+	size_t size;
+} buffer_t;
+
+/* State of the error handler during a call */
+typedef struct {
+	assembler_result_t *result;
+	int capacity;
+	int is_expanded; /* Nonzero once lines are lines of the expanded source */
+} diagnostics_t;
+
+struct assembler_context_t {
+	char name[MAX_FILE_NAME];
+	int pool_data;
+
+	/* State of the running call */
+	diagnostics_t diagnostics;
+	buffer_t expanded;       /* The source after macro processing */
+	buffer_t object;         /* The object image */
+};
+
+assembler_context_t *assembler_create(const char *name) {
+	assembler_context_t *context;
+
+	context = (assembler_context_t *)calloc(1, sizeof(assembler_context_t));
+	if (!context) {
+		return NULL;
+	}
+	strncat(context->name, name ? name : "", MAX_FILE_NAME - 1);
+	return context;
+}
+
+void assembler_set_data_pooling(assembler_context_t *context, int enabled) {
+	context->pool_data = enabled;
+}
+
+void assembler_destroy(assembler_context_t *context) {
+	free(context);
+}
+
+/* Memory streams --------------------------------------------- */
+
+/* Opens a stream that writes to a buffer, which is set when the stream is closed */
+static FILE *create_buffer(buffer_t *buffer) {
+	buffer->data = NULL;
+	buffer->size = 0;
+	return open_memstream(&buffer->data, &buffer->size);
+}
+
+/* Opens a stream that reads a buffer. An empty buffer is read as a single empty line,
+   as a stream of size 0 cannot be opened on every system */
+static FILE *open_buffer(const char *data, size_t size) {
+	static char empty_line[] = "\n";
+
+	if (size == 0) {
+		return fmemopen(empty_line, 1, "r");
+	}
+	return fmemopen((void *)data, size, "r");
+}
+
+/* Frees the data of a buffer */
+static void free_buffer(buffer_t *buffer) {
+	free(buffer->data);
+	buffer->data = NULL;
+	buffer->size = 0;
+}
+
+/* Diagnostics --------------------------------------------- */
+
+/* Collects a reported error as a diagnostic of the result */
+static void add_diagnostic(void *context, ErrorCode error, char *filename, int line_number, char *error_context) {
+	diagnostics_t *diagnostics = (diagnostics_t *)context;
+	assembler_result_t *result = diagnostics->result;
+	assembler_diagnostic_t *diagnostic;
+	const char *message = get_error_message(error);
+	char *macro;
+	int macro_line;
+
+	if (!message) {
+		message = "unknown error";
+	}
+
+	/* Grow the diagnostics array as needed */
+	if (result->n_diagnostics == diagnostics->capacity) {
+		assembler_diagnostic_t *grown;
+		int capacity = diagnostics->capacity ? diagnostics->capacity * 2 : 16;
+		grown = (assembler_diagnostic_t *)realloc(result->diagnostics, capacity * sizeof(assembler_diagnostic_t));
+		if (!grown) {
+			return;
+		}
+		result->diagnostics = grown;
+		diagnostics->capacity = capacity;
+	}
+
+	diagnostic = &result->diagnostics[result->n_diagnostics];
+	diagnostic->message = (char *)malloc(strlen(message) + (error_context ? strlen(error_context) + 1 : 0) + 1);
+	if (!diagnostic->message) {
+		return;
+	}
+	strcpy(diagnostic->message, message);
+	if (error_context) {
+		strcat(diagnostic->message, " ");
+		strcat(diagnostic->message, error_context);
+	}
+
+	/* Lines of the expanded source are mapped back to the buffer */
+	diagnostic->error = error;
+	diagnostic->line_number = line_number;
+	if (diagnostics->is_expanded && line_number > 0 &&
+		get_line_origin(line_number, &diagnostic->line_number, &macro, &macro_line) != SUCCESS
+	) {
+		diagnostic->line_number = 0;
+	}
+	result->n_diagnostics++;
+}
+
+/* Reads the "name address" records of an entry or extern file */
+static ErrorCode read_symbols(FILE *file, assembler_symbol_t **symbols, int *n_symbols) {
+	char line[LINE_LEN];
+	char name[LINE_LEN];
+	int address;
+	int capacity = 0;
+
+	rewind(file);
+	while (fgets(line, LINE_LEN, file)) {
+		if (sscanf(line, "%s %d", name, &address) != 2) {
+			continue;
+		}
+
+		/* Grow the records array as needed */
+		if (*n_symbols == capacity) {
+			assembler_symbol_t *grown;
+			capacity = capacity ? capacity * 2 : 16;
+			grown = (assembler_symbol_t *)realloc(*symbols, capacity * sizeof(assembler_symbol_t));
+			if (!grown) {
+				return ERR_OUT_OF_MEMORY;
+			}
+			*symbols = grown;
+		}
+		(*symbols)[*n_symbols].name = my_strdup(name);
+		(*symbols)[*n_symbols].address = address;
+		(*n_symbols)++;
+	}
+	return SUCCESS;
+}
+
+/* Reads the words of an object image */
+static ErrorCode read_words(FILE *file, assembler_result_t *result) {
+	char line[LINE_LEN];
+	int address;
+	unsigned int value;
+	int i;
+
+	rewind(file);
+	if (!fgets(line, LINE_LEN, file) || sscanf(line, "%d %d", &result->code_size, &result->data_size) != 2) {
+		return ERR_INTERNAL_ASSERT;
+	}
+	result->words = (unsigned int *)malloc((result->code_size + result->data_size + 1) * sizeof(unsigned int));
+	if (!result->words) {
+		return ERR_OUT_OF_MEMORY;
+	}
+	for (i = 0; i < result->code_size + result->data_size; i++) {
+		if (!fgets(line, LINE_LEN, file) || sscanf(line, "%d %x", &address, &value) != 2) {
+			return ERR_INTERNAL_ASSERT;
+		}
+		result->words[i] = value;
+	}
+	return SUCCESS;
+}
+
+/* Writes the entry or extern records to a memory buffer, and reads them back */
+static ErrorCode collect_symbols(void (*dump)(FILE *), assembler_symbol_t **symbols, int *n_symbols) {
+	buffer_t buffer;
+	FILE *file = create_buffer(&buffer);
+	ErrorCode error = ERR_OUT_OF_MEMORY;
+
+	if (!file) {
+		return ERR_OUT_OF_MEMORY;
+	}
+	dump(file);
+	fclose(file);
+	file = open_buffer(buffer.data, buffer.size);
+	if (file) {
+		error = read_symbols(file, symbols, n_symbols);
+		fclose(file);
+	}
+	free_buffer(&buffer);
+	return error;
+}
+
+/* Runs the assembler phases on the source, with the lock held */
+static int assemble_locked(assembler_context_t *context, const char *source, long length, assembler_result_t *result) {
+	FILE *source_file, *expanded, *object = NULL;
+	int error_state = 0;
+
+	/* Expand the macros into the expanded buffer of the context */
+	source_file = open_buffer(source, (size_t)length);
+	expanded = create_buffer(&context->expanded);
+	if (!source_file || !expanded) {
+		is_error(ERR_OUT_OF_MEMORY, &error_state, context->name, 0, NULL);
+	}
+	if (!error_state) {
+		/* Diagnostics are reported by their source lines */
+		set_line_origins(1);
+		error_state = macro_process(context->name, source_file, expanded);
+	}
+	if (source_file) {
+		fclose(source_file);
+	}
+	if (expanded) {
+		fclose(expanded);
+		expanded = NULL;
+	}
+	context->diagnostics.is_expanded = 1;
+
+	if (!error_state) {
+		expanded = open_buffer(context->expanded.data, context->expanded.size);
+		if (!expanded) {
+			is_error(ERR_OUT_OF_MEMORY, &error_state, context->name, 0, NULL);
+		}
+	}
+	if (!error_state) {
+		set_data_pooling(context->pool_data);
+		error_state = first_process(context->name, expanded);
+	}
+	if (!error_state) {
+		rewind(expanded);
+		error_state = second_process(context->name, expanded);
+	}
+
+	/* Collect the entries and external references, before the symbols are freed */
+	if (!error_state && has_entry()) {
+		is_error(collect_symbols(dump_entry, &result->entries, &result->n_entries), &error_state, context->name, 0, NULL);
+	}
+	if (!error_state && has_extern()) {
+		is_error(collect_symbols(dump_extern, &result->externs, &result->n_externs), &error_state, context->name, 0, NULL);
+	}
+	if (!error_state) {
+		object = create_buffer(&context->object);
+		if (!object) {
+			is_error(ERR_OUT_OF_MEMORY, &error_state, context->name, 0, NULL);
+		}
+	}
+
+	purge_and_dump_assembly(object);
+	purge_macros();
+	purge_symbols();
+	set_data_pooling(0);
+
+	/* Read the words back from the object image */
+	if (object) {
+		fclose(object);
+		object = open_buffer(context->object.data, context->object.size);
+		is_error(object ? read_words(object, result) : ERR_OUT_OF_MEMORY, &error_state, context->name, 0, NULL);
+		if (object) {
+			fclose(object);
+		}
+	}
+	if (expanded) {
+		fclose(expanded);
+	}
+	free_buffer(&context->expanded);
+	free_buffer(&context->object);
+	return error_state;
+}
+
+int assemble_buffer(assembler_context_t *context, const char *source, long length, assembler_result_t *result) {
+	int error_state;
+
+	memset(result, 0, sizeof(assembler_result_t));
+	context->diagnostics.result = result;
+	context->diagnostics.capacity = 0;
+	context->diagnostics.is_expanded = 0;
+
+	pthread_mutex_lock(&assembler_lock);
+	set_error_handler(add_diagnostic, &context->diagnostics);
+	error_state = assemble_locked(context, source, length, result);
+	set_error_handler(NULL, NULL);
+	pthread_mutex_unlock(&assembler_lock);
+
+	return error_state;
+}
+
+/* Frees an array of symbol records */
+static void free_symbols(assembler_symbol_t *symbols, int n_symbols) {
+	int i;
+	for (i = 0; i < n_symbols; i++) {
+		free(symbols[i].name);
+	}
+	free(symbols);
+}
+
+void assembler_free_result(assembler_result_t *result) {
+	int i;
+
+	for (i = 0; i < result->n_diagnostics; i++) {
+		free(result->diagnostics[i].message);
+	}
+	free(result->diagnostics);
+	free_symbols(result->entries, result->n_entries);
+	free_symbols(result->externs, result->n_externs);
+	free(result->words);
+	memset(result, 0, sizeof(assembler_result_t));
+}
@@ -0,0 +1,78 @@
+#ifndef LIBASSEMBLER_H
+#define LIBASSEMBLER_H
+
+#include "error_codes.h"
+
+/* An assembler context, holding the options and the state of the calls made with it */
+typedef struct assembler_context_t assembler_context_t;
+
+/* A diagnostic reported while assembling */
+typedef struct {
+	ErrorCode error;
+	int line_number;  /* Line of the source buffer, 0 if not related to a line */
+	char *message;    /* Error description, followed by its context if any */
+} assembler_diagnostic_t;
+
+/* An entry or an external reference */
+typedef struct {
+	char *name;
+	int address;
+} assembler_symbol_t;
+
+/* The result of assembling a buffer */
+typedef struct {
+	int code_size;
+	int data_size;
+	unsigned int *words;  /* Code words followed by data words, from the first code address */
+	assembler_symbol_t *entries;
+	int n_entries;
+	assembler_symbol_t *externs;
+	int n_externs;
+	assembler_diagnostic_t *diagnostics;
+	int n_diagnostics;
+} assembler_result_t;
+
+/**
+Creates an assembler context.
+	@param name: The name of the source, used in diagnostics (e.g. "prog.as").
+	@return: The new context, or NULL if out of memory.
+*/
+assembler_context_t *assembler_create(const char *name);
+
+/**
+Enables or disables data pooling for the calls made with a context (see set_data_pooling).
+	@param context: The assembler context.
+	@param enabled: Nonzero to enable pooling.
+*/
+void assembler_set_data_pooling(assembler_context_t *context, int enabled);
+
+/**
+Assembles a source buffer in memory.
+The result holds the object words, entries and external references of the source,
+or the diagnostics that failed it. Lines in the diagnostics are lines of the buffer,
+errors inside a macro expansion are reported on the line of the macro call.
+The phases exchange memory streams held by the context, so no file is read or written,
+except the libraries of .include directives, which are opened as by the assembler (see open_library).
+Calls may be made from several threads, each with its own context. The assembler keeps its
+tables in module state, so the calls run one at a time: a call waits for the running one to finish.
+	@param context: The assembler context, used by one call at a time.
+	@param source: The source text, before macro processing.
+	@param length: The length of the source text.
+	@param result: Output - the result, to be freed with assembler_free_result.
+	@return: 0 on success, 1 on failure.
+*/
+int assemble_buffer(assembler_context_t *context, const char *source, long length, assembler_result_t *result);
+
+/**
+Frees the memory held by a result.
+	@param result: The result of assemble_buffer.
+*/
+void assembler_free_result(assembler_result_t *result);
+
+/**
+Frees an assembler context.
+	@param context: The assembler context.
+*/
+void assembler_destroy(assembler_context_t *context);
+
+#endif /* LIBASSEMBLER_H */
@@ -0,0 +1,635 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <pthread.h>
+#endif
+
+#include "utils.h"
+#include "language.h"
+#include "macro.h"
+#include "symbols.h"
+#include "library.h"
+
+/**
+Library file layout. All offsets are from the start of the file, and 0 marks no entry.
+	library_header_t
+	unsigned int buckets[n_buckets]     Offset of the first entry of each hash bucket
+	library_entry_t entries[n_entries]  Each entry is chained to the previous entry of its bucket
+	Zero terminated names and macro contents
+*/
+#define LIBRARY_MAGIC "MLB2"
+
+/* Kinds of library entries */
+#define LIBRARY_MACRO 0
+#define LIBRARY_EXTERN 1
+
+typedef struct {
+	char magic[4];
+	unsigned int n_buckets;     /* A power of 2 */
+	unsigned int n_entries;
+	long source_size;           /* Size of the source the library was compiled from */
+	long source_modified;       /* Modification time of the source the library was compiled from */
+} library_header_t;
+
+typedef struct {
+	unsigned int next;          /* Offset of the next entry in the bucket, always a lower offset */
+	unsigned int kind;
+	unsigned int name;          /* Offset of the name */
+	unsigned int content;       /* Offset of the macro content, 0 for an extern */
+	unsigned int line_number;   /* Line of the definition in the library source */
+} library_entry_t;
+
+/* A mapped library file */
+struct library_t {
+	char filename[MAX_FILE_NAME];
+	char source_filename[MAX_FILE_NAME]; /* Empty if the library has no source */
+	char *data;
+	long size;
+	time_t modified;            /* Modification time of the file when it was mapped */
+	struct library_t *next;
+};
+
+/* Libraries mapped by this process, mapped libraries are never changed */
+static library_t *libraries = NULL;
+#ifndef _WIN32
+static pthread_mutex_t libraries_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* FNV-1a hash of a name */
+static unsigned int hash_name(const char *name) {
+	unsigned int hash = 2166136261u;
+	while (*name) {
+		hash = (hash ^ (unsigned char)*name++) * 16777619u;
+	}
+	return hash;
+}
+
+/* Compiling ------------------------------------------------ */
+
+/* An entry collected from a library source */
+typedef struct {
+	char *name;
+	char *content;
+	long content_length;
+	long content_capacity;
+	int line_number;
+	unsigned int kind;
+	unsigned int offset;        /* Offset of the entry in the library file */
+	unsigned int next;
+} source_entry_t;
+
+/* Entries collected from a library source */
+typedef struct {
+	source_entry_t *entries;
+	int n_entries;
+	int capacity;
+} library_source_t;
+
+/* Adds an entry to the collected entries */
+static ErrorCode add_source_entry(library_source_t *source, char *name, unsigned int kind, int line_number) {
+	source_entry_t *entry;
+
+	if (source->n_entries == source->capacity) {
+		source_entry_t *grown;
+		int capacity = source->capacity ? source->capacity * 2 : 64;
+		grown = (source_entry_t *)realloc(source->entries, capacity * sizeof(source_entry_t));
+		if (!grown) {
+			return ERR_OUT_OF_MEMORY;
+		}
+		source->entries = grown;
+		source->capacity = capacity;
+	}
+	entry = &source->entries[source->n_entries];
+	memset(entry, 0, sizeof(source_entry_t));
+	entry->name = my_strdup(name);
+	if (!entry->name) {
+		return ERR_OUT_OF_MEMORY;
+	}
+	entry->kind = kind;
+	entry->line_number = line_number;
+	source->n_entries++;
+	return SUCCESS;
+}
+
+/* Appends a line to the content of a macro entry */
+static ErrorCode append_content(source_entry_t *entry, char *line) {
+	long length = strlen(line);
+
+	if (entry->content_length + length + 1 > entry->content_capacity) {
+		char *grown;
+		long capacity = entry->content_capacity ? entry->content_capacity * 2 : 256;
+		while (capacity < entry->content_length + length + 1) {
+			capacity *= 2;
+		}
+		grown = (char *)realloc(entry->content, capacity);
+		if (!grown) {
+			return ERR_OUT_OF_MEMORY;
+		}
+		entry->content = grown;
+		entry->content_capacity = capacity;
+	}
+	strcpy(entry->content + entry->content_length, line);
+	entry->content_length += length;
+	return SUCCESS;
+}
+
+/* Frees the collected entries */
+static void free_source(library_source_t *source) {
+	int i;
+	for (i = 0; i < source->n_entries; i++) {
+		free(source->entries[i].name);
+		free(source->entries[i].content);
+	}
+	free(source->entries);
+}
+
+/* Reads the macros and externs of a library source, reporting errors by line */
+static int read_library_source(char *filename, FILE *file, library_source_t *source) {
+	char line[LINE_LEN];
+	char word[LINE_LEN];
+	char *rest_of_line;
+	int macro = -1; /* Index of the macro being defined */
+	int line_number = 0;
+	int error_state = 0;
+	ErrorCode error;
+
+	while (fgets(line, LINE_LEN, file)) {
+		line_number++;
+		line[LINE_LEN-1] = '\0';
+
+		if (is_line_too_long(file, line)) {
+			is_error(ERR_LINE_TOO_LONG, &error_state, filename, line_number, NULL);
+			continue;
+		}
+
+		error = get_word(line, word, &rest_of_line, LAST_WORD_DONT_CARE);
+		if (is_error(error, &error_state, filename, line_number, NULL)) {
+			continue;
+		}
+
+		/* Inside a macro definition, lines are kept up to the end marker */
+		if (macro >= 0) {
+			if (strcmp(word, "mcroend") == 0) {
+				macro = -1;
+				if (!is_whitespaces(rest_of_line)) {
+					is_error(ERR_TRAILING_TEXT, &error_state, filename, line_number, NULL);
+				}
+			}
+			else {
+				error = append_content(&source->entries[macro], line);
+				is_error(error, &error_state, filename, line_number, NULL);
+			}
+			continue;
+		}
+
+		/* Skip empty lines and comments */
+		if (line[0] == ';' || is_whitespaces(line)) {
+			continue;
+		}
+
+		if (strcmp(word, "mcro") == 0) {
+			error = get_word(rest_of_line, word, NULL, LAST_WORD);
+			if (error == SUCCESS && strlen(word) == 0) {
+				error = ERR_MACRO_MISSING_NAME;
+			}
+			if (error == SUCCESS) {
+				error = check_macro_name(word);
+			}
+			if (error == SUCCESS) {
+				error = add_source_entry(source, word, LIBRARY_MACRO, line_number);
+			}
+			if (!is_error(error, &error_state, filename, line_number, NULL)) {
+				macro = source->n_entries - 1;
+			}
+		}
+		else if (is_extern(word)) {
+			error = get_word(rest_of_line, word, NULL, LAST_WORD);
+			if (error == SUCCESS) {
+				error = check_symbol_name(word);
+			}
+			if (error == SUCCESS) {
+				error = add_source_entry(source, word, LIBRARY_EXTERN, line_number);
+			}
+			is_error(error, &error_state, filename, line_number, NULL);
+		}
+		else {
+			is_error(ERR_LIBRARY_ILLEGAL_LINE, &error_state, filename, line_number, NULL);
+		}
+	}
+	return error_state;
+}
+
+/* Chains the entries into hash buckets, and reports names defined twice */
+static int chain_entries(char *filename, library_source_t *source, unsigned int *buckets, unsigned int n_buckets) {
+	int error_state = 0;
+	int i;
+
+	for (i = 0; i < source->n_entries; i++) {
+		source_entry_t *entry = &source->entries[i];
+		unsigned int bucket = hash_name(entry->name) & (n_buckets - 1);
+		unsigned int offset;
+
+		/* Entries are chained in order, so an earlier entry has a lower offset */
+		for (offset = buckets[bucket]; offset; ) {
+			source_entry_t *other = &source->entries[(offset - source->entries[0].offset) / sizeof(library_entry_t)];
+			if (strcmp(other->name, entry->name) == 0) {
+				ErrorCode error = ERR_SYMBOL_REDEFINITION;
+				if (entry->kind != other->kind) {
+					error = ERR_SYMBOL_AS_MACRO;
+				}
+				else if (entry->kind == LIBRARY_MACRO) {
+					error = ERR_MACRO_REDEFINITION;
+				}
+				is_error(error, &error_state, filename, entry->line_number, NULL);
+				break;
+			}
+			offset = other->next;
+		}
+		entry->next = buckets[bucket];
+		buckets[bucket] = entry->offset;
+	}
+	return error_state;
+}
+
+/* Writes a library file, under a temporary name first, so the file is never seen half written */
+static ErrorCode write_library(char *filename, char *library_filename, library_source_t *source, struct stat *source_info) {
+	char temporary_filename[MAX_FILE_NAME + 32];
+	library_header_t header;
+	library_entry_t record;
+	unsigned int *buckets;
+	unsigned int offset;
+	FILE *file;
+	int error_state = 0;
+	int i;
+
+	memcpy(header.magic, LIBRARY_MAGIC, 4);
+	header.n_entries = source->n_entries;
+	header.source_size = (long)source_info->st_size;
+	header.source_modified = (long)source_info->st_mtime;
+	header.n_buckets = 16;
+	while (header.n_buckets < 2 * header.n_entries) {
+		header.n_buckets *= 2;
+	}
+
+	/* Lay out the entries, then the strings */
+	offset = sizeof(library_header_t) + header.n_buckets * sizeof(unsigned int);
+	for (i = 0; i < source->n_entries; i++) {
+		source->entries[i].offset = offset;
+		offset += sizeof(library_entry_t);
+	}
+
+	buckets = (unsigned int *)calloc(header.n_buckets, sizeof(unsigned int));
+	if (!buckets) {
+		return ERR_OUT_OF_MEMORY;
+	}
+	if (chain_entries(filename, source, buckets, header.n_buckets)) {
+		free(buckets);
+		return ERR_LIBRARY_ILLEGAL;
+	}
+
+#ifndef _WIN32
+	sprintf(temporary_filename, "%s.%ld", library_filename, (long)getpid());
+#else
+	sprintf(temporary_filename, "%s.tmp", library_filename);
+#endif
+	file = fopen(temporary_filename, "wb");
+	if (!file) {
+		free(buckets);
+		return ERR_FILE_CANNOT_CREATE;
+	}
+	fwrite(&header, sizeof(library_header_t), 1, file);
+	fwrite(buckets, sizeof(unsigned int), header.n_buckets, file);
+	free(buckets);
+
+	for (i = 0; i < source->n_entries; i++) {
+		source_entry_t *entry = &source->entries[i];
+		record.next = entry->next;
+		record.kind = entry->kind;
+		record.line_number = entry->line_number;
+		record.name = offset;
+		offset += strlen(entry->name) + 1;
+		record.content = 0;
+		if (entry->kind == LIBRARY_MACRO) {
+			record.content = offset;
+			offset += entry->content_length + 1;
+		}
+		fwrite(&record, sizeof(library_entry_t), 1, file);
+	}
+	for (i = 0; i < source->n_entries; i++) {
+		source_entry_t *entry = &source->entries[i];
+		fwrite(entry->name, 1, strlen(entry->name) + 1, file);
+		if (entry->kind == LIBRARY_MACRO) {
+			if (entry->content) {
+				fwrite(entry->content, 1, entry->content_length, file);
+			}
+			fputc('\0', file);
+		}
+	}
+
+	if (ferror(file)) {
+		error_state = 1;
+	}
+	if (fclose(file) != 0) {
+		error_state = 1;
+	}
+#ifdef _WIN32
+	remove(library_filename);
+#endif
+	if (error_state || rename(temporary_filename, library_filename) != 0) {
+		remove(temporary_filename);
+		return ERR_FILE_CANNOT_CREATE;
+	}
+	return SUCCESS;
+}
+
+/* Compiles a library source into a library file, stamped with the size and time of the source */
+static ErrorCode compile_library(char *filename, char *library_filename, struct stat *source_info) {
+	library_source_t source;
+	FILE *file;
+	ErrorCode error;
+	int error_state;
+
+	file = fopen(filename, "r");
+	if (!file) {
+		return ERR_FILE_NOT_EXIST;
+	}
+	memset(&source, 0, sizeof(library_source_t));
+	error_state = read_library_source(filename, file, &source);
+	fclose(file);
+
+	error = error_state ? ERR_LIBRARY_ILLEGAL : write_library(filename, library_filename, &source, source_info);
+	free_source(&source);
+	return error;
+}
+
+/* Mapping ------------------------------------------------- */
+
+/* Checks that the offsets of a library file stay inside it, and that bucket chains end */
+static int is_valid_library(char *data, long size) {
+	library_header_t *header = (library_header_t *)data;
+	unsigned int *buckets;
+	library_entry_t *entries;
+	unsigned long entries_start, strings_start;
+	unsigned int i;
+
+	if (size < (long)sizeof(library_header_t) || memcmp(header->magic, LIBRARY_MAGIC, 4) != 0) {
+		return 0;
+	}
+	if (header->n_buckets == 0 || (header->n_buckets & (header->n_buckets - 1)) != 0) {
+		return 0;
+	}
+	entries_start = sizeof(library_header_t) + (unsigned long)header->n_buckets * sizeof(unsigned int);
+	strings_start = entries_start + (unsigned long)header->n_entries * sizeof(library_entry_t);
+	if (strings_start > (unsigned long)size || (header->n_entries > 0 && data[size - 1] != '\0')) {
+		return 0;
+	}
+
+	buckets = (unsigned int *)(data + sizeof(library_header_t));
+	entries = (library_entry_t *)(data + entries_start);
+	for (i = 0; i < header->n_buckets; i++) {
+		if (buckets[i] && (buckets[i] < entries_start || buckets[i] >= strings_start ||
+			(buckets[i] - entries_start) % sizeof(library_entry_t) != 0)) {
+			return 0;
+		}
+	}
+	for (i = 0; i < header->n_entries; i++) {
+		unsigned long offset = entries_start + i * sizeof(library_entry_t);
+		library_entry_t *entry = &entries[i];
+		if (entry->next && (entry->next < entries_start || entry->next >= offset ||
+			(entry->next - entries_start) % sizeof(library_entry_t) != 0)) {
+			return 0;
+		}
+		if (entry->name < strings_start || entry->name >= (unsigned long)size) {
+			return 0;
+		}
+		if (entry->kind == LIBRARY_MACRO && (entry->content < strings_start || entry->content >= (unsigned long)size)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Maps a library file into memory, read-only */
+static ErrorCode map_library(library_t *library) {
+#ifndef _WIN32
+	struct stat info;
+	int file = open(library->filename, O_RDONLY);
+
+	if (file < 0) {
+		return ERR_FILE_NOT_EXIST;
+	}
+	if (fstat(file, &info) != 0 || info.st_size == 0) {
+		close(file);
+		return ERR_LIBRARY_ILLEGAL;
+	}
+	library->data = (char *)mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+	if (library->data == (char *)MAP_FAILED) {
+		library->data = NULL;
+		return ERR_OUT_OF_MEMORY;
+	}
+	library->size = info.st_size;
+	library->modified = info.st_mtime;
+#else
+	FILE *file = fopen(library->filename, "rb");
+	struct stat info;
+
+	if (!file) {
+		return ERR_FILE_NOT_EXIST;
+	}
+	if (stat(library->filename, &info) != 0 || info.st_size == 0) {
+		fclose(file);
+		return ERR_LIBRARY_ILLEGAL;
+	}
+	library->data = (char *)malloc(info.st_size);
+	if (!library->data) {
+		fclose(file);
+		return ERR_OUT_OF_MEMORY;
+	}
+	library->size = fread(library->data, 1, info.st_size, file);
+	library->modified = info.st_mtime;
+	fclose(file);
+#endif
+
+	if (!is_valid_library(library->data, library->size)) {
+		return ERR_LIBRARY_ILLEGAL;
+	}
+	return SUCCESS;
+}
+
+/* Unmaps a library file */
+static void unmap_library(library_t *library) {
+	if (library->data) {
+#ifndef _WIN32
+		munmap(library->data, library->size);
+#else
+		free(library->data);
+#endif
+	}
+	library->data = NULL;
+	library->size = 0;
+}
+
+/**
+Returns the mapped library of a file.
+A library file that changed since it was mapped is mapped again as a new library.
+The old mapping stays, as files that were expanded before may still use it.
+*/
+static ErrorCode get_mapped_library(char *library_filename, char *source_filename, int is_compiled, library_t **library) {
+	struct stat info;
+	library_t **link;
+	library_t *current;
+	ErrorCode error;
+
+	if (stat(library_filename, &info) != 0) {
+		return ERR_FILE_NOT_EXIST;
+	}
+	for (link = &libraries; *link; link = &(*link)->next) {
+		if (strcmp((*link)->filename, library_filename) == 0) {
+			break;
+		}
+	}
+
+	/* A library that did not change since it was mapped is used as is */
+	current = *link;
+	if (current && !is_compiled && current->modified == info.st_mtime && current->size == (long)info.st_size &&
+		strcmp(current->source_filename, source_filename) == 0) {
+		*library = current;
+		return SUCCESS;
+	}
+	if (current) {
+		*link = current->next;
+	}
+
+	current = (library_t *)calloc(1, sizeof(library_t));
+	if (!current) {
+		return ERR_OUT_OF_MEMORY;
+	}
+	strcpy(current->filename, library_filename);
+	strcpy(current->source_filename, source_filename);
+	error = map_library(current);
+	if (error != SUCCESS) {
+		unmap_library(current);
+		free(current);
+		return error;
+	}
+	current->next = libraries;
+	libraries = current;
+	*library = current;
+	return SUCCESS;
+}
+
+/* Checks if a library file was compiled from the source as it is now, by the stamp in its header */
+static int is_library_current(char *library_filename, struct stat *source_info) {
+	library_header_t header;
+	FILE *file = fopen(library_filename, "rb");
+	int is_current;
+
+	if (!file) {
+		return 0;
+	}
+	is_current =
+		fread(&header, sizeof(library_header_t), 1, file) == 1 &&
+		memcmp(header.magic, LIBRARY_MAGIC, 4) == 0 &&
+		header.source_size == (long)source_info->st_size &&
+		header.source_modified == (long)source_info->st_mtime;
+	fclose(file);
+	return is_current;
+}
+
+/* Compiles a library if needed, and maps it */
+static ErrorCode open_library_locked(char *name, library_t **library) {
+	char filename[MAX_FILE_NAME];
+	char library_filename[MAX_FILE_NAME];
+	struct stat source_info, library_info;
+	int has_source, has_library;
+	int is_compiled = 0;
+	ErrorCode error;
+
+	if (is_filename_too_long(name)) {
+		return ERR_FILE_NAME_TOO_LONG;
+	}
+	get_filename(name, "as", filename);
+	get_filename(name, "mlb", library_filename);
+
+	/* Compile the library when there is no library file, or it was compiled from another version of the source.
+	   The size and time of the source are compared, as the time alone misses edits within the same second */
+	has_source = stat(filename, &source_info) == 0;
+	has_library = stat(library_filename, &library_info) == 0;
+	if (!has_source && !has_library) {
+		return ERR_FILE_NOT_EXIST;
+	}
+	if (has_source && (!has_library || !is_library_current(library_filename, &source_info))) {
+		error = compile_library(filename, library_filename, &source_info);
+		if (error != SUCCESS) {
+			return error;
+		}
+		is_compiled = 1;
+	}
+
+	return get_mapped_library(library_filename, has_source ? filename : "", is_compiled, library);
+}
+
+ErrorCode open_library(char *name, library_t **library) {
+	ErrorCode error;
+
+#ifndef _WIN32
+	pthread_mutex_lock(&libraries_lock);
+#endif
+	error = open_library_locked(name, library);
+#ifndef _WIN32
+	pthread_mutex_unlock(&libraries_lock);
+#endif
+	return error;
+}
+
+/* Looking up ---------------------------------------------- */
+
+/* Finds the entry of a name in a library */
+static library_entry_t *find_entry(library_t *library, char *name) {
+	library_header_t *header = (library_header_t *)library->data;
+	unsigned int offset;
+
+	offset = ((unsigned int *)(library->data + sizeof(library_header_t)))[hash_name(name) & (header->n_buckets - 1)];
+	while (offset) {
+		library_entry_t *entry = (library_entry_t *)(library->data + offset);
+		if (strcmp(library->data + entry->name, name) == 0) {
+			return entry;
+		}
+		offset = entry->next;
+	}
+	return NULL;
+}
+
+ErrorCode get_library_macro(library_t *library, char *name, char **stored_name, char **content, int *line_number) {
+	library_entry_t *entry = find_entry(library, name);
+
+	if (!entry || entry->kind != LIBRARY_MACRO) {
+		return ERR_INTERNAL_ASSERT;
+	}
+	*stored_name = library->data + entry->name;
+	*content = library->data + entry->content;
+	*line_number = entry->line_number;
+	return SUCCESS;
+}
+
+int is_library_extern(library_t *library, char *name) {
+	library_entry_t *entry = find_entry(library, name);
+	return entry && entry->kind == LIBRARY_EXTERN;
+}
+
+void dump_library_files(library_t *library, FILE *file, const char *format) {
+	if (*library->source_filename) {
+		fprintf(file, format, library->source_filename);
+	}
+	fprintf(file, format, library->filename);
+}
@@ -0,0 +1,50 @@
+#ifndef LIBRARY_H
+#define LIBRARY_H
+
+#include <stdio.h>
+#include "error_codes.h"
+
+/* A mapped macro library */
+typedef struct library_t library_t;
+
+/**
+Opens a macro library.
+A library source (.as) holds only macro definitions and .extern declarations.
+It is compiled on first use into a library file (.mlb), a hashed table of the macros and externs,
+which is used as is from then on, and compiled again when the source changes size or time.
+Library files are mapped read-only and stay mapped, so a library shared by many sources
+is read once per process, and can be used by any thread.
+   @param name: The library name, without extension.
+   @param library: Pointer to store the library.
+   @return SUCCESS if the library was opened, error otherwise.
+*/
+ErrorCode open_library(char *name, library_t **library);
+
+/**
+Looks up a macro in a library.
+   @param library: The library.
+   @param name: The macro name.
+   @param stored_name: Pointer to store the name as stored in the library.
+   @param content: Pointer to store the macro content.
+   @param line_number: Pointer to store the line of the macro definition in the library source.
+   @return SUCCESS if the macro was found, error otherwise.
+*/
+ErrorCode get_library_macro(library_t *library, char *name, char **stored_name, char **content, int *line_number);
+
+/**
+Checks if a name is declared as external by a library.
+   @param library: The library.
+   @param name: The symbol name.
+   @return 1 if the name is an external symbol of the library, 0 otherwise.
+*/
+int is_library_extern(library_t *library, char *name);
+
+/**
+Writes the files of a library, the library source and the library file.
+   @param library: The library.
+   @param file: The file pointer to write to.
+   @param format: The format of each file name, with a single %s.
+*/
+void dump_library_files(library_t *library, FILE *file, const char *format);
+
+#endif /* LIBRARY_H */
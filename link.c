@@ -0,0 +1,450 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "assemble.h"
+#include "parallel.h"
+#include "output.h"
+#include "reach.h"
+#include "link.h"
+
+/* Loaded objects --------------------------------------------- */
+
+/* A symbol record of an entry or extern file */
+typedef struct {
+	char *name;
+	int address;
+} link_symbol_t;
+
+/* An object loaded from its output files */
+typedef struct {
+	char *base;
+	int code_size;
+	int data_size;
+	assembly_t *words; /* Code words followed by data words */
+	link_symbol_t *entries;
+	int n_entries;
+	link_symbol_t *externs;
+	int n_externs;
+	int code_base; /* First code address in the linked image */
+	int data_base; /* First data address in the linked image */
+
+	/* Load error, reported after all objects are loaded */
+	ErrorCode error;
+	char error_filename[MAX_FILE_NAME];
+	int error_line;
+} object_t;
+
+/* Reads "name address" records. A missing file has no records. */
+static ErrorCode load_symbols(char *filename, link_symbol_t **symbols, int *n_symbols, int *line_number) {
+	FILE *file;
+	char line[LINE_LEN];
+	char name[LINE_LEN];
+	int address;
+	int capacity = 0;
+
+	*symbols = NULL;
+	*n_symbols = 0;
+	*line_number = 0;
+
+	file = fopen(filename, "r");
+	if (!file) {
+		return SUCCESS;
+	}
+
+	while (fgets(line, LINE_LEN, file)) {
+		(*line_number)++;
+		if (is_whitespaces(line)) {
+			continue;
+		}
+		if (sscanf(line, "%s %d", name, &address) != 2) {
+			fclose(file);
+			return ERR_OBJECT_ILLEGAL;
+		}
+
+		/* Grow the records array as needed */
+		if (*n_symbols == capacity) {
+			link_symbol_t *grown;
+			capacity = capacity ? capacity * 2 : 16;
+			grown = (link_symbol_t *)realloc(*symbols, capacity * sizeof(link_symbol_t));
+			if (!grown) {
+				fclose(file);
+				return ERR_OUT_OF_MEMORY;
+			}
+			*symbols = grown;
+		}
+		(*symbols)[*n_symbols].name = my_strdup(name);
+		(*symbols)[*n_symbols].address = address;
+		(*n_symbols)++;
+	}
+
+	*line_number = 0;
+	fclose(file);
+	return SUCCESS;
+}
+
+/* Reads the code and data words of an .ob file */
+static ErrorCode load_words(char *filename, object_t *object, int *line_number) {
+	FILE *file;
+	char line[LINE_LEN];
+	int address;
+	unsigned int value;
+	int i;
+
+	*line_number = 0;
+	file = fopen(filename, "r");
+	if (!file) {
+		return ERR_FILE_NOT_EXIST;
+	}
+
+	/* Header line holds the code and data sizes */
+	*line_number = 1;
+	if (!fgets(line, LINE_LEN, file) ||
+		sscanf(line, "%d %d", &object->code_size, &object->data_size) != 2 ||
+		object->code_size < 0 || object->data_size < 0 ||
+		object->code_size + object->data_size > MEMORY_SIZE
+	) {
+		fclose(file);
+		return ERR_OBJECT_ILLEGAL;
+	}
+
+	object->words = (assembly_t *)malloc((object->code_size + object->data_size + 1) * sizeof(assembly_t));
+	if (!object->words) {
+		fclose(file);
+		return ERR_OUT_OF_MEMORY;
+	}
+
+	/* Words must follow each other from the first code address */
+	for (i = 0; i < object->code_size + object->data_size; i++) {
+		(*line_number)++;
+		if (!fgets(line, LINE_LEN, file) ||
+			sscanf(line, "%d %x", &address, &value) != 2 ||
+			address != IC_BASE + i
+		) {
+			fclose(file);
+			return ERR_OBJECT_ILLEGAL;
+		}
+		object->words[i].data.value = value;
+	}
+
+	*line_number = 0;
+	fclose(file);
+	return SUCCESS;
+}
+
+/* Loads all the output files of a single object */
+static void load_object(void *context, int index) {
+	object_t *object = (object_t *)context + index;
+	char *filename = object->error_filename;
+
+	get_filename(object->base, "ob", filename);
+	object->error = load_words(filename, object, &object->error_line);
+	if (object->error != SUCCESS) {
+		return;
+	}
+
+	get_filename(object->base, "ent", filename);
+	object->error = load_symbols(filename, &object->entries, &object->n_entries, &object->error_line);
+	if (object->error != SUCCESS) {
+		return;
+	}
+
+	get_filename(object->base, "ext", filename);
+	object->error = load_symbols(filename, &object->externs, &object->n_externs, &object->error_line);
+}
+
+/* Frees the memory of all loaded objects */
+static void purge_objects(object_t *objects, int n_objects) {
+	int i, j;
+	for (i = 0; i < n_objects; i++) {
+		for (j = 0; j < objects[i].n_entries; j++) {
+			free(objects[i].entries[j].name);
+		}
+		for (j = 0; j < objects[i].n_externs; j++) {
+			free(objects[i].externs[j].name);
+		}
+		free(objects[i].entries);
+		free(objects[i].externs);
+		free(objects[i].words);
+	}
+	free(objects);
+}
+
+/* Maps an address of an object to its address in the linked image */
+static int relocate(object_t *object, int address) {
+	if (address < IC_BASE + object->code_size) {
+		return object->code_base + address - IC_BASE;
+	}
+	return object->data_base + address - IC_BASE - object->code_size;
+}
+
+/* Global entry table --------------------------------------------- */
+
+/* An entry in the hashed entry table */
+typedef struct entry_node_t {
+	char *name;
+	int address;
+	struct entry_node_t *next;
+} entry_node_t;
+
+static entry_node_t **entry_table = NULL;
+static int entry_table_size = 0;
+
+/* Hashes a name into an entry table bucket */
+static int hash_name(char *name) {
+	unsigned long hash = 5381;
+	while (*name) {
+		hash = hash * 33 + (unsigned char)*name++;
+	}
+	return (int)(hash & (entry_table_size - 1));
+}
+
+/* Allocates an empty entry table for the given number of entries */
+static ErrorCode init_entries(int n_entries) {
+	entry_table_size = 64;
+	while (entry_table_size < n_entries * 2) {
+		entry_table_size *= 2;
+	}
+	entry_table = (entry_node_t **)calloc(entry_table_size, sizeof(entry_node_t *));
+	if (!entry_table) {
+		return ERR_OUT_OF_MEMORY;
+	}
+	return SUCCESS;
+}
+
+static ErrorCode get_entry(char *name, int *address) {
+	entry_node_t *current = entry_table[hash_name(name)];
+	while (current) {
+		if (strcmp(current->name, name) == 0) {
+			if (address) {
+				*address = current->address;
+			}
+			return SUCCESS;
+		}
+		current = current->next;
+	}
+	return ERR_SYMBOL_UNDEFINED;
+}
+
+static ErrorCode add_entry(char *name, int address) {
+	entry_node_t *node;
+	int bucket;
+
+	/* An entry may only be exported by a single object */
+	if (get_entry(name, NULL) == SUCCESS) {
+		return ERR_SYMBOL_REDEFINITION;
+	}
+
+	node = (entry_node_t *)malloc(sizeof(entry_node_t));
+	if (!node) {
+		return ERR_OUT_OF_MEMORY;
+	}
+	bucket = hash_name(name);
+	node->name = name;
+	node->address = address;
+	node->next = entry_table[bucket];
+	entry_table[bucket] = node;
+	return SUCCESS;
+}
+
+static void purge_entries() {
+	int i;
+	for (i = 0; i < entry_table_size; i++) {
+		entry_node_t *current = entry_table[i];
+		while (current) {
+			entry_node_t *next = current->next;
+			free(current);
+			current = next;
+		}
+	}
+	free(entry_table);
+	entry_table = NULL;
+	entry_table_size = 0;
+}
+
+/* Linker --------------------------------------------- */
+
+/* Places all code sections, followed by all data sections, in a single image */
+static assembly_t *build_image(object_t *objects, int n_objects, int code_size, int data_size) {
+	assembly_t *image;
+	int address = 0;
+	int i;
+
+	image = (assembly_t *)malloc((code_size + data_size + 1) * sizeof(assembly_t));
+	if (!image) {
+		return NULL;
+	}
+	for (i = 0; i < n_objects; i++) {
+		memcpy(image + address, objects[i].words, objects[i].code_size * sizeof(assembly_t));
+		address += objects[i].code_size;
+	}
+	for (i = 0; i < n_objects; i++) {
+		memcpy(image + address, objects[i].words + objects[i].code_size, objects[i].data_size * sizeof(assembly_t));
+		address += objects[i].data_size;
+	}
+	return image;
+}
+
+/* Writes the linked image */
+static void dump_image(FILE *file, assembly_t *image, int code_size, int data_size) {
+	char line[LINE_LEN];
+	int i;
+
+	sprintf(line, "%7d %-6d\n", code_size, data_size);
+	fputs(line, file);
+
+	for (i = 0; i < code_size + data_size; i++) {
+		sprintf(line, "%07d %06x\n", IC_BASE + i, image[i].data.value);
+		fputs(line, file);
+	}
+}
+
+int link_process(char *output, char **names, int n_objects, int strip) {
+	object_t *objects;
+	assembly_t *image = NULL;
+	char filename[MAX_FILE_NAME];
+	FILE *file;
+	int code_size = 0;
+	int data_size = 0;
+	int n_entries = 0;
+	int i, j;
+	ErrorCode error;
+	int error_state = 0;
+
+	if (is_filename_too_long(output)) {
+		is_error(ERR_FILE_NAME_TOO_LONG, NULL, output, 0, NULL);
+		return 1;
+	}
+	for (i = 0; i < n_objects; i++) {
+		if (is_filename_too_long(names[i])) {
+			is_error(ERR_FILE_NAME_TOO_LONG, NULL, names[i], 0, NULL);
+			return 1;
+		}
+	}
+
+	objects = (object_t *)calloc(n_objects, sizeof(object_t));
+	if (!objects) {
+		is_error(ERR_OUT_OF_MEMORY, NULL, output, 0, NULL);
+		return 1;
+	}
+	for (i = 0; i < n_objects; i++) {
+		objects[i].base = names[i];
+	}
+
+	/* Objects are independent, load them all at once */
+	get_filename(output, "ob", filename);
+	printf("Linking file %s...\n", filename);
+	printf("Loading objects...\n");
+	parallel_for(n_objects, load_object, objects);
+	for (i = 0; i < n_objects; i++) {
+		is_error(objects[i].error, &error_state, objects[i].error_filename, objects[i].error_line, NULL);
+	}
+	if (error_state) {
+		purge_objects(objects, n_objects);
+		return error_state;
+	}
+
+	/* Place all code sections, followed by all data sections */
+	for (i = 0; i < n_objects; i++) {
+		objects[i].code_base = IC_BASE + code_size;
+		code_size += objects[i].code_size;
+		n_entries += objects[i].n_entries;
+	}
+	for (i = 0; i < n_objects; i++) {
+		objects[i].data_base = IC_BASE + code_size + data_size;
+		data_size += objects[i].data_size;
+	}
+	if (code_size + data_size > MEMORY_SIZE) {
+		is_error(ERR_EXCEEDED_RAM, NULL, filename, 0, NULL);
+		purge_objects(objects, n_objects);
+		return 1;
+	}
+
+	/* Build the global entry table */
+	printf("Resolving symbols...\n");
+	error = init_entries(n_entries);
+	if (is_error(error, &error_state, filename, 0, NULL)) {
+		purge_objects(objects, n_objects);
+		return error_state;
+	}
+	for (i = 0; i < n_objects; i++) {
+		get_filename(objects[i].base, "ent", filename);
+		for (j = 0; j < objects[i].n_entries; j++) {
+			link_symbol_t *entry = &objects[i].entries[j];
+			error = add_entry(entry->name, relocate(&objects[i], entry->address));
+			is_error(error, &error_state, filename, j + 1, entry->name);
+		}
+	}
+
+	/* Relocate internal references and patch external ones */
+	for (i = 0; i < n_objects && !error_state; i++) {
+		object_t *object = &objects[i];
+
+		for (j = 0; j < object->code_size; j++) {
+			if (object->words[j].operand.ARE == CODING_R) {
+				object->words[j].operand.value = relocate(object, object->words[j].operand.value);
+			}
+		}
+
+		get_filename(object->base, "ext", filename);
+		for (j = 0; j < object->n_externs; j++) {
+			link_symbol_t *reference = &object->externs[j];
+			int index = reference->address - IC_BASE;
+			int address;
+
+			/* The reference must point to an external operand word */
+			if (index < 0 || index >= object->code_size || object->words[index].operand.ARE != CODING_E) {
+				is_error(ERR_OBJECT_ILLEGAL, &error_state, filename, j + 1, reference->name);
+				continue;
+			}
+			error = get_entry(reference->name, &address);
+			if (is_error(error, &error_state, filename, j + 1, reference->name)) {
+				continue;
+			}
+			object->words[index].operand.ARE = CODING_R;
+			object->words[index].operand.value = address;
+		}
+	}
+
+	if (!error_state) {
+		image = build_image(objects, n_objects, code_size, data_size);
+		get_filename(output, "ob", filename);
+		if (!image) {
+			is_error(ERR_OUT_OF_MEMORY, &error_state, filename, 0, NULL);
+		}
+	}
+
+	/* Remove unreachable code and data from the whole program */
+	if (!error_state && strip) {
+		int size = code_size + data_size;
+
+		printf("Removing unreachable code...\n");
+		error = strip_unreachable(image, &code_size, &data_size);
+		if (!is_error(error, &error_state, filename, 0, NULL)) {
+			printf("Removed %d unreachable words.\n", size - code_size - data_size);
+		}
+	}
+
+	if (!error_state) {
+		printf("Generating output files...\n");
+		file = open_output(filename);
+		if (file) {
+			dump_image(file, image, code_size, data_size);
+			if (!is_error(close_output(file), &error_state, filename, 0, NULL)) {
+				if (get_unchanged_outputs() > 0) {
+					printf("Kept unchanged output file.\n");
+				}
+				printf("Done file.\n");
+			}
+		}
+		else {
+			is_error(ERR_FILE_CANNOT_CREATE, &error_state, filename, 0, NULL);
+		}
+	}
+
+	free(image);
+	purge_entries();
+	purge_objects(objects, n_objects);
+	return error_state;
+}
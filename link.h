@@ -0,0 +1,22 @@
+#ifndef LINK_H
+#define LINK_H
+
+#include "error_codes.h"
+
+/**
+Links assembled objects into a single executable image.
+Each object is given by its base file name, and consists of its .ob file,
+and the optional .ent and .ext files written by the assembler.
+The code sections of all objects are placed first, followed by all data sections.
+Relocatable words are moved to their new addresses, and each external reference
+is patched with the address of the matching entry in another object.
+Optionally, code and data that cannot be reached from the start of the program are removed (see reach.h).
+	@param output: The base name of the linked .ob file.
+	@param objects: The base names of the objects to link.
+	@param n_objects: The number of objects.
+	@param strip: Nonzero to remove unreachable code and data.
+	@return 0 on success, 1 on failure.
+*/
+int link_process(char *output, char **objects, int n_objects, int strip);
+
+#endif /* LINK_H */
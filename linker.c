@@ -0,0 +1,33 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "link.h"
+
+/**
+ * This program links objects built by the assembler into a single executable image.
+ * Usage: linker [--gc-sections] <output> <object> [<object> ...]
+ * Each object is given by its base name, as passed to the assembler.
+ * The linked image is written to the output's .ob file.
+ * With --gc-sections, code and data that the program can never reach are left out of the image.
+ */
+int main(int argc, char **argv)
+{
+	char *program = argv[0];
+	int strip = 0;
+
+	if (argc > 1 && strcmp(argv[1], "--gc-sections") == 0) {
+		strip = 1;
+		argc--;
+		argv++;
+	}
+
+	/* Check that an output and at least one object are provided */
+	if (argc < 3)
+	{
+		printf("Usage: %s [--gc-sections] <output> <object> [<object> ...]\n", program);
+		exit(1);
+	}
+
+	return link_process(argv[1], argv + 2, argc - 2, strip);
+}
@@ -0,0 +1,634 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "language.h"
+#include "machine.h"
+
+#define WORD_MASK 0xffffff
+
+/* Instruction kind by its opcode and funct */
+#define KIND(opcode, funct) ((opcode) * 8 + (funct))
+#define KIND_MOV KIND(0, 0)
+#define KIND_CMP KIND(1, 0)
+#define KIND_ADD KIND(2, 1)
+#define KIND_SUB KIND(2, 2)
+#define KIND_LEA KIND(4, 0)
+#define KIND_CLR KIND(5, 1)
+#define KIND_NOT KIND(5, 2)
+#define KIND_INC KIND(5, 3)
+#define KIND_DEC KIND(5, 4)
+#define KIND_JMP KIND(9, 1)
+#define KIND_BNE KIND(9, 2)
+#define KIND_JSR KIND(9, 3)
+#define KIND_RED KIND(12, 0)
+#define KIND_PRN KIND(13, 0)
+#define KIND_RTS KIND(14, 0)
+#define KIND_STOP KIND(15, 0)
+#define KIND_EXTERNAL 0xff /* An instruction with an unresolved operand */
+
+/* Sign extends the low 24 bits of a value */
+static int to_word(int value) {
+	return ((value & WORD_MASK) ^ 0x800000) - 0x800000;
+}
+
+static void purge_blocks(machine_t *machine);
+
+ErrorCode machine_init(machine_t *machine, FILE *input, FILE *output) {
+	memset(machine, 0, sizeof(machine_t));
+	machine->memory = (int *)calloc(MACHINE_MEMORY, sizeof(int));
+	if (!machine->memory) {
+		return ERR_OUT_OF_MEMORY;
+	}
+	machine->input = input;
+	machine->output = output;
+	machine->cache_blocks = 1;
+	return SUCCESS;
+}
+
+ErrorCode machine_load(machine_t *machine, FILE *file, int *line_number) {
+	char line[LINE_LEN];
+	int code_size, data_size;
+	int address;
+	unsigned int value;
+	int i;
+
+	/* Header line holds the code and data sizes */
+	*line_number = 1;
+	if (!fgets(line, LINE_LEN, file) ||
+		sscanf(line, "%d %d", &code_size, &data_size) != 2 ||
+		code_size < 0 || data_size < 0 ||
+		code_size + data_size > MEMORY_SIZE
+	) {
+		return ERR_OBJECT_ILLEGAL;
+	}
+
+	/* Words must follow each other from the first code address */
+	memset(machine->memory, 0, MACHINE_MEMORY * sizeof(int));
+	for (i = 0; i < code_size + data_size; i++) {
+		(*line_number)++;
+		if (!fgets(line, LINE_LEN, file) ||
+			sscanf(line, "%d %x", &address, &value) != 2 ||
+			address != IC_BASE + i
+		) {
+			return ERR_OBJECT_ILLEGAL;
+		}
+		machine->memory[address] = to_word(value);
+	}
+	*line_number = 0;
+
+	/* Start from a reset machine, when it already ran a program */
+	memset(machine->registers, 0, sizeof(machine->registers));
+	machine->zero_flag = 0;
+	machine->negative_flag = 0;
+	machine->stack_size = 0;
+	machine->halted = 0;
+	machine->instructions = 0;
+	machine->cycles = 0;
+
+	/* Allocate the predecoded instructions, all are decoded on demand */
+	purge_blocks(machine);
+	machine->code_modified = 0;
+	free(machine->ops);
+	free(machine->profile);
+	machine->profile = NULL;
+	machine->code_end = IC_BASE + code_size;
+	machine->data_end = machine->code_end + data_size;
+	machine->ops = (micro_op_t *)calloc(machine->code_end, sizeof(micro_op_t));
+	if (!machine->ops) {
+		return ERR_OUT_OF_MEMORY;
+	}
+
+	machine->pc = IC_BASE;
+	return SUCCESS;
+}
+
+/* Decodes the instruction at the given address into a micro operation */
+static ErrorCode decode(machine_t *machine, int address) {
+	micro_op_t *op = &machine->ops[address];
+	instruction_t *instruction;
+	assembly_t assembly;
+	int modes[MAX_OPERANDS];
+	int operands[MAX_OPERANDS];
+	int external = 0;
+	int length = 1;
+	int n, i;
+
+	assembly.data.value = machine->memory[address] & WORD_MASK;
+	if (assembly.instruction.ARE != CODING_A ||
+		get_instruction_by_code(assembly.instruction.opcode, assembly.instruction.funct, &instruction) != SUCCESS
+	) {
+		return ERR_RUNTIME_ILLEGAL_INSTRUCTION;
+	}
+
+	/* With a single operand, it is the destination */
+	n = instruction->number_of_operands;
+	modes[0] = n == 2 ? assembly.instruction.src_addr : assembly.instruction.dst_addr;
+	modes[1] = assembly.instruction.dst_addr;
+
+	for (i = 0; i < n; i++) {
+		if (!is_valid_addressing(modes[i], instruction->allowed_addressing[i])) {
+			return ERR_RUNTIME_ILLEGAL_INSTRUCTION;
+		}
+
+		/* Registers are encoded in the instruction word */
+		if (modes[i] == REG) {
+			operands[i] = (n == 2 && i == 0) ? assembly.instruction.src_reg : assembly.instruction.dst_reg;
+		}
+		/* Other operands take the next word */
+		else {
+			assembly_t operand;
+			if (address + length >= machine->code_end) {
+				return ERR_RUNTIME_ILLEGAL_INSTRUCTION;
+			}
+			operand.data.value = machine->memory[address + length] & WORD_MASK;
+			length++;
+
+			if (operand.operand.ARE == CODING_E) {
+				external = 1;
+			}
+			operands[i] = operand.operand.value;
+			/* Relational operands are resolved to their target address */
+			if (modes[i] == RELATIONAL) {
+				operands[i] += address;
+			}
+		}
+	}
+
+	op->kind = external ? KIND_EXTERNAL : KIND(instruction->opcode, instruction->funct);
+	op->length = length;
+	op->src_mode = n == 2 ? modes[0] : 0;
+	op->dst_mode = n > 0 ? modes[n - 1] : 0;
+	op->src = n == 2 ? operands[0] : 0;
+	op->dst = n > 0 ? operands[n - 1] : 0;
+	return SUCCESS;
+}
+
+/* Reads the value of an operand */
+static ErrorCode load_value(machine_t *machine, int mode, int operand, int *value) {
+	switch (mode) {
+		case IMMEDIATE:
+			*value = operand;
+			break;
+		case REG:
+			*value = machine->registers[operand];
+			break;
+		default:
+			if (operand < 0 || operand >= MACHINE_MEMORY) {
+				return ERR_RUNTIME_ILLEGAL_ADDRESS;
+			}
+			machine->cycles++;
+			*value = machine->memory[operand];
+			break;
+	}
+	return SUCCESS;
+}
+
+/* Writes a value to an operand */
+static ErrorCode store_value(machine_t *machine, int mode, int operand, int value) {
+	if (mode == REG) {
+		machine->registers[operand] = to_word(value);
+		return SUCCESS;
+	}
+
+	if (operand < 0 || operand >= MACHINE_MEMORY) {
+		return ERR_RUNTIME_ILLEGAL_ADDRESS;
+	}
+	machine->cycles++;
+	machine->memory[operand] = to_word(value);
+
+	/* Self modifying code: discard the instructions that may cover this word */
+	if (operand < machine->code_end) {
+		int i;
+		machine->code_modified = 1;
+		for (i = operand; i >= 0 && i > operand - 1 - MAX_OPERANDS; i--) {
+			machine->ops[i].length = 0;
+		}
+	}
+	return SUCCESS;
+}
+
+/* Executes a single decoded instruction, and moves the program counter */
+static ErrorCode execute(machine_t *machine, micro_op_t *op) {
+	ErrorCode error = SUCCESS;
+	/* The instruction may overwrite itself, keep its length */
+	int length = op->length;
+	int src, dst;
+
+	machine->instructions++;
+	machine->cycles += length;
+
+	switch (op->kind) {
+		case KIND_MOV:
+			error = load_value(machine, op->src_mode, op->src, &src);
+			if (error == SUCCESS) {
+				error = store_value(machine, op->dst_mode, op->dst, src);
+			}
+			break;
+
+		case KIND_CMP:
+			error = load_value(machine, op->src_mode, op->src, &src);
+			if (error == SUCCESS) {
+				error = load_value(machine, op->dst_mode, op->dst, &dst);
+			}
+			if (error != SUCCESS) {
+				return error;
+			}
+			machine->zero_flag = to_word(src - dst) == 0;
+			machine->negative_flag = to_word(src - dst) < 0;
+			break;
+
+		case KIND_ADD:
+		case KIND_SUB:
+			error = load_value(machine, op->src_mode, op->src, &src);
+			if (error == SUCCESS) {
+				error = load_value(machine, op->dst_mode, op->dst, &dst);
+			}
+			if (error == SUCCESS) {
+				error = store_value(machine, op->dst_mode, op->dst, op->kind == KIND_ADD ? dst + src : dst - src);
+			}
+			break;
+
+		case KIND_LEA:
+			error = store_value(machine, op->dst_mode, op->dst, op->src);
+			break;
+
+		case KIND_CLR:
+			error = store_value(machine, op->dst_mode, op->dst, 0);
+			break;
+
+		case KIND_NOT:
+		case KIND_INC:
+		case KIND_DEC:
+			error = load_value(machine, op->dst_mode, op->dst, &dst);
+			if (error == SUCCESS) {
+				dst = op->kind == KIND_NOT ? ~dst : op->kind == KIND_INC ? dst + 1 : dst - 1;
+				error = store_value(machine, op->dst_mode, op->dst, dst);
+			}
+			break;
+
+		case KIND_JMP:
+			machine->pc = op->dst;
+			return SUCCESS;
+
+		case KIND_BNE:
+			if (!machine->zero_flag) {
+				machine->pc = op->dst;
+				return SUCCESS;
+			}
+			break;
+
+		case KIND_JSR:
+			if (machine->stack_size == STACK_SIZE) {
+				return ERR_RUNTIME_STACK_OVERFLOW;
+			}
+			machine->stack[machine->stack_size++] = machine->pc + length;
+			machine->pc = op->dst;
+			return SUCCESS;
+
+		case KIND_RTS:
+			if (machine->stack_size == 0) {
+				return ERR_RUNTIME_STACK_UNDERFLOW;
+			}
+			machine->pc = machine->stack[--machine->stack_size];
+			return SUCCESS;
+
+		case KIND_RED:
+			dst = machine->input ? fgetc(machine->input) : EOF;
+			error = store_value(machine, op->dst_mode, op->dst, dst == EOF ? -1 : dst);
+			break;
+
+		case KIND_PRN:
+			error = load_value(machine, op->dst_mode, op->dst, &dst);
+			if (error == SUCCESS && machine->output) {
+				fputc(dst & 0xff, machine->output);
+			}
+			break;
+
+		case KIND_STOP:
+			machine->halted = 1;
+			return SUCCESS;
+
+		case KIND_EXTERNAL:
+			return ERR_RUNTIME_EXTERNAL;
+
+		default:
+			return ERR_RUNTIME_ILLEGAL_INSTRUCTION;
+	}
+
+	if (error == SUCCESS) {
+		machine->pc += length;
+	}
+	return error;
+}
+
+/* Decoded block cache ------------------------------------------------- */
+
+#define MAX_BLOCK_OPS 64
+
+/* Specialized forms of common register and immediate instructions */
+typedef enum {
+	FAST_GENERIC,
+	FAST_MOV_RR,
+	FAST_MOV_IR,
+	FAST_ADD_RR,
+	FAST_ADD_IR,
+	FAST_SUB_RR,
+	FAST_SUB_IR,
+	FAST_CMP_RR,
+	FAST_CMP_RI,
+	FAST_CMP_IR,
+	FAST_CLR_R,
+	FAST_INC_R,
+	FAST_DEC_R
+} fast_kind_t;
+
+/* Checks if the instruction ends a basic block */
+static int is_block_end(micro_op_t *op) {
+	switch (op->kind) {
+		case KIND_JMP:
+		case KIND_BNE:
+		case KIND_JSR:
+		case KIND_RTS:
+		case KIND_STOP:
+		case KIND_EXTERNAL:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+/* Selects a specialized form for an instruction, by its addressing methods */
+static fast_kind_t specialize(micro_op_t *op) {
+	int rr = op->src_mode == REG && op->dst_mode == REG;
+	int ir = op->src_mode == IMMEDIATE && op->dst_mode == REG;
+	int ri = op->src_mode == REG && op->dst_mode == IMMEDIATE;
+
+	switch (op->kind) {
+		case KIND_MOV: return rr ? FAST_MOV_RR : ir ? FAST_MOV_IR : FAST_GENERIC;
+		case KIND_ADD: return rr ? FAST_ADD_RR : ir ? FAST_ADD_IR : FAST_GENERIC;
+		case KIND_SUB: return rr ? FAST_SUB_RR : ir ? FAST_SUB_IR : FAST_GENERIC;
+		case KIND_CMP: return rr ? FAST_CMP_RR : ri ? FAST_CMP_RI : ir ? FAST_CMP_IR : FAST_GENERIC;
+		case KIND_CLR: return op->dst_mode == REG ? FAST_CLR_R : FAST_GENERIC;
+		case KIND_INC: return op->dst_mode == REG ? FAST_INC_R : FAST_GENERIC;
+		case KIND_DEC: return op->dst_mode == REG ? FAST_DEC_R : FAST_GENERIC;
+		default: return FAST_GENERIC;
+	}
+}
+
+/* Frees all cached blocks */
+static void purge_blocks(machine_t *machine) {
+	free(machine->block_index);
+	free(machine->blocks);
+	free(machine->block_ops);
+	machine->block_index = NULL;
+	machine->blocks = NULL;
+	machine->block_ops = NULL;
+	machine->n_blocks = 0;
+	machine->blocks_capacity = 0;
+	machine->n_block_ops = 0;
+	machine->block_ops_capacity = 0;
+}
+
+/* Returns the cached block starting at the program counter, decoding it if needed */
+static ErrorCode get_block(machine_t *machine, block_t **block) {
+	ErrorCode error;
+	block_t *new_block;
+	int address = machine->pc;
+	int i;
+
+	/* Allocate the index on first use */
+	if (!machine->block_index) {
+		machine->block_index = (int *)malloc(machine->code_end * sizeof(int));
+		if (!machine->block_index) {
+			return ERR_OUT_OF_MEMORY;
+		}
+		for (i = 0; i < machine->code_end; i++) {
+			machine->block_index[i] = -1;
+		}
+	}
+	if (machine->block_index[address] >= 0) {
+		*block = &machine->blocks[machine->block_index[address]];
+		return SUCCESS;
+	}
+
+	/* Grow the block and instruction arrays */
+	if (machine->n_blocks == machine->blocks_capacity) {
+		block_t *grown;
+		int capacity = machine->blocks_capacity ? machine->blocks_capacity * 2 : 64;
+		grown = (block_t *)realloc(machine->blocks, capacity * sizeof(block_t));
+		if (!grown) {
+			return ERR_OUT_OF_MEMORY;
+		}
+		machine->blocks = grown;
+		machine->blocks_capacity = capacity;
+	}
+	if (machine->n_block_ops + MAX_BLOCK_OPS > machine->block_ops_capacity) {
+		block_op_t *grown;
+		int capacity = machine->block_ops_capacity ? machine->block_ops_capacity * 2 : 1024;
+		grown = (block_op_t *)realloc(machine->block_ops, capacity * sizeof(block_op_t));
+		if (!grown) {
+			return ERR_OUT_OF_MEMORY;
+		}
+		machine->block_ops = grown;
+		machine->block_ops_capacity = capacity;
+	}
+
+	/* Collect decoded instructions till the first jump, or an instruction that cannot be decoded */
+	new_block = &machine->blocks[machine->n_blocks];
+	new_block->first_op = machine->n_block_ops;
+	new_block->n_ops = 0;
+	while (new_block->n_ops < MAX_BLOCK_OPS && address < machine->code_end) {
+		micro_op_t *op = &machine->ops[address];
+		block_op_t *block_op;
+
+		if (op->length == 0) {
+			error = decode(machine, address);
+			if (error != SUCCESS) {
+				/* Report the error when it is reached */
+				if (new_block->n_ops == 0) {
+					return error;
+				}
+				break;
+			}
+		}
+
+		block_op = &machine->block_ops[new_block->first_op + new_block->n_ops];
+		block_op->op = *op;
+		block_op->address = address;
+		block_op->fast = specialize(op);
+		new_block->n_ops++;
+
+		if (is_block_end(op)) {
+			break;
+		}
+		address += op->length;
+	}
+
+	machine->n_block_ops += new_block->n_ops;
+	machine->block_index[machine->pc] = machine->n_blocks++;
+	*block = new_block;
+	return SUCCESS;
+}
+
+/* Counts the executions of a block's instructions, from the given one to the last */
+static void profile_block(machine_t *machine, block_op_t *block_op, block_op_t *end, int n) {
+	for (; block_op < end; block_op++) {
+		machine->profile[block_op->address] += n;
+	}
+}
+
+/* Runs a cached block, specialized instructions run inline */
+static ErrorCode run_block(machine_t *machine, block_t *block) {
+	ErrorCode error;
+	block_op_t *block_op = &machine->block_ops[block->first_op];
+	block_op_t *end = block_op + block->n_ops;
+	int *registers = machine->registers;
+	micro_op_t *op;
+
+	/* Count the whole block, and take back what an early exit skips */
+	if (machine->profile) {
+		profile_block(machine, block_op, end, 1);
+	}
+
+	for (; block_op < end; block_op++) {
+		op = &block_op->op;
+		switch (block_op->fast) {
+			case FAST_MOV_RR:
+				registers[op->dst] = registers[op->src];
+				break;
+			case FAST_MOV_IR:
+				registers[op->dst] = op->src;
+				break;
+			case FAST_ADD_RR:
+				registers[op->dst] = to_word(registers[op->dst] + registers[op->src]);
+				break;
+			case FAST_ADD_IR:
+				registers[op->dst] = to_word(registers[op->dst] + op->src);
+				break;
+			case FAST_SUB_RR:
+				registers[op->dst] = to_word(registers[op->dst] - registers[op->src]);
+				break;
+			case FAST_SUB_IR:
+				registers[op->dst] = to_word(registers[op->dst] - op->src);
+				break;
+			case FAST_CMP_RR:
+				machine->zero_flag = registers[op->src] == registers[op->dst];
+				machine->negative_flag = to_word(registers[op->src] - registers[op->dst]) < 0;
+				break;
+			case FAST_CMP_RI:
+				machine->zero_flag = to_word(registers[op->src] - op->dst) == 0;
+				machine->negative_flag = to_word(registers[op->src] - op->dst) < 0;
+				break;
+			case FAST_CMP_IR:
+				machine->zero_flag = to_word(op->src - registers[op->dst]) == 0;
+				machine->negative_flag = to_word(op->src - registers[op->dst]) < 0;
+				break;
+			case FAST_CLR_R:
+				registers[op->dst] = 0;
+				break;
+			case FAST_INC_R:
+				registers[op->dst] = to_word(registers[op->dst] + 1);
+				break;
+			case FAST_DEC_R:
+				registers[op->dst] = to_word(registers[op->dst] - 1);
+				break;
+
+			default:
+				/* Other instructions run through the interpreter */
+				machine->pc = block_op->address;
+				error = execute(machine, op);
+				if (error != SUCCESS || machine->halted || machine->code_modified) {
+					if (machine->profile) {
+						profile_block(machine, block_op + 1, end, -1);
+					}
+					return error;
+				}
+				continue;
+		}
+		machine->instructions++;
+		machine->cycles += op->length;
+	}
+
+	/* Fall through to the next instruction, unless the block ended with a jump */
+	if (!is_block_end(op)) {
+		machine->pc = (end - 1)->address + op->length;
+	}
+	return SUCCESS;
+}
+
+ErrorCode machine_run(machine_t *machine, long limit) {
+	ErrorCode error;
+	block_t *block;
+	micro_op_t *op;
+
+	machine->halted = 0;
+	while (!machine->halted) {
+		if (limit && machine->instructions >= limit) {
+			return ERR_RUNTIME_LIMIT;
+		}
+
+		/* Only the code section is executable */
+		if (machine->pc < IC_BASE || machine->pc >= machine->code_end) {
+			return ERR_RUNTIME_ILLEGAL_ADDRESS;
+		}
+
+		/* Overwritten code is decoded again, drop the blocks built from the old code */
+		if (machine->code_modified) {
+			purge_blocks(machine);
+			machine->code_modified = 0;
+		}
+
+		/* Run a whole block if it cannot pass the limit */
+		if (machine->cache_blocks) {
+			error = get_block(machine, &block);
+			if (error != SUCCESS) {
+				return error;
+			}
+			if (!limit || machine->instructions + block->n_ops <= limit) {
+				error = run_block(machine, block);
+				if (error != SUCCESS) {
+					return error;
+				}
+				continue;
+			}
+		}
+
+		/* Decode on first execution */
+		op = &machine->ops[machine->pc];
+		if (op->length == 0) {
+			error = decode(machine, machine->pc);
+			if (error != SUCCESS) {
+				return error;
+			}
+		}
+		if (machine->profile) {
+			machine->profile[machine->pc]++;
+		}
+		error = execute(machine, op);
+		if (error != SUCCESS) {
+			return error;
+		}
+	}
+	return SUCCESS;
+}
+
+ErrorCode machine_profile(machine_t *machine) {
+	free(machine->profile);
+	machine->profile = (long *)calloc(machine->code_end, sizeof(long));
+	if (!machine->profile) {
+		return ERR_OUT_OF_MEMORY;
+	}
+	return SUCCESS;
+}
+
+void machine_purge(machine_t *machine) {
+	purge_blocks(machine);
+	free(machine->memory);
+	free(machine->ops);
+	free(machine->profile);
+	machine->memory = NULL;
+	machine->ops = NULL;
+	machine->profile = NULL;
+}
@@ -0,0 +1,117 @@
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include <stdio.h>
+#include "error_codes.h"
+#include "assemble.h"
+
+#define REGISTERS 8
+#define STACK_SIZE 4096
+#define MACHINE_MEMORY (IC_BASE + MEMORY_SIZE)
+
+/* A predecoded instruction, with its operand words resolved */
+typedef struct {
+	unsigned char kind;     /* Instruction kind by opcode and funct */
+	unsigned char length;   /* Number of words, 0 if not decoded yet */
+	unsigned char src_mode; /* Addressing method of the source operand */
+	unsigned char dst_mode; /* Addressing method of the destination operand */
+	int src;                /* Register, immediate value or address */
+	int dst;                /* Register, immediate value or address */
+} micro_op_t;
+
+/* A predecoded instruction inside a cached block */
+typedef struct {
+	micro_op_t op;
+	int address;
+	unsigned char fast;     /* Specialized form of the instruction */
+} block_op_t;
+
+/* A basic block: instructions that run one after the other, up to a jump */
+typedef struct {
+	int first_op;           /* Index of the first instruction in the block instructions */
+	int n_ops;
+} block_t;
+
+/* State of the simulated machine */
+typedef struct {
+	int *memory;            /* Sign extended 24 bit words */
+	micro_op_t *ops;        /* Predecoded instructions of the code section */
+	int code_end;           /* First address after the code section */
+	int data_end;           /* First address after the data section */
+	int registers[REGISTERS];
+	int pc;
+	int zero_flag;
+	int negative_flag;
+	int stack[STACK_SIZE];  /* Return addresses */
+	int stack_size;
+	int halted;
+	int cache_blocks;       /* Run cached decoded blocks, set by default */
+	int code_modified;      /* Set when the code is overwritten, till the blocks are dropped */
+	int *block_index;       /* Block starting at each code address, -1 if none */
+	block_t *blocks;
+	int n_blocks;
+	int blocks_capacity;
+	block_op_t *block_ops;  /* Instructions of all the blocks */
+	int n_block_ops;
+	int block_ops_capacity;
+	long *profile;          /* Executions of each code address, NULL when not profiling */
+	long instructions;      /* Executed instructions */
+	long cycles;            /* Fetched words and memory accesses */
+	FILE *input;            /* Read by the red instruction */
+	FILE *output;           /* Written by the prn instruction */
+} machine_t;
+
+/**
+Initializes a machine with empty memory.
+	@param machine: The machine to initialize.
+	@param input: The file read by red, or NULL.
+	@param output: The file written by prn, or NULL.
+	@return: Error code indicating success or failure.
+*/
+ErrorCode machine_init(machine_t *machine, FILE *input, FILE *output);
+
+/**
+Loads an .ob file into the machine memory, and starts at the first code address.
+A machine that already ran a program is reset first, so it can run any number of programs.
+	@param machine: The machine to load into.
+	@param file: The opened .ob file.
+	@param line_number: A pointer to store the line of a load error.
+	@return: Error code indicating success or failure.
+*/
+ErrorCode machine_load(machine_t *machine, FILE *file, int *line_number);
+
+/**
+Runs the loaded program until it stops.
+Instructions are decoded once, on their first execution, into micro operations.
+Unless the block cache is turned off, straight line code is then collected into cached
+basic blocks, and common register and immediate instructions run without dispatching
+on their addressing methods.
+Writing to a code address discards the decoded instructions covering it,
+and the program continues on the interpreter, without cached blocks.
+Instructions:
+ - mov, add, sub, lea, clr, not, inc, dec: update the destination operand.
+ - cmp: sets the zero and negative flags by the source minus the destination.
+ - jmp, bne, jsr, rts: jump, branch if not zero, call and return.
+ - red: reads a character into the operand, -1 on end of input.
+ - prn: writes the operand as a character.
+ - stop: stops the machine.
+	@param machine: The machine to run.
+	@param limit: The maximal number of instructions to execute, 0 for no limit.
+	@return: SUCCESS when the program stops, a runtime error otherwise.
+*/
+ErrorCode machine_run(machine_t *machine, long limit);
+
+/**
+Starts counting the executions of each instruction of the loaded program.
+	@param machine: The machine, after the program is loaded.
+	@return: Error code indicating success or failure.
+*/
+ErrorCode machine_profile(machine_t *machine);
+
+/**
+Frees the memory of the machine.
+	@param machine: The machine to free.
+*/
+void machine_purge(machine_t *machine);
+
+#endif /* MACHINE_H */
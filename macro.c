@@ -1,11 +1,24 @@
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+
+#ifndef _WIN32
+	#include <pthread.h>
+#endif
+
 #include "utils.h"
 #include "language.h"
+#include "intern.h"
+#include "library.h"
 #include "macro.h"
 
+static ErrorCode add_line_origin(int source_line, char *macro, int macro_line);
+static ErrorCode add_macro_origins(char *name, int source_line);
+static ErrorCode include_macro_library(char *name);
+
 int macro_process(char *filename, FILE *source, FILE *destination)
 {
 	char name[LINE_LEN];
@@ -40,8 +53,22 @@ int macro_process(char *filename, FILE *source, FILE *destination)
 		}
 		
 		if (!in_macro) {
+			/* Include the macros and externs of a library */
+			if (is_include(first_word)) {
+				error = get_word(rest_of_line, name, NULL, LAST_WORD);
+				if (is_error(error, &error_state, filename, line_number, NULL)) {
+					continue;
+				}
+				if (strlen(name) < 3 || name[0] != '"' || name[strlen(name) - 1] != '"') {
+					is_error(ERR_STRING_ILLEGAL, &error_state, filename, line_number, NULL);
+					continue;
+				}
+				name[strlen(name) - 1] = '\0';
+				error = include_macro_library(name + 1);
+				is_error(error, &error_state, filename, line_number, name + 1);
+			}
 			/* Check if this is the beginning of a macro definition */
-			if(strcmp(first_word, "mcro") == 0) {
+			else if(strcmp(first_word, "mcro") == 0) {
 				error = get_word(rest_of_line, name, NULL, LAST_WORD);
 				if (is_error(error, &error_state, filename, line_number, NULL)) {
 					continue;
@@ -53,7 +80,7 @@ int macro_process(char *filename, FILE *source, FILE *destination)
 				}
 				
 				/* Add macro to the table */
-				error = add_macro(name);
+				error = add_macro(name, line_number);
 				if (is_error(error, &error_state, filename, line_number, NULL)) {
 					continue;
 				}
@@ -67,6 +94,10 @@ int macro_process(char *filename, FILE *source, FILE *destination)
 				
 				if (get_macro(first_word, &content) == SUCCESS) {
 					fputs(content, destination);
+					error = add_macro_origins(first_word, line_number);
+					if (is_error(error, &error_state, filename, line_number, NULL)) {
+						continue;
+					}
 					/* Ensure there is no trailing text after a macro call */
 					if (!is_whitespaces(rest_of_line)) {
 						is_error(ERR_TRAILING_TEXT, &error_state, filename, line_number, NULL);
@@ -76,6 +107,10 @@ int macro_process(char *filename, FILE *source, FILE *destination)
 				/* Otherwise, keep the original line */
 				else {
 					fputs(line, destination);
+					error = add_line_origin(line_number, NULL, 0);
+					if (is_error(error, &error_state, filename, line_number, NULL)) {
+						continue;
+					}
 				}
 			}
 		}
@@ -101,27 +136,131 @@ int macro_process(char *filename, FILE *source, FILE *destination)
 	return error_state;
 }
 
-/* Macro table --------------------------------------------- */
-
-# define MACRO_NAME_LEN 31
+/* Macro tables --------------------------------------------- */
 
 /* Struct for macro definition */
 typedef struct macro_t {
-    char *name;
+    name_id_t name;
     char *content;
+    int line_number;
     struct macro_t *next;
 } macro_t;
 
-/* Head of linked list of macro definitions*/
-static macro_t *macro_list = NULL;
+/* Origin of a line in the expanded file */
+typedef struct {
+	int source_line;
+	char *macro;
+	int macro_line;
+} line_origin_t;
+
+/* Tables of an expanded file */
+struct macro_state_t {
+	macro_t *macro_list;            /* Head of linked list of macro definitions */
+	line_origin_t *line_origins;    /* Origins of the expanded file lines, by line number */
+	int n_line_origins;
+	int line_origins_capacity;
+	int has_line_origins;           /* Nonzero if line origins are recorded, see set_line_origins */
+	library_t **libraries;          /* Included libraries */
+	int n_libraries;
+};
+
+/* Tables of the threads that have no tables of their own (see use_thread_macros) */
+static macro_state_t default_state = { NULL, NULL, 0, 0, 0, NULL, 0 };
+
+/* Frees the tables */
+static void purge_state(macro_state_t *state) {
+    macro_t *current = state->macro_list;
+	/* Free the macro table*/
+    while (current) {
+        macro_t *next = current->next;
+        free(current->content);
+        free(current);
+        current = next;
+    }
+
+	/* Free the line origins and included libraries, libraries stay mapped for the next files */
+	free(state->line_origins);
+	free(state->libraries);
+	memset(state, 0, sizeof(macro_state_t));
+}
+
+#ifndef _WIN32
+static pthread_key_t state_key;
+static pthread_once_t state_key_once = PTHREAD_ONCE_INIT;
+
+/* Frees the tables of an ending thread */
+static void free_thread_state(void *state) {
+	purge_state((macro_state_t *)state);
+	free(state);
+}
+
+static void create_state_key() {
+	pthread_key_create(&state_key, free_thread_state);
+}
+#endif
+
+/* Returns the tables of the calling thread */
+static macro_state_t *get_state() {
+#ifndef _WIN32
+	macro_state_t *state;
+
+	pthread_once(&state_key_once, create_state_key);
+	state = (macro_state_t *)pthread_getspecific(state_key);
+	if (state) {
+		return state;
+	}
+#endif
+	return &default_state;
+}
+
+ErrorCode use_thread_macros() {
+#ifndef _WIN32
+	macro_state_t *state;
+
+	pthread_once(&state_key_once, create_state_key);
+	if (pthread_getspecific(state_key)) {
+		return SUCCESS;
+	}
+	state = (macro_state_t *)calloc(1, sizeof(macro_state_t));
+	if (!state) {
+		return ERR_OUT_OF_MEMORY;
+	}
+	if (pthread_setspecific(state_key, state) != 0) {
+		free(state);
+		return ERR_OUT_OF_MEMORY;
+	}
+#endif
+	return SUCCESS;
+}
+
+macro_state_t *detach_macros() {
+	macro_state_t *state = get_state();
+	macro_state_t *detached = (macro_state_t *)malloc(sizeof(macro_state_t));
+
+	if (detached) {
+		*detached = *state;
+		memset(state, 0, sizeof(macro_state_t));
+	}
+	return detached;
+}
+
+void attach_macros(macro_state_t *detached) {
+	macro_state_t *state = get_state();
 
-ErrorCode add_macro(char *name) {
+	purge_state(state);
+	*state = *detached;
+	free(detached);
+}
+
+/* Macro table --------------------------------------------- */
+
+# define MACRO_NAME_LEN 31
+
+ErrorCode check_macro_name(char *name) {
 	int i;
-	macro_t *new_macro;
 
-	/* Validate macro name */
-    /* Check if the macro name is a reserved word */
-    if (is_reserved_word(name)) {
+    /* Check if the macro name is a reserved word, without interning it */
+    if (is_reserved_name(find_name(name))) {
         return ERR_MACRO_RESERVED;
     }
     
@@ -136,6 +275,18 @@ ErrorCode add_macro(char *name) {
 			return ERR_MACRO_ILLEGAL_NAME;
 		}
 	}
+	return SUCCESS;
+}
+
+ErrorCode add_macro(char *name, int line_number) {
+	macro_t *new_macro;
+	ErrorCode error;
+
+	/* Validate macro name */
+	error = check_macro_name(name);
+	if (error != SUCCESS) {
+		return error;
+	}
     
     /* Check if macro already exists */
 	if (get_macro(name, NULL) == SUCCESS) {
@@ -148,18 +299,25 @@ ErrorCode add_macro(char *name) {
         return ERR_OUT_OF_MEMORY;
     }
 
-    new_macro->name = my_strdup(name);
+    new_macro->name = intern_name(name);
+    if (new_macro->name == NO_NAME) {
+        free(new_macro);
+        return ERR_OUT_OF_MEMORY;
+    }
 	new_macro->content = NULL;
-    new_macro->next = macro_list;
-    macro_list = new_macro;
+	new_macro->line_number = line_number;
+    new_macro->next = get_state()->macro_list;
+    get_state()->macro_list = new_macro;
     
     return SUCCESS;
 }
 
 ErrorCode add_macro_content(char *name, char *content) {
-    macro_t *current = macro_list;
+    macro_t *current = get_state()->macro_list;
+    name_id_t id = find_name(name);
+
 	while (current) {
-        if (strcmp(current->name, name) == 0) {
+        if (current->name == id) {
 			/* Append content to the existing macro */
 			if (current->content == NULL) {
 				current->content = my_strdup(content);
@@ -181,30 +339,163 @@ int is_macro(char *name) {
 	return get_macro(name, NULL) == SUCCESS;
 }
 
-ErrorCode get_macro(char *name, char **content) {
-    macro_t *current = macro_list;
-	/* Search for the macro in the macro list */
-    while (current) {
-        if (strcmp(current->name, name) == 0) {
-			if (content) {
-            	*content = current->content;
-			}
+/* Finds a macro defined in the file or in an included library */
+static ErrorCode find_macro(char *name, char **stored_name, char **content, int *line_number) {
+	macro_state_t *state = get_state();
+    macro_t *current = state->macro_list;
+	name_id_t id = find_name(name);
+	int i;
+
+	/* Search for the macro in the macro list, a name that was never interned is not defined */
+    while (current && id != NO_NAME) {
+        if (current->name == id) {
+			*stored_name = get_name(id);
+			*content = current->content;
+			*line_number = current->line_number;
             return SUCCESS;
         }
         current = current->next;
     }
+
+	/* Then in the included libraries */
+	for (i = 0; i < state->n_libraries; i++) {
+		if (get_library_macro(state->libraries[i], name, stored_name, content, line_number) == SUCCESS) {
+			return SUCCESS;
+		}
+	}
     return ERR_INTERNAL_ASSERT;
 }
 
+ErrorCode get_macro(char *name, char **content) {
+	char *stored_name, *found_content;
+	int line_number;
+
+	if (find_macro(name, &stored_name, &found_content, &line_number) != SUCCESS) {
+		return ERR_INTERNAL_ASSERT;
+	}
+	if (content) {
+		*content = found_content;
+	}
+	return SUCCESS;
+}
+
+/* Libraries --------------------------------------------- */
+
+/* Includes a library in the tables of the file, once */
+static ErrorCode include_macro_library(char *name) {
+	macro_state_t *state = get_state();
+	library_t **grown;
+	library_t *library;
+	ErrorCode error;
+	int i;
+
+	error = open_library(name, &library);
+	if (error != SUCCESS) {
+		return error;
+	}
+	for (i = 0; i < state->n_libraries; i++) {
+		if (state->libraries[i] == library) {
+			return SUCCESS;
+		}
+	}
+
+	grown = (library_t **)realloc(state->libraries, (state->n_libraries + 1) * sizeof(library_t *));
+	if (!grown) {
+		return ERR_OUT_OF_MEMORY;
+	}
+	state->libraries = grown;
+	state->libraries[state->n_libraries++] = library;
+	return SUCCESS;
+}
+
+int is_included_extern(char *name) {
+	macro_state_t *state = get_state();
+	int i;
+
+	for (i = 0; i < state->n_libraries; i++) {
+		if (is_library_extern(state->libraries[i], name)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void dump_included_libraries(FILE *file, const char *format) {
+	macro_state_t *state = get_state();
+	int i;
+
+	for (i = 0; i < state->n_libraries; i++) {
+		dump_library_files(state->libraries[i], file, format);
+	}
+}
+
+/* Line origins --------------------------------------------- */
+
+void set_line_origins(int enabled) {
+	get_state()->has_line_origins = enabled;
+}
+
+/* Records the origin of the next line written to the expanded file */
+static ErrorCode add_line_origin(int source_line, char *macro, int macro_line) {
+	macro_state_t *state = get_state();
+
+	if (!state->has_line_origins) {
+		return SUCCESS;
+	}
+	if (state->n_line_origins == state->line_origins_capacity) {
+		line_origin_t *grown;
+		int capacity = state->line_origins_capacity ? state->line_origins_capacity * 2 : 256;
+		grown = (line_origin_t *)realloc(state->line_origins, capacity * sizeof(line_origin_t));
+		if (!grown) {
+			return ERR_OUT_OF_MEMORY;
+		}
+		state->line_origins = grown;
+		state->line_origins_capacity = capacity;
+	}
+	state->line_origins[state->n_line_origins].source_line = source_line;
+	state->line_origins[state->n_line_origins].macro = macro;
+	state->line_origins[state->n_line_origins].macro_line = macro_line;
+	state->n_line_origins++;
+	return SUCCESS;
+}
+
+/* Records the origins of the lines of an expanded macro */
+static ErrorCode add_macro_origins(char *name, int source_line) {
+	ErrorCode error = SUCCESS;
+	char *stored_name, *content;
+	char *pos;
+	int macro_line;
+
+	if (!get_state()->has_line_origins ||
+		find_macro(name, &stored_name, &content, &macro_line) != SUCCESS || !content) {
+		return SUCCESS;
+	}
+
+	/* Content lines follow the macro definition line */
+	macro_line++;
+	for (pos = content; *pos && error == SUCCESS; macro_line++) {
+		error = add_line_origin(source_line, stored_name, macro_line);
+		pos = strchr(pos, '\n');
+		if (!pos) {
+			break;
+		}
+		pos++;
+	}
+	return error;
+}
+
+ErrorCode get_line_origin(int line_number, int *source_line, char **macro, int *macro_line) {
+	macro_state_t *state = get_state();
+
+	if (line_number < 1 || line_number > state->n_line_origins) {
+		return ERR_INTERNAL_ASSERT;
+	}
+	*source_line = state->line_origins[line_number - 1].source_line;
+	*macro = state->line_origins[line_number - 1].macro;
+	*macro_line = state->line_origins[line_number - 1].macro_line;
+	return SUCCESS;
+}
+
 void purge_macros() {
-    macro_t *current = macro_list;
-	/* Free the macro table*/
-    while (current) {
-        macro_t *next = current->next;
-        free(current->name);
-        free(current->content);
-        free(current);
-        current = next;
-    }
-    macro_list = NULL;
+	purge_state(get_state());
 }
@@ -13,12 +13,20 @@ Processes macros in the given source file and writes the expanded output to the
 */
 int macro_process(char *filename, FILE *source, FILE *destination);
 
+/**
+Checks that a name is a valid macro name.
+   @param name: The name to check.
+   @return SUCCESS if the name is valid, error otherwise.
+*/
+ErrorCode check_macro_name(char *name);
+
 /**
 Adds a new macro definition with the given name.
    @param name: The name of the macro to be added.
+   @param line_number: The source line of the macro definition.
    @return SUCCESS if added successfully, error otherwise.
 */
-ErrorCode add_macro(char *name);
+ErrorCode add_macro(char *name, int line_number);
 
 /**
 Adds content to an existing macro.
@@ -44,8 +52,62 @@ Retrieves the content of a macro by name.
 ErrorCode get_macro(char *name, char **content);
 
 /**
-Frees all allocated memory for macros and clears the macro table.
+Enables recording the origins of the lines of the expanded file, for get_line_origin.
+Origins are not recorded by default, so memory does not grow with the size of the file;
+purging the macros disables them again.
+   @param enabled: Nonzero to record the line origins.
+*/
+void set_line_origins(int enabled);
+
+/**
+Retrieves the source origin of a line of the expanded file.
+   @param line_number: The line number in the expanded file.
+   @param source_line: Pointer to store the line number in the source file.
+   @param macro: Pointer to store the name of the macro the line was expanded from, or NULL.
+   @param macro_line: Pointer to store the line number in the macro definition, 0 if not expanded.
+   @return SUCCESS if the line exists, error otherwise.
+*/
+ErrorCode get_line_origin(int line_number, int *source_line, char **macro, int *macro_line);
+
+/**
+Checks if a name is declared as external by the libraries included by the file.
+   @param name: The symbol name.
+   @return 1 if the name is an external symbol of an included library, 0 otherwise.
+*/
+int is_included_extern(char *name);
+
+/**
+Writes the files of the libraries included by the file, the library sources and the library files.
+   @param file: The file pointer to write to.
+   @param format: The format of each file name, with a single %s.
+*/
+void dump_included_libraries(FILE *file, const char *format);
+
+/**
+Frees all allocated memory for macros and clears the macro table, the line origins and the included libraries.
 */
 void purge_macros();
 
+/* The macro tables of an expanded file, see detach_macros */
+typedef struct macro_state_t macro_state_t;
+
+/**
+Gives the calling thread macro tables of its own, so it can expand a file while other threads
+use the tables of other files. Other threads share a single set of tables.
+   @return SUCCESS if successful, error otherwise.
+*/
+ErrorCode use_thread_macros();
+
+/**
+Takes the macro tables of the calling thread, which is left with empty tables.
+   @return The tables, or NULL if out of memory.
+*/
+macro_state_t *detach_macros();
+
+/**
+Replaces the macro tables of the calling thread with tables taken by detach_macros.
+   @param state: The tables, owned by the calling thread from now on.
+*/
+void attach_macros(macro_state_t *state);
+
 #endif /* MACRO_H */
@@ -1,15 +1,15 @@
 #include <stdio.h>
 #include <stdlib.h>
-
-#ifndef _WIN32
-	#include <unistd.h>
-#endif
+#include <string.h>
 
 #include "error_codes.h"
-#include "utils.h"
-#include "macro.h"
-#include "process.h"
-#include "symbols.h"
+#include "build.h"
+#include "jobs.h"
+#include "output.h"
+#include "parallel.h"
+#include "runner.h"
+#include "server.h"
+#include "watch.h"
 
 /**
  * This program compiles an assembler file into machine code.
@@ -24,22 +24,154 @@
  *    Performed in the function second_process.
  *    Resolves symbols and generates machine code.
  * Finally, the program outputs the machine code, as well as external and entry definitions, into files.
+ *
+ * With the -g option, a debug file (.dbg) is written along with the machine code.
+ * It maps address ranges to their source lines and macro expansions, and holds the full
+ * symbol table, including non-entry labels, for the simulator's profiler and other tools.
+ *
+ * With the -O option, a peephole optimization runs between the first and second processes,
+ * followed by a new first process to assign the new addresses (see optimize.h).
+ *
+ * With the -P option, labeled .data and .string blocks that repeat earlier data, or the end of it,
+ * share the earlier copy instead of being stored again (see set_data_pooling).
+ *
+ * With the -M option, a dependency file (.d) for make is written along with the machine code.
+ * It lists the source and library files that were read as prerequisites of the output files,
+ * and the external symbols the file uses (see write_dependencies).
+ *
+ * With the -S option, the code words are written to the object file as they are assembled, and only
+ * the latest data runs are kept in memory, for images too large to keep in memory (see set_output_streaming).
+ *
+ * With the -j option, the files are built on worker processes, up to one per processor, or up to N with -jN,
+ * largest source first, sharing the job slots of make when run by it (see jobs.h).
+ *
+ * An argument @FILE reads more arguments from FILE, separated by white space, for file lists
+ * that do not fit on a command line.
+ *
+ * With the --test option, the given programs are assembled in memory and run on the simulator instead,
+ * and their output is checked against the expected output (see runner.h).
+ *
+ * With the --watch option, the files are built, and then built again whenever their source changes
+ * (see watch.h).
+ *
+ * With the --lsp option, the program runs as a language server for editors over its standard input
+ * and output (see server.h).
  * 
  * The program consists of several modules:
+ * - Build: Runs all the phases on a file, and pipelines the phases of several files.
  * - Macro: Handles macro preprocessing.
  * - Process: Manages the main compilation logic.
  * - Assembler: Constructs the machine code for both code and data.
  * - Language: Defines instructions and syntax rules.
  * - Symbol: Manages the symbol table.
+ * - Intern: Pools the names of symbols and macros as integer ids.
+ * - Library: Compiles and maps the included macro libraries.
+ * - Output: Writes output files only when their content changes, on a background thread.
+ * - Optimize: Peephole optimization of the expanded code.
+ * - Runner: Runs test programs on the simulated machine.
+ * - Server: Language server, with incremental analysis of open documents.
+ * - Jobs: Builds files on worker processes.
+ * - Watch: Rebuilds files when they change.
  * - Utils: Provides various utility functions.
  * - Error Codes: Handles error reporting.
  */
+/* The files to build, each with the options given before it */
+typedef struct {
+	build_options_t options;        /* Options for the next files */
+	build_options_t *file_options;
+	char **files;
+	int n_files;
+	int capacity;
+	int n_jobs;                     /* Number of worker processes, 0 to build in this process */
+} arguments_t;
+
+/* Adds an option or a file to the arguments */
+static void add_argument(arguments_t *arguments, char *argument) {
+	/* Options apply to the files that follow them */
+	if (strcmp(argument, "-g") == 0) {
+		arguments->options.debug = 1;
+		return;
+	}
+	if (strcmp(argument, "-O") == 0) {
+		arguments->options.optimize = 1;
+		return;
+	}
+	if (strcmp(argument, "-P") == 0) {
+		arguments->options.pool_data = 1;
+		return;
+	}
+	if (strcmp(argument, "-M") == 0) {
+		arguments->options.dependencies = 1;
+		return;
+	}
+	if (strcmp(argument, "-S") == 0) {
+		arguments->options.stream_output = 1;
+		return;
+	}
+	if (strncmp(argument, "-j", 2) == 0) {
+		arguments->n_jobs = argument[2] ? atoi(argument + 2) : get_number_of_workers();
+		if (arguments->n_jobs < 1) {
+			printf("Invalid number of jobs: %s.\n", argument);
+			exit(1);
+		}
+		return;
+	}
+
+	if (arguments->n_files == arguments->capacity) {
+		arguments->capacity *= 2;
+		arguments->files = (char **)realloc(arguments->files, arguments->capacity * sizeof(char *));
+		arguments->file_options = (build_options_t *)realloc(arguments->file_options, arguments->capacity * sizeof(build_options_t));
+		if (!arguments->files || !arguments->file_options) {
+			is_error(ERR_OUT_OF_MEMORY, NULL, argument, 0, NULL);
+			exit(1);
+		}
+	}
+	arguments->files[arguments->n_files] = argument;
+	arguments->file_options[arguments->n_files] = arguments->options;
+	arguments->n_files++;
+}
+
+/**
+Adds the arguments listed in a response file.
+The arguments point into the returned content, which must be freed after them.
+*/
+static char *read_response_file(arguments_t *arguments, char *filename) {
+	FILE *file;
+	char *content;
+	char *argument;
+	long length;
+
+	file = fopen(filename, "rb");
+	if (!file) {
+		is_error(ERR_FILE_NOT_EXIST, NULL, filename, 0, NULL);
+		exit(1);
+	}
+	fseek(file, 0, SEEK_END);
+	length = ftell(file);
+	rewind(file);
+	content = (char *)malloc(length + 1);
+	if (!content) {
+		is_error(ERR_OUT_OF_MEMORY, NULL, filename, 0, NULL);
+		exit(1);
+	}
+	length = (long)fread(content, 1, length, file);
+	content[length] = '\0';
+	fclose(file);
+
+	for (argument = strtok(content, " \t\r\n"); argument; argument = strtok(NULL, " \t\r\n")) {
+		add_argument(arguments, argument);
+	}
+	return content;
+}
+
 int main(int argc, char **argv)
 {
-    FILE *source, *destination;
-	char source_filename[MAX_FILE_NAME];
-	char destination_filename[MAX_FILE_NAME];
-    int error = SUCCESS;
+	build_options_t options = { 0, 0, 0, 0, 0 };
+	arguments_t arguments;
+	char **response_files;
+	int n_response_files = 0;
+	int watch = 0;
+	int error_state = 0;
     int i;
 
 	/* Check if at least one input file is provided */
@@ -49,104 +181,65 @@ int main(int argc, char **argv)
         exit(1);
     }
 
-	/* Iterate over all input files */
-    for (i = 1; i < argc; i++)
-	{
-		/* Open source file */
-		if (is_filename_too_long(argv[i])) {
-			is_error(ERR_FILE_NAME_TOO_LONG, NULL, argv[i], 0, NULL);
-			continue;
-		}
-		get_filename(argv[i], "as", source_filename);
-		printf("Building file %s...\n", source_filename);
-		source = fopen(source_filename, "r");
-		if (!source) {
-			is_error(ERR_FILE_NOT_EXIST, NULL, source_filename, 0, NULL);
-			continue;
-		}
+	/* Test runner mode */
+	if (strcmp(argv[1], "--test") == 0) {
+		return runner_process(argv + 2, argc - 2);
+	}
 
-		/* Create file for processed macros */
-		get_filename(argv[i], "am", destination_filename);
-		destination = fopen(destination_filename, "w+");
-		if (!destination) {
-			is_error(ERR_FILE_CANNOT_CREATE, NULL, destination_filename, 0, NULL);
-			continue;
-		}
+	/* Language server mode */
+	if (strcmp(argv[1], "--lsp") == 0) {
+		return server_process(stdin, stdout);
+	}
 
-		/* Process macros and write the results */
-		printf("Processing macros...\n");
-		error = macro_process(source_filename, source, destination);
-		fclose (source);
-		fclose(destination);
-		
-		/* Error during macro processing: delete .am file and continue to next file */
-		if (error) {
-			unlink(destination_filename);
-			purge_macros();
-			continue;
-		}
+	/* Watch mode, for the files that follow */
+	if (strcmp(argv[1], "--watch") == 0) {
+		watch = 1;
+	}
 
-		/* First process: resolve symbols */
-		get_filename(argv[i], "am", source_filename);
-		source = fopen(source_filename, "r");
-		if (!source) {
-			is_error(ERR_FILE_NOT_EXIST, NULL, source_filename, 0, NULL);
-			purge_macros();
-			continue;
-		}
-		
-		printf("Resolving symbols...\n");
-		/* Error during first process: continue to next file */
-		error = first_process(source_filename, source);
-		if (error) {
-			fclose (source);
-			purge_macros();
-			purge_symbols();
-			continue;
-		}
+	arguments.options = options;
+	arguments.n_files = 0;
+	arguments.capacity = argc;
+	arguments.n_jobs = 0;
+	arguments.files = (char **)malloc(argc * sizeof(char *));
+	arguments.file_options = (build_options_t *)malloc(argc * sizeof(build_options_t));
+	response_files = (char **)malloc(argc * sizeof(char *));
+	if (!arguments.files || !arguments.file_options || !response_files) {
+		is_error(ERR_OUT_OF_MEMORY, NULL, argv[0], 0, NULL);
+		exit(1);
+	}
 
-		/* Second process of the same file - seek to start */
-		fseek (source, 0, SEEK_SET);
-		printf("Assembling...\n");
-		error = second_process(source_filename, source);
-		/* Error during second process: do not create output files */
-		if (error) {
-			fclose (source);
-			purge_macros();
-			purge_symbols();
+	/* Collect all input files, with the arguments of response files in their place */
+    for (i = 1 + watch; i < argc; i++)
+	{
+		if (argv[i][0] == '@') {
+			response_files[n_response_files++] = read_response_file(&arguments, argv[i] + 1);
 			continue;
 		}
+		add_argument(&arguments, argv[i]);
+	}
 
-		fclose (source);
-		
-		/* Dump all files */
-		printf("Generating output files...\n");
-		get_filename(argv[i], "ob", destination_filename);
-		destination = fopen(destination_filename, "w+");
-		purge_and_dump_assembly(destination);
-		fclose(destination);
-
-		/* If external symbols exist, generate an extern file */
-		if (has_extern()) {
-			get_filename(argv[i], "ext", destination_filename);
-			destination = fopen(destination_filename, "w+");
-			dump_extern(destination);
-			fclose(destination);
-		}
-
-		/* If entry symbols exist, generate an entry file */
-		if (has_entry()) {
-			get_filename(argv[i], "ent", destination_filename);
-			destination = fopen(destination_filename, "w+");
-			dump_entry(destination);
-			fclose(destination);
-		}
+	if (watch) {
+		error_state = watch_process(arguments.files, arguments.file_options, arguments.n_files);
+	}
+	else if (arguments.n_jobs > 0) {
+		/* Each file is built by its own process, largest first */
+		error_state = jobs_process(arguments.files, arguments.file_options, arguments.n_files, arguments.n_jobs);
+	}
+	else {
+		/* Build each file, an error in a file does not stop the next ones */
+		error_state = build_files(arguments.files, arguments.file_options, arguments.n_files);
+	}
 
-		/* Clean up stored macros and symbols before moving to the next file */
-		purge_macros();
-		purge_symbols();
-		printf("Done file.\n");
+	/* Outputs with the same content as before are not written again */
+	if (!watch && get_unchanged_outputs() > 0) {
+		printf("Kept %d unchanged output files.\n", get_unchanged_outputs());
 	}
 
-    return 0;
+	for (i = 0; i < n_response_files; i++) {
+		free(response_files[i]);
+	}
+	free(response_files);
+	free(arguments.files);
+	free(arguments.file_options);
+    return error_state;
 }
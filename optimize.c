@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "language.h"
+#include "assemble.h"
+#include "process.h"
+#include "symbols.h"
+#include "optimize.h"
+
+#define MAX_JUMP_CHAIN 16
+
+/* A line of the optimized file */
+typedef struct {
+	char *text;
+	char *label;                  /* Label of the line, NULL if none */
+	char *name;                   /* Instruction name, NULL if not an instruction */
+	char *operands[MAX_OPERANDS];
+	int n_operands;
+	int address;
+	int length;                   /* Number of code words */
+	int target;                   /* Line of a jump target, -1 if unknown */
+	int removed;
+	int rewritten;
+} peephole_line_t;
+
+/* Parses a line into its label, instruction and operands */
+static void parse_line(peephole_line_t *line) {
+	char word[LINE_LEN];
+	char *rest_of_line = line->text;
+	instruction_t *instruction;
+	int n_words;
+	int i;
+
+	line->target = -1;
+	if (line->text[0] == ';' || is_whitespaces(line->text)) {
+		return;
+	}
+
+	get_word(rest_of_line, word, &rest_of_line, LAST_WORD_DONT_CARE);
+	if (is_label(word)) {
+		word[strlen(word) - 1] = '\0';
+		line->label = my_strdup(word);
+		get_word(rest_of_line, word, &rest_of_line, LAST_WORD_DONT_CARE);
+	}
+	if (get_instruction(word, &instruction) != SUCCESS ||
+		get_instruction_length(word, rest_of_line, &n_words) != SUCCESS
+	) {
+		return;
+	}
+
+	/* The line is already checked by the first process */
+	line->name = instruction->name;
+	line->length = 1 + n_words;
+	line->n_operands = instruction->number_of_operands;
+	for (i = 0; i < line->n_operands; i++) {
+		get_word(rest_of_line, word, &rest_of_line, LAST_WORD_DONT_CARE);
+		line->operands[i] = my_strdup(word);
+		if (i < line->n_operands - 1) {
+			get_comma(rest_of_line, &rest_of_line);
+		}
+	}
+}
+
+/* Checks if a line is a live instruction with the given name */
+static int is_instruction_line(peephole_line_t *line, char *name) {
+	return !line->removed && line->name && (!name || strcmp(line->name, name) == 0);
+}
+
+/* Checks if a line is a jump with a target operand */
+static int is_jump_line(peephole_line_t *line) {
+	return is_instruction_line(line, "jmp") || is_instruction_line(line, "bne") || is_instruction_line(line, "jsr");
+}
+
+/* Checks if an instruction line has no effect */
+static int is_no_operation(peephole_line_t *line) {
+	if (is_instruction_line(line, "mov")) {
+		return strcmp(line->operands[0], line->operands[1]) == 0;
+	}
+	if (is_instruction_line(line, "add") || is_instruction_line(line, "sub")) {
+		int value;
+		return line->operands[0][0] == '#' && get_number(line->operands[0] + 1, &value) == SUCCESS && value == 0;
+	}
+	return 0;
+}
+
+/* Finds the line of the instruction at a code address, -1 if there is none.
+   Instruction lines are given in address order. */
+static int find_address(peephole_line_t *lines, int *instruction_lines, int n_instructions, int address) {
+	int low = 0;
+	int high = n_instructions - 1;
+	while (low <= high) {
+		int middle = (low + high) / 2;
+		int line = instruction_lines[middle];
+		if (lines[line].address == address) {
+			return line;
+		}
+		if (lines[line].address < address) {
+			low = middle + 1;
+		}
+		else {
+			high = middle - 1;
+		}
+	}
+	return -1;
+}
+
+/* Finds the next live instruction line after a line, -1 if there is none */
+static int next_instruction(peephole_line_t *lines, int n_lines, int i) {
+	for (i++; i < n_lines; i++) {
+		if (is_instruction_line(&lines[i], NULL)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* Checks if an instruction line can be removed: it has no effect, or jumps to the next instruction.
+   Lines with a label may be jumped to, and are kept. */
+static int is_removable(peephole_line_t *lines, int n_lines, int i) {
+	peephole_line_t *line = &lines[i];
+
+	if (line->label || !is_instruction_line(line, NULL)) {
+		return 0;
+	}
+	return is_no_operation(line) ||
+		((is_instruction_line(line, "jmp") || is_instruction_line(line, "bne")) &&
+			line->target >= 0 && line->target == next_instruction(lines, n_lines, i));
+}
+
+/* Resolves the target lines of all jumps, by the symbols of the first process */
+static ErrorCode resolve_targets(peephole_line_t *lines, int n_lines) {
+	int *instruction_lines;
+	int n_instructions = 0;
+	int ic = IC_BASE;
+	int address;
+	storage_t storage;
+	int i;
+
+	instruction_lines = (int *)malloc((n_lines + 1) * sizeof(int));
+	if (!instruction_lines) {
+		return ERR_OUT_OF_MEMORY;
+	}
+
+	/* Assign addresses as the first process does */
+	for (i = 0; i < n_lines; i++) {
+		if (lines[i].name) {
+			lines[i].address = ic;
+			ic += lines[i].length;
+			instruction_lines[n_instructions++] = i;
+		}
+	}
+
+	for (i = 0; i < n_lines; i++) {
+		char *operand;
+		if (!is_jump_line(&lines[i])) {
+			continue;
+		}
+		operand = lines[i].operands[0];
+		if (*operand == '&') {
+			operand++;
+		}
+		if (get_symbol(operand, &address, &storage) == SUCCESS && storage == CODE) {
+			lines[i].target = find_address(lines, instruction_lines, n_instructions, address);
+		}
+	}
+
+	free(instruction_lines);
+	return SUCCESS;
+}
+
+/* Follows a chain of jumps from a jump line.
+   Returns the last jmp line on the chain, -1 if there is none or the chain loops. */
+static int follow_jumps(peephole_line_t *lines, int i, int *skipped_words) {
+	int target = lines[i].target;
+	int last = -1;
+	int hops;
+
+	*skipped_words = 0;
+	for (hops = 0; hops < MAX_JUMP_CHAIN; hops++) {
+		/* The chain ends at anything but a jmp to a known target */
+		if (target < 0 || !is_instruction_line(&lines[target], "jmp") || lines[target].target < 0) {
+			return last;
+		}
+		last = target;
+		*skipped_words += lines[target].length;
+		target = lines[target].target;
+	}
+	return -1;
+}
+
+/* Rewrites the jump operand of a line to the given label */
+static void set_jump_target(peephole_line_t *line, peephole_line_t *target_line) {
+	char operand[LINE_LEN];
+	char *target = target_line->operands[0];
+
+	/* Keep the addressing method of the redirected jump */
+	if (*target == '&') {
+		target++;
+	}
+	sprintf(operand, "%s%s", line->operands[0][0] == '&' ? "&" : "", target);
+	free(line->operands[0]);
+	line->operands[0] = my_strdup(operand);
+	line->target = target_line->target;
+	line->rewritten = 1;
+}
+
+/* Writes a line, as it is or rebuilt from its parts */
+static void write_line(FILE *destination, peephole_line_t *line) {
+	int i;
+
+	if (line->removed) {
+		fputs("\n", destination);
+		return;
+	}
+	if (!line->rewritten) {
+		fputs(line->text, destination);
+		return;
+	}
+
+	if (line->label) {
+		fprintf(destination, "%s: ", line->label);
+	}
+	else {
+		fputs("\t", destination);
+	}
+	fputs(line->name, destination);
+	for (i = 0; i < line->n_operands; i++) {
+		fprintf(destination, "%s%s", i == 0 ? " " : ", ", line->operands[i]);
+	}
+	fputs("\n", destination);
+}
+
+int optimize_process(char *filename, FILE *source, FILE *destination, int *words_saved, int *cycles_saved) {
+	peephole_line_t *lines = NULL;
+	char text[LINE_LEN];
+	ErrorCode error = SUCCESS;
+	int n_lines = 0;
+	int capacity = 0;
+	int changed = 1;
+	int i, j;
+
+	*words_saved = 0;
+	*cycles_saved = 0;
+
+	/* Read and parse the whole file */
+	while (error == SUCCESS && fgets(text, LINE_LEN, source)) {
+		if (n_lines == capacity) {
+			peephole_line_t *grown;
+			capacity = capacity ? capacity * 2 : 256;
+			grown = (peephole_line_t *)realloc(lines, capacity * sizeof(peephole_line_t));
+			if (!grown) {
+				error = ERR_OUT_OF_MEMORY;
+				break;
+			}
+			lines = grown;
+		}
+		memset(&lines[n_lines], 0, sizeof(peephole_line_t));
+		lines[n_lines].text = my_strdup(text);
+		parse_line(&lines[n_lines]);
+		n_lines++;
+	}
+	if (error == SUCCESS) {
+		error = resolve_targets(lines, n_lines);
+	}
+
+	/* Removing an instruction may expose another pattern, repeat till there are no changes */
+	while (error == SUCCESS && changed) {
+		changed = 0;
+		for (i = 0; i < n_lines; i++) {
+			peephole_line_t *line = &lines[i];
+			int skipped_words;
+
+			/* Redirect a jump to a jmp to the final target, unless the jump can go */
+			if (is_jump_line(line) && !is_removable(lines, n_lines, i)) {
+				int last = follow_jumps(lines, i, &skipped_words);
+				if (last >= 0) {
+					set_jump_target(line, &lines[last]);
+					*cycles_saved += skipped_words;
+					changed = 1;
+				}
+			}
+
+			/* Remove instructions without an effect, and jumps to the next instruction,
+			   checked again on the redirected target */
+			if (is_removable(lines, n_lines, i)) {
+				line->removed = 1;
+				*words_saved += line->length;
+				*cycles_saved += line->length;
+				changed = 1;
+			}
+		}
+	}
+
+	/* Write the optimized file */
+	for (i = 0; i < n_lines; i++) {
+		if (error == SUCCESS) {
+			write_line(destination, &lines[i]);
+		}
+		free(lines[i].text);
+		free(lines[i].label);
+		for (j = 0; j < lines[i].n_operands; j++) {
+			free(lines[i].operands[j]);
+		}
+	}
+	free(lines);
+
+	return is_error(error, NULL, filename, 0, NULL);
+}
@@ -0,0 +1,24 @@
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include <stdio.h>
+
+/**
+Peephole optimization of an expanded source file, after its first process.
+Rewrites the following patterns:
+ - mov X, X and add/sub #0, X are removed.
+ - jmp and bne to the next instruction are removed.
+ - jmp, bne and jsr to a jmp are redirected to the final target.
+Removed lines are replaced with empty lines, so line numbers are kept.
+Lines with a label are never removed. The optimized file must be processed
+again from the first process, to assign the new addresses.
+	@param filename: The name of the file being processed.
+	@param source: A pointer to the file, after its first process.
+	@param destination: A pointer to the file where the optimized lines are written.
+	@param words_saved: A pointer to store the number of code words removed.
+	@param cycles_saved: A pointer to store the cycles saved by a single run through the code.
+	@return 0 on success, 1 on failure.
+*/
+int optimize_process(char *filename, FILE *source, FILE *destination, int *words_saved, int *cycles_saved);
+
+#endif /* OPTIMIZE_H */
@@ -0,0 +1,398 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+	#include <unistd.h>
+	#include <pthread.h>
+#endif
+
+#include "utils.h"
+#include "output.h"
+
+#define COMPARE_BLOCK 4096
+/* Number of outputs waiting for the background writer before open_output waits */
+#define MAX_PENDING_OUTPUTS 64
+
+/* An open output file */
+typedef struct output_t {
+	FILE *file;
+	char filename[MAX_FILE_NAME];
+	char temporary_filename[MAX_FILE_NAME + 32];
+	output_batch_t *batch;  /* The batch it was submitted with */
+	struct output_t *next;
+} output_t;
+
+#ifndef _WIN32
+/* The background writer, and the outputs waiting for it */
+static struct {
+	output_t *head;
+	output_t *tail;
+	int n_pending;      /* Outputs queued or being written */
+	double seconds;     /* Time spent writing */
+	int is_enabled;
+	int is_running;
+	int stop;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t done;
+} writer = { NULL, NULL, 0, 0, 0, 0, 0 };
+#endif
+
+/* Open output files */
+static output_t *outputs = NULL;
+
+/* Number of outputs kept unchanged */
+static int unchanged_outputs = 0;
+
+/* Outputs can be opened and closed by several threads */
+#ifndef _WIN32
+static pthread_mutex_t outputs_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_OUTPUTS() pthread_mutex_lock(&outputs_lock)
+#define UNLOCK_OUTPUTS() pthread_mutex_unlock(&outputs_lock)
+#else
+#define LOCK_OUTPUTS()
+#define UNLOCK_OUTPUTS()
+#endif
+
+FILE *open_output(char *filename) {
+	output_t *output = (output_t *)malloc(sizeof(output_t));
+
+	if (!output) {
+		return NULL;
+	}
+	output->next = NULL;
+	strncpy(output->filename, filename, MAX_FILE_NAME - 1);
+	output->filename[MAX_FILE_NAME - 1] = '\0';
+
+	/* The temporary file is in the same directory, so it can be renamed over the output */
+#ifndef _WIN32
+	sprintf(output->temporary_filename, "%s.%ld.tmp", output->filename, (long)getpid());
+#else
+	sprintf(output->temporary_filename, "%s.tmp", output->filename);
+#endif
+	output->file = fopen(output->temporary_filename, "w+");
+	if (!output->file) {
+		free(output);
+		return NULL;
+	}
+	setvbuf(output->file, NULL, _IOFBF, IO_BUFFER_SIZE);
+	LOCK_OUTPUTS();
+	output->next = outputs;
+	outputs = output;
+	UNLOCK_OUTPUTS();
+	return output->file;
+}
+
+/* Removes an output from the open outputs */
+static output_t *take_output(FILE *file) {
+	output_t **link;
+	output_t *output = NULL;
+
+	LOCK_OUTPUTS();
+	for (link = &outputs; *link; link = &(*link)->next) {
+		if ((*link)->file == file) {
+			output = *link;
+			*link = output->next;
+			break;
+		}
+	}
+	UNLOCK_OUTPUTS();
+	return output;
+}
+
+void add_unchanged_outputs(int count) {
+	LOCK_OUTPUTS();
+	unchanged_outputs += count;
+	UNLOCK_OUTPUTS();
+}
+
+/* Checks if the new content of an output is the same as the existing file */
+static int is_unchanged(output_t *output) {
+	char new_block[COMPARE_BLOCK];
+	char old_block[COMPARE_BLOCK];
+	FILE *existing;
+	long size;
+	size_t n;
+	int is_same = 0;
+
+	existing = fopen(output->filename, "rb");
+	if (!existing) {
+		return 0;
+	}
+
+	/* Files of different sizes are different, without reading them */
+	fseek(output->file, 0, SEEK_END);
+	size = ftell(output->file);
+	fseek(existing, 0, SEEK_END);
+	if (ftell(existing) == size) {
+		rewind(output->file);
+		rewind(existing);
+		do {
+			n = fread(new_block, 1, COMPARE_BLOCK, output->file);
+			is_same = fread(old_block, 1, COMPARE_BLOCK, existing) == n && memcmp(new_block, old_block, n) == 0;
+		} while (is_same && n == COMPARE_BLOCK);
+	}
+	fclose(existing);
+	return is_same;
+}
+
+/* Replaces the existing file with the new content of an output, if it changed, and closes the output */
+static ErrorCode finish_output(output_t *output, int *is_kept) {
+	ErrorCode error = SUCCESS;
+
+	*is_kept = 0;
+	if (fflush(output->file) != 0 || ferror(output->file)) {
+		error = ERR_FILE_CANNOT_CREATE;
+	}
+	else if (is_unchanged(output)) {
+		*is_kept = 1;
+		fclose(output->file);
+		output->file = NULL;
+		remove(output->temporary_filename);
+	}
+
+	if (output->file) {
+		if (fclose(output->file) != 0) {
+			error = ERR_FILE_CANNOT_CREATE;
+		}
+#ifdef _WIN32
+		if (error == SUCCESS) {
+			remove(output->filename);
+		}
+#endif
+		if (error != SUCCESS || rename(output->temporary_filename, output->filename) != 0) {
+			remove(output->temporary_filename);
+			error = ERR_FILE_CANNOT_CREATE;
+		}
+	}
+	return error;
+}
+
+/* Writes a submitted output, and keeps the error writing it in its batch */
+static void write_output(output_t *output) {
+	ErrorCode error;
+	int is_kept;
+
+	error = finish_output(output, &is_kept);
+	add_unchanged_outputs(is_kept);
+	if (error != SUCCESS && output->batch->error == SUCCESS) {
+		output->batch->error = error;
+		strcpy(output->batch->filename, output->filename);
+	}
+	free(output);
+}
+
+void init_batch(output_batch_t *batch) {
+	batch->n_pending = 0;
+	batch->error = SUCCESS;
+	batch->filename[0] = '\0';
+}
+
+ErrorCode close_output(FILE *file) {
+	output_t *output = take_output(file);
+	ErrorCode error;
+	int is_kept;
+
+	if (!output) {
+		return ERR_INTERNAL_ASSERT;
+	}
+	error = finish_output(output, &is_kept);
+	add_unchanged_outputs(is_kept);
+	free(output);
+	return error;
+}
+
+#ifndef _WIN32
+
+/* Background writer body: finish the queued outputs in order */
+static void *run_writer(void *argument) {
+	output_t *output;
+	output_batch_t *batch;
+	double start;
+
+	while (1) {
+		pthread_mutex_lock(&writer.lock);
+		while (!writer.head && !writer.stop) {
+			pthread_cond_wait(&writer.wake, &writer.lock);
+		}
+		if (!writer.head) {
+			pthread_mutex_unlock(&writer.lock);
+			return NULL;
+		}
+		output = writer.head;
+		writer.head = output->next;
+		if (!writer.head) {
+			writer.tail = NULL;
+		}
+		pthread_mutex_unlock(&writer.lock);
+
+		start = get_seconds();
+		batch = output->batch;
+		write_output(output);
+
+		pthread_mutex_lock(&writer.lock);
+		writer.seconds += get_seconds() - start;
+		batch->n_pending--;
+		writer.n_pending--;
+		pthread_cond_broadcast(&writer.done);
+		pthread_mutex_unlock(&writer.lock);
+	}
+}
+
+/* Starts the background writer on first use */
+static int start_writer() {
+	if (!writer.is_running) {
+		writer.stop = 0;
+		pthread_mutex_init(&writer.lock, NULL);
+		pthread_cond_init(&writer.wake, NULL);
+		pthread_cond_init(&writer.done, NULL);
+		writer.is_running = pthread_create(&writer.thread, NULL, run_writer, NULL) == 0;
+		if (!writer.is_running) {
+			pthread_mutex_destroy(&writer.lock);
+			pthread_cond_destroy(&writer.wake);
+			pthread_cond_destroy(&writer.done);
+		}
+	}
+	return writer.is_running;
+}
+
+ErrorCode submit_output(FILE *file, output_batch_t *batch) {
+	output_t *output = take_output(file);
+
+	if (!output) {
+		return ERR_INTERNAL_ASSERT;
+	}
+	output->batch = batch;
+	if (!writer.is_enabled || !start_writer()) {
+		write_output(output);
+		return SUCCESS;
+	}
+
+	/* Memory and open files stay bounded, the build waits for the writer when it is behind */
+	pthread_mutex_lock(&writer.lock);
+	while (writer.n_pending >= MAX_PENDING_OUTPUTS) {
+		pthread_cond_wait(&writer.done, &writer.lock);
+	}
+	output->next = NULL;
+	if (writer.tail) {
+		writer.tail->next = output;
+	}
+	else {
+		writer.head = output;
+	}
+	writer.tail = output;
+	batch->n_pending++;
+	writer.n_pending++;
+	pthread_cond_signal(&writer.wake);
+	pthread_mutex_unlock(&writer.lock);
+	return SUCCESS;
+}
+
+void flush_outputs() {
+	if (!writer.is_running) {
+		return;
+	}
+	pthread_mutex_lock(&writer.lock);
+	while (writer.n_pending > 0) {
+		pthread_cond_wait(&writer.done, &writer.lock);
+	}
+	pthread_mutex_unlock(&writer.lock);
+}
+
+int is_batch_written(output_batch_t *batch) {
+	int is_written;
+
+	if (!writer.is_running) {
+		return 1;
+	}
+	pthread_mutex_lock(&writer.lock);
+	is_written = batch->n_pending == 0;
+	pthread_mutex_unlock(&writer.lock);
+	return is_written;
+}
+
+void wait_batch(output_batch_t *batch) {
+	if (!writer.is_running) {
+		return;
+	}
+	pthread_mutex_lock(&writer.lock);
+	while (batch->n_pending > 0) {
+		pthread_cond_wait(&writer.done, &writer.lock);
+	}
+	pthread_mutex_unlock(&writer.lock);
+}
+
+void set_background_output(int enabled) {
+	if (!enabled && writer.is_running) {
+		pthread_mutex_lock(&writer.lock);
+		writer.stop = 1;
+		pthread_cond_signal(&writer.wake);
+		pthread_mutex_unlock(&writer.lock);
+		pthread_join(writer.thread, NULL);
+		pthread_mutex_destroy(&writer.lock);
+		pthread_cond_destroy(&writer.wake);
+		pthread_cond_destroy(&writer.done);
+		writer.is_running = 0;
+	}
+	writer.is_enabled = enabled;
+}
+
+double get_writer_seconds() {
+	return writer.seconds;
+}
+
+#else /* _WIN32 */
+
+/* No background writer: outputs are written when they are submitted */
+ErrorCode submit_output(FILE *file, output_batch_t *batch) {
+	output_t *output = take_output(file);
+
+	if (!output) {
+		return ERR_INTERNAL_ASSERT;
+	}
+	output->batch = batch;
+	write_output(output);
+	return SUCCESS;
+}
+
+int is_batch_written(output_batch_t *batch) {
+	return 1;
+}
+
+void wait_batch(output_batch_t *batch) {
+}
+
+void flush_outputs() {
+}
+
+void set_background_output(int enabled) {
+}
+
+double get_writer_seconds() {
+	return 0;
+}
+
+#endif /* _WIN32 */
+
+void discard_output(FILE *file) {
+	output_t *output = take_output(file);
+
+	if (output) {
+		fclose(output->file);
+		remove(output->temporary_filename);
+		free(output);
+	}
+}
+
+int get_unchanged_outputs() {
+	int count;
+
+	LOCK_OUTPUTS();
+	count = unchanged_outputs;
+	UNLOCK_OUTPUTS();
+	return count;
+}
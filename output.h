@@ -0,0 +1,99 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdio.h>
+#include "error_codes.h"
+#include "utils.h"
+
+#define IO_BUFFER_SIZE 65536 /* Size of file buffers, most sources are read and written in one call */
+
+/**
+Opens an output file for writing.
+The content is written to a temporary file next to the output file, and replaces the output
+file on close only if it is different, so unchanged outputs keep their modification time
+and do not trigger the build steps that depend on them.
+	@param filename: The output file name.
+	@return: A file pointer to write the content to, or NULL if the file cannot be created.
+*/
+FILE *open_output(char *filename);
+
+/**
+Closes an output file, and replaces the existing file if the new content is different.
+	@param file: A file pointer returned by open_output.
+	@return: SUCCESS if the output was written or kept, error otherwise.
+*/
+ErrorCode close_output(FILE *file);
+
+/* Outputs submitted together, such as the outputs of a source file */
+typedef struct {
+	int n_pending;                  /* Outputs submitted and not written yet */
+	ErrorCode error;                /* The first error writing an output, or SUCCESS */
+	char filename[MAX_FILE_NAME];   /* The output that could not be written */
+} output_batch_t;
+
+/**
+Starts an empty batch of outputs.
+	@param batch: The batch to start.
+*/
+void init_batch(output_batch_t *batch);
+
+/**
+Closes an output file, and replaces the existing file if the new content is different,
+on the background writer if it is enabled (see set_background_output).
+An error writing the output is kept in the batch, to be reported once the batch is written.
+	@param file: A file pointer returned by open_output.
+	@param batch: The batch the output belongs to.
+	@return: SUCCESS if the output was queued or written, error otherwise.
+*/
+ErrorCode submit_output(FILE *file, output_batch_t *batch);
+
+/**
+Checks if all the outputs of a batch were written, without waiting.
+	@param batch: A batch of submitted outputs.
+	@return: Nonzero if the batch was written.
+*/
+int is_batch_written(output_batch_t *batch);
+
+/**
+Waits until the background writer has written all the outputs of a batch.
+	@param batch: A batch of submitted outputs.
+*/
+void wait_batch(output_batch_t *batch);
+
+/**
+Waits until the background writer has written all the submitted outputs.
+*/
+void flush_outputs();
+
+/**
+Enables or disables the background writer.
+When disabled, submitted outputs are written at once. Disabling waits for the pending outputs.
+	@param enabled: Nonzero to write submitted outputs on a background thread.
+*/
+void set_background_output(int enabled);
+
+/**
+Returns the time the background writer spent writing outputs.
+	@return: The time in seconds.
+*/
+double get_writer_seconds();
+
+/**
+Closes an output file and drops its content. The existing file, if any, is left as is.
+	@param file: A file pointer returned by open_output.
+*/
+void discard_output(FILE *file);
+
+/**
+Returns the number of outputs that were kept because their content did not change.
+	@return: The number of unchanged outputs since the program started, submitted outputs are counted once written.
+*/
+int get_unchanged_outputs();
+
+/**
+Adds outputs that were kept by another process, such as a worker of jobs_process.
+	@param count: The number of unchanged outputs to add.
+*/
+void add_unchanged_outputs(int count);
+
+#endif /* OUTPUT_H */
@@ -0,0 +1,99 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+
+#ifndef _WIN32
+	#include <unistd.h>
+	#include <pthread.h>
+#endif
+
+#include "parallel.h"
+
+#define MAX_WORKERS 64
+
+/* Shared state of a running parallel loop */
+typedef struct {
+	int n;
+	int next_index;
+	parallel_task_t task;
+	void *context;
+#ifndef _WIN32
+	pthread_mutex_t lock;
+#endif
+} parallel_loop_t;
+
+int get_number_of_workers() {
+#if !defined(_WIN32) && defined(_SC_NPROCESSORS_ONLN)
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n < 1) {
+		return 1;
+	}
+	return n > MAX_WORKERS ? MAX_WORKERS : (int)n;
+#else
+	return 1;
+#endif
+}
+
+/* Takes the next free index of the loop, or -1 when all are taken */
+static int next_index(parallel_loop_t *loop) {
+	int index;
+#ifndef _WIN32
+	pthread_mutex_lock(&loop->lock);
+#endif
+	index = loop->next_index < loop->n ? loop->next_index++ : -1;
+#ifndef _WIN32
+	pthread_mutex_unlock(&loop->lock);
+#endif
+	return index;
+}
+
+/* Worker body: run tasks until the loop is exhausted */
+static void *run_worker(void *argument) {
+	parallel_loop_t *loop = (parallel_loop_t *)argument;
+	int index;
+	while ((index = next_index(loop)) >= 0) {
+		loop->task(loop->context, index);
+	}
+	return NULL;
+}
+
+void parallel_for(int n, parallel_task_t task, void *context) {
+	parallel_loop_t loop;
+	int n_workers = get_number_of_workers();
+
+	loop.n = n;
+	loop.next_index = 0;
+	loop.task = task;
+	loop.context = context;
+
+	if (n_workers > n) {
+		n_workers = n;
+	}
+
+#ifndef _WIN32
+	pthread_mutex_init(&loop.lock, NULL);
+	if (n_workers > 1) {
+		pthread_t workers[MAX_WORKERS];
+		int n_started = 0;
+		int i;
+
+		/* The calling thread is a worker too */
+		for (i = 1; i < n_workers; i++) {
+			if (pthread_create(&workers[n_started], NULL, run_worker, &loop) == 0) {
+				n_started++;
+			}
+		}
+		run_worker(&loop);
+		for (i = 0; i < n_started; i++) {
+			pthread_join(workers[i], NULL);
+		}
+	}
+	else {
+		run_worker(&loop);
+	}
+	pthread_mutex_destroy(&loop.lock);
+#else
+	/* No worker threads: run the loop on the calling thread */
+	run_worker(&loop);
+#endif
+}
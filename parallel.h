@@ -0,0 +1,23 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+/* A task executed for a single index of a parallel loop */
+typedef void (*parallel_task_t)(void *context, int index);
+
+/**
+Returns the number of worker threads used for parallel loops.
+	@return: The number of online processors, at least 1.
+*/
+int get_number_of_workers();
+
+/**
+Runs a task for every index in [0, n) on a pool of worker threads.
+Indices are handed out dynamically, so tasks of different cost balance out.
+The call returns after all the tasks are done.
+	@param n: The number of indices.
+	@param task: The task to run for each index.
+	@param context: A pointer passed as is to every task call.
+*/
+void parallel_for(int n, parallel_task_t task, void *context);
+
+#endif /* PARALLEL_H */
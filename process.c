@@ -2,17 +2,65 @@
 #include "process.h"
 #include "utils.h"
 #include "symbols.h"
+#include "macro.h"
+#include "lexer.h"
 
 #define DETAILS_LEN 20
 
+static ErrorCode count_operands(instruction_t *instruction, token_line_t *tokens, int *n_operands);
+static ErrorCode assemble_instruction(
+	instruction_t *instruction,
+	token_line_t *tokens,
+	assembly_t *assembly,
+	assembly_t *operands,
+	int *n_operands,
+	char *error_context
+);
+
+/* Checks if a token is the given directive */
+static int is_directive(token_t *token, directive_t directive) {
+	return token->type == TOKEN_DIRECTIVE && token->value == directive;
+}
+
+/* Adds the words of a data directive, and moves its label if the block is shared with an earlier copy */
+static ErrorCode add_data_block_of_label(char *label, int *values, int n_values, char *shared_label) {
+	int dc = get_DC();
+	int address;
+	ErrorCode error;
+
+	error = add_data_block(values, n_values, *label != '\0', &address);
+	if (error != SUCCESS || address == dc) {
+		return error;
+	}
+	strcpy(shared_label, label);
+	return set_symbol_address(label, address);
+}
+
+/* A data directive without a label continues the previous block, so a shared block is stored in place */
+static ErrorCode continue_data_block(char *shared_label) {
+	int address;
+	ErrorCode error;
+
+	error = unshare_data_block(&address);
+	if (error != SUCCESS || address < 0) {
+		return error;
+	}
+	return set_symbol_address(shared_label, address);
+}
+
 int first_process(char *filename, FILE *file)
 {
 	int line_number = 0;
 	char line[LINE_LEN];
 	char word[LINE_LEN];
 	char label[LINE_LEN];
+	char shared_label[LINE_LEN];
+	int values[LINE_LEN];
+	int n_values;
 	int value;
-	char *rest_of_line;
+	token_line_t tokens;
+	token_t token;
+	instruction_t *instruction;
 	assembly_t assembly;
 	int i; /* loop index */
 
@@ -26,32 +74,38 @@ int first_process(char *filename, FILE *file)
 	while(fgets(line, LINE_LEN, file))
 	{
 		line_number++;
+		set_line_number(line_number);
 		label[0] = '\0';
 		
 		/* Ensure null termination */
 		line[LINE_LEN-1] = '\0';
-		rest_of_line = line;
 
-        /* Skip empty lines and comments */
-		if (line[0] == ';' || is_whitespaces(line)) {
+        /* Skip comments */
+		if (line[0] == ';') {
+			continue;
+		}
+
+		/* Split the line into tokens, and skip empty lines */
+		tokenize_line(line, &tokens);
+		if (!has_more_tokens(&tokens)) {
 			continue;
 		}
 
 		/* Extract the first word in the line */
-		error = get_word(rest_of_line, word, &rest_of_line, LAST_WORD_DONT_CARE);
+		error = next_token(&tokens, word, &token, LAST_WORD_DONT_CARE);
 		if (is_error(error, &error_state, filename, line_number, NULL)) {
 			continue;
 		}
 
 		/* If the first word is a label, store it and extract the next word */
-		if (is_label(word)) {
+		if (token.type == TOKEN_LABEL) {
 			strcpy(label, word);
 			label[strlen(label) - 1] = '\0'; /* Remove colon */
-			error = get_word(rest_of_line, word, &rest_of_line, LAST_WORD_DONT_CARE);
+			error = next_token(&tokens, word, &token, LAST_WORD_DONT_CARE);
 			if (is_error(error, &error_state, filename, line_number, NULL)) {
 				continue;
 			}
-			if (strlen(word) == 0) {
+			if (token.type == TOKEN_NONE) {
 				is_error(ERR_SYMBOL_ILLEGAL, &error_state, filename, line_number, NULL);
 				continue;
 			}
@@ -60,17 +114,21 @@ int first_process(char *filename, FILE *file)
 		/* Process different types of assembler directives and instructions */
 
 		/* Handle .data directive */
-		if (is_data(word)) {
+		if (is_directive(&token, DIRECTIVE_DATA)) {
 			if (*label) {
 				error = add_symbol(label, get_DC(), DATA, 0);
 				if (is_error(error, &error_state, filename, line_number, NULL)) {
 					continue;
 				}
 			}
+			else if (is_error(continue_data_block(shared_label), &error_state, filename, line_number, NULL)) {
+				return error_state;
+			}
 
-			/* Parse and store numeric values */
+			/* Parse and collect numeric values */
+			n_values = 0;
 			do {
-				error = get_word(rest_of_line, word, &rest_of_line, LAST_WORD_DONT_CARE);
+				error = next_token(&tokens, word, &token, LAST_WORD_DONT_CARE);
 				if (is_error(error, &error_state, filename, line_number, NULL)) {
 					continue;
 				}
@@ -81,58 +139,120 @@ int first_process(char *filename, FILE *file)
 				}
 
 				assembly.data.value = value;
-				error = add_data(assembly);
-				if (is_error(error, &error_state, filename, line_number, NULL)) {
-					/* Out of memory or RAM exceeded - do not coninue this file*/
-					return error_state;
-				}
+				values[n_values++] = assembly.data.value;
 	
-				if (rest_of_line && !is_whitespaces(rest_of_line)) {
-					error = get_comma(rest_of_line, &rest_of_line);
+				if (has_more_tokens(&tokens)) {
+					error = next_comma(&tokens);
 				}
-			} while (*rest_of_line && error == SUCCESS);
+			} while (has_more_tokens(&tokens) && error == SUCCESS);
 
+			error = add_data_block_of_label(label, values, n_values, shared_label);
+			if (is_error(error, &error_state, filename, line_number, NULL)) {
+				/* Out of memory or RAM exceeded - do not coninue this file*/
+				return error_state;
+			}
 		}
 		/* Handle .string directive */
-		else if (is_string(word)) {
+		else if (is_directive(&token, DIRECTIVE_STRING)) {
 			if (*label) {
 				error = add_symbol(label, get_DC(), DATA, 0);
 				if (is_error(error, &error_state, filename, line_number, NULL)) {
 					continue;
 				}
 			}
+			else if (is_error(continue_data_block(shared_label), &error_state, filename, line_number, NULL)) {
+				return error_state;
+			}
 
 			/* Extract string content */
-			error = get_word(rest_of_line, word, &rest_of_line, LAST_WORD);
+			error = next_token(&tokens, word, &token, LAST_WORD);
 			if (is_error(error, &error_state, filename, line_number, NULL)) {
 				continue;
 			}
 			/* Validate string format */
-			if (strlen(word) < 2 || word[0] != '"' || word[strlen(word) - 1] != '"') {
+			if (token.type != TOKEN_STRING) {
 				is_error(ERR_STRING_ILLEGAL, &error_state, filename, line_number, NULL);
 				continue;
 			}
-			/* Store characters in memory */
-			for (i = 1; i < strlen(word) - 1; i++) {
+			/* Collect characters, with zero termination */
+			n_values = 0;
+			for (i = 1; i < token.length - 1; i++) {
 				assembly.data.value = word[i];
-				error = add_data(assembly);
+				values[n_values++] = assembly.data.value;
+			}
+			values[n_values++] = 0;
+
+			error = add_data_block_of_label(label, values, n_values, shared_label);
+			if (is_error(error, &error_state, filename, line_number, NULL)) {
+				/* Out of memory or RAM exceeded - do not coninue this file*/
+				return error_state;
+			}
+		}
+		/* Handle .fill and .space directives */
+		else if (is_directive(&token, DIRECTIVE_FILL) || is_directive(&token, DIRECTIVE_SPACE)) {
+			int count;
+			int has_value = is_directive(&token, DIRECTIVE_FILL); /* .space is zero filled */
+
+			if (*label) {
+				error = add_symbol(label, get_DC(), DATA, 0);
 				if (is_error(error, &error_state, filename, line_number, NULL)) {
-					/* Out of memory or RAM exceeded - do not coninue this file*/
-					return error_state;
+					continue;
+				}
+			}
+			else if (is_error(continue_data_block(shared_label), &error_state, filename, line_number, NULL)) {
+				return error_state;
+			}
+
+			/* Extract the number of words */
+			error = next_token(&tokens, word, &token, !has_value);
+			if (is_error(error, &error_state, filename, line_number, NULL)) {
+				continue;
+			}
+			if (token.type == TOKEN_NONE) {
+				is_error(ERR_OPERAND_MISSING, &error_state, filename, line_number, NULL);
+				continue;
+			}
+			error = get_number(word, &count);
+			if (is_error(error, &error_state, filename, line_number, NULL)) {
+				continue;
+			}
+			if (count <= 0) {
+				is_error(ERR_NUMBER_OUT_OF_RANGE, &error_state, filename, line_number, NULL);
+				continue;
+			}
+
+			/* Extract the repeated value */
+			value = 0;
+			if (has_value) {
+				error = next_comma(&tokens);
+				if (is_error(error, &error_state, filename, line_number, NULL)) {
+					continue;
+				}
+				error = next_token(&tokens, word, &token, LAST_WORD);
+				if (is_error(error, &error_state, filename, line_number, NULL)) {
+					continue;
+				}
+				if (token.type == TOKEN_NONE) {
+					is_error(ERR_OPERAND_MISSING, &error_state, filename, line_number, NULL);
+					continue;
+				}
+				error = get_number(word, &value);
+				if (is_error(error, &error_state, filename, line_number, NULL)) {
+					continue;
 				}
 			}
 
-			/* Add zero termination */
-			assembly.data.value = 0;
-			error = add_data(assembly);
+			/* Store the block as a single run */
+			assembly.data.value = value;
+			error = add_data_run(assembly, count);
 			if (is_error(error, &error_state, filename, line_number, NULL)) {
 				/* Out of memory or RAM exceeded - do not coninue this file*/
 				return error_state;
 			}
 		}
 		/* Handle .extern directive */
-		else if (is_extern(word)) {
-			error = get_word(rest_of_line, word, &rest_of_line, LAST_WORD);
+		else if (is_directive(&token, DIRECTIVE_EXTERN)) {
+			error = next_token(&tokens, word, &token, LAST_WORD);
 			if (is_error(error, &error_state, filename, line_number, NULL)) {
 				continue;
 			}
@@ -143,11 +263,11 @@ int first_process(char *filename, FILE *file)
 			}
 		}
 		/* Entry is processed on second scan */
-		else if (is_entry(word)) {
+		else if (is_directive(&token, DIRECTIVE_ENTRY)) {
 			continue;
 		}
 		/* Handle an assembly instruction */
-		else if (is_instruction(word)) {
+		else if (token.type == TOKEN_MNEMONIC && get_instruction_by_index(token.value, &instruction) == SUCCESS) {
 			int n_operands;
 
 			if (*label) {
@@ -157,7 +277,7 @@ int first_process(char *filename, FILE *file)
 				}
 			}
 
-			error = get_instruction_length(word, rest_of_line, &n_operands);
+			error = count_operands(instruction, &tokens, &n_operands);
 			if (is_error(error, &error_state, filename, line_number, NULL)) {
 				continue;
 			}
@@ -185,7 +305,9 @@ int second_process(char *filename, FILE *file)
 	int line_number = 0;
 	char line[LINE_LEN];
 	char word[LINE_LEN];
-	char *rest_of_line;
+	token_line_t tokens;
+	token_t token;
+	instruction_t *instruction;
 	assembly_t assembly;
 	int i;
 
@@ -199,36 +321,44 @@ int second_process(char *filename, FILE *file)
 	while(fgets(line, LINE_LEN, file))
 	{
 		line_number++;
+		set_line_number(line_number);
 		
 		/* Ensure null termination */
 		line[LINE_LEN-1] = '\0';
-		rest_of_line = line;
 
-		/* Skip empty lines and comments */
-		if (line[0] == ';' || is_whitespaces(line)) {
+		/* Skip comments */
+		if (line[0] == ';') {
+			continue;
+		}
+
+		/* Split the line into tokens, and skip empty lines */
+		tokenize_line(line, &tokens);
+		if (!has_more_tokens(&tokens)) {
 			continue;
 		}
 
 		/* Extract the first word in the line */
-		error = get_word(rest_of_line, word, &rest_of_line, LAST_WORD_DONT_CARE);
+		error = next_token(&tokens, word, &token, LAST_WORD_DONT_CARE);
 		if (is_error(error, &error_state, filename, line_number, NULL)) {
 			continue;
 		}
 
 		/* Labels are already processed on first scan */
-		if (is_label(word)) {
+		if (token.type == TOKEN_LABEL) {
 			/* Skip to next word */
-			get_word(rest_of_line, word, &rest_of_line, LAST_WORD_DONT_CARE);
+			next_token(&tokens, word, &token, LAST_WORD_DONT_CARE);
 		}
 
-		/* Data, string & extern are already processed on first scan */
-		if (is_data(word) || is_string(word) || is_extern(word)) {
+		/* Data, string, fill, space & extern are already processed on first scan */
+		if (is_directive(&token, DIRECTIVE_DATA) || is_directive(&token, DIRECTIVE_STRING) ||
+			is_directive(&token, DIRECTIVE_FILL) || is_directive(&token, DIRECTIVE_SPACE) ||
+			is_directive(&token, DIRECTIVE_EXTERN)) {
 			continue;
 		}
 
 		/* Process .entry directive */
-		else if (is_entry(word)) {
-			error = get_word(rest_of_line, word, &rest_of_line, LAST_WORD);
+		else if (is_directive(&token, DIRECTIVE_ENTRY)) {
+			error = next_token(&tokens, word, &token, LAST_WORD);
 			if (is_error(error, &error_state, filename, line_number, NULL)) {
 				continue;
 			}
@@ -240,13 +370,13 @@ int second_process(char *filename, FILE *file)
 		}
 
 		/* Process an instruction */
-		else if (is_instruction(word)) {
+		else if (token.type == TOKEN_MNEMONIC && get_instruction_by_index(token.value, &instruction) == SUCCESS) {
 			char error_context[DETAILS_LEN];
 			assembly_t operands[2];
 			int n_operands;
 
 			/* Parse the instruction and extract operands */
-			error = process_instruction(word, rest_of_line, &assembly, operands, &n_operands, error_context);
+			error = assemble_instruction(instruction, &tokens, &assembly, operands, &n_operands, error_context);
 			if (is_error(error, &error_state, filename, line_number, error_context)) {
 				continue;
 			}
@@ -275,43 +405,33 @@ int second_process(char *filename, FILE *file)
 	return error_state;
 }
 
-ErrorCode get_instruction_length(char *name, char *rest_of_line, int *n_operands) {
+/* Counts the operand words of an instruction from the tokens of its operands */
+static ErrorCode count_operands(instruction_t *instruction, token_line_t *tokens, int *n_operands) {
 	ErrorCode error;
-	instruction_t *instruction;
 	char word[LINE_LEN];
+	token_t token;
 	int i;
 
-	/* Ensure the operand counter pointer is valid */
-	if (!n_operands) {
-		return ERR_INTERNAL_ASSERT;
-	}
-
-	/* Retrieve the instruction details */
-	error = get_instruction(name, &instruction);
-	if (error != SUCCESS) {
-		return error;
-	}
-
 	*n_operands = 0;
 	
 	/* Count operands */
 	for (i = 0; i < instruction->number_of_operands; i++) {
-		error = get_word(rest_of_line, word, &rest_of_line, i == instruction->number_of_operands - 1);
+		error = next_token(tokens, word, &token, i == instruction->number_of_operands - 1);
 		if (error != SUCCESS) {
 			return error;
 		}
-		if (strlen(word) == 0) {
+		if (token.type == TOKEN_NONE) {
 			return ERR_OPERAND_MISSING;
 		}
 
 		/* Registers are not counted as operands */
-		if (!is_register(word, NULL)) {
+		if (token.type != TOKEN_REGISTER) {
 			(*n_operands)++;
 		}
 
 		/* Ensure correct operand separation */
 		if (i < instruction->number_of_operands - 1) {
-			error = get_comma(rest_of_line, &rest_of_line);
+			error = next_comma(tokens);
 			if (error != SUCCESS) {
 				return error;
 			}
@@ -321,34 +441,43 @@ ErrorCode get_instruction_length(char *name, char *rest_of_line, int *n_operands
 	return SUCCESS;
 }
 
-ErrorCode process_instruction(
-	char *name, 
-	char *rest_of_line, 
+ErrorCode get_instruction_length(char *name, char *rest_of_line, int *n_operands) {
+	ErrorCode error;
+	instruction_t *instruction;
+	token_line_t tokens;
+
+	/* Ensure the operand counter pointer is valid */
+	if (!n_operands) {
+		return ERR_INTERNAL_ASSERT;
+	}
+
+	/* Retrieve the instruction details */
+	error = get_instruction(name, &instruction);
+	if (error != SUCCESS) {
+		return error;
+	}
+
+	tokenize_line(rest_of_line, &tokens);
+	return count_operands(instruction, &tokens, n_operands);
+}
+
+/* Encodes an instruction and its operands from the tokens of its operands */
+static ErrorCode assemble_instruction(
+	instruction_t *instruction,
+	token_line_t *tokens,
 	assembly_t *assembly,
 	assembly_t *operands, 
 	int *n_operands,
 	char *error_context
 ) {
 	ErrorCode error;
-	instruction_t *instruction;
 	char word[LINE_LEN];
+	token_t token;
 	int value;
 	coding_t are;
 	addressing_t addressing;
-	int reg;
 	int i;
 
-	/* Ensure valid pointers */
-	if (!assembly || !operands || !n_operands) {
-		return ERR_INTERNAL_ASSERT;
-	}
-
-	/* Retrieve instruction details */
-	error = get_instruction(name, &instruction);
-	if (error != SUCCESS) {
-		return error;
-	}
-
 	/* Initialize assembly structure */
 	assembly->data.value = 0;
 	*n_operands = 0;
@@ -365,21 +494,21 @@ ErrorCode process_instruction(
 		}
 
 		/* Extract operand */
-		error = get_word(rest_of_line, word, &rest_of_line, instruction->number_of_operands == 1);
+		error = next_token(tokens, word, &token, instruction->number_of_operands == 1);
 		if (error != SUCCESS) {
 			return error;
 		}
-		if (strlen(word) == 0) {
+		if (token.type == TOKEN_NONE) {
 			return ERR_OPERAND_MISSING;
 		}
 
 		/* Handle register operands */
-		if (is_register(word, &reg)) {
+		if (token.type == TOKEN_REGISTER) {
             /* Ensure register addressing is allowed for this operand */
 			if (!is_valid_addressing(REG, instruction->allowed_addressing[i])) {
 				return ERR_INSTRUCTION_ADDRESSING_NOT_ALLOWED;
 			}
-			set_reg(assembly, reg, i, instruction->number_of_operands);
+			set_reg(assembly, token.value, i, instruction->number_of_operands);
 		}
 		/* Handle non-register operands */
 		else {
@@ -390,7 +519,10 @@ ErrorCode process_instruction(
 
 			/* If it is an external referece, store the address for later resolution */
 			if (are == CODING_E) {
-				add_external_symbol_references(word, get_IC() + i + 1);
+				error = add_external_symbol_references(word, get_IC() + i + 1);
+				if (error != SUCCESS) {
+					return error;
+				}
 			}
 
 			operands[*n_operands].operand.ARE = are;
@@ -402,7 +534,7 @@ ErrorCode process_instruction(
 
 		 /* Ensure correct operand separation */
 		if (i < instruction->number_of_operands - 1) {
-			error = get_comma(rest_of_line, &rest_of_line);
+			error = next_comma(tokens);
 			if (error != SUCCESS) {
 				return error;
 			}
@@ -412,6 +544,33 @@ ErrorCode process_instruction(
 	return SUCCESS;
 }
 
+ErrorCode process_instruction(
+	char *name, 
+	char *rest_of_line, 
+	assembly_t *assembly,
+	assembly_t *operands, 
+	int *n_operands,
+	char *error_context
+) {
+	ErrorCode error;
+	instruction_t *instruction;
+	token_line_t tokens;
+
+	/* Ensure valid pointers */
+	if (!assembly || !operands || !n_operands) {
+		return ERR_INTERNAL_ASSERT;
+	}
+
+	/* Retrieve instruction details */
+	error = get_instruction(name, &instruction);
+	if (error != SUCCESS) {
+		return error;
+	}
+
+	tokenize_line(rest_of_line, &tokens);
+	return assemble_instruction(instruction, &tokens, assembly, operands, n_operands, error_context);
+}
+
 ErrorCode process_operand(
 	char *operand, 
 	int i_operand, 
@@ -449,6 +608,15 @@ ErrorCode process_operand(
 	/* Direct addressing */
 	else {
 		error = get_symbol(operand, value, &storage);
+
+		/* Externs of included libraries are declared on their first use */
+		if (error != SUCCESS && is_included_extern(operand)) {
+			error = add_symbol(operand, 0, EXTERN, 0);
+			if (error != SUCCESS) {
+				return error;
+			}
+			error = get_symbol(operand, value, &storage);
+		}
 		if (error != SUCCESS) {
 			return ERR_SYMBOL_UNDEFINED;
 		}
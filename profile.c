@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "profile.h"
+
+#define REPORT_LINES 10
+
+/* A code label and the instructions executed under it */
+typedef struct {
+	char *name;
+	int address;
+	long count;
+} profile_label_t;
+
+/* A range of addresses of a source line, and the instructions executed in it */
+typedef struct {
+	int address;
+	int length;
+	int source_line;
+	char *macro;
+	int macro_line;
+	long count;
+} profile_line_t;
+
+/* An instruction address and its executions */
+typedef struct {
+	int address;
+	long count;
+} profile_address_t;
+
+static int compare_label_address(const void *a, const void *b) {
+	return ((profile_label_t *)a)->address - ((profile_label_t *)b)->address;
+}
+
+static int compare_label_count(const void *a, const void *b) {
+	long difference = ((profile_label_t *)b)->count - ((profile_label_t *)a)->count;
+	return difference > 0 ? 1 : difference < 0 ? -1 : 0;
+}
+
+static int compare_line_count(const void *a, const void *b) {
+	long difference = ((profile_line_t *)b)->count - ((profile_line_t *)a)->count;
+	return difference > 0 ? 1 : difference < 0 ? -1 : 0;
+}
+
+static int compare_address_count(const void *a, const void *b) {
+	long difference = ((profile_address_t *)b)->count - ((profile_address_t *)a)->count;
+	return difference > 0 ? 1 : difference < 0 ? -1 : 0;
+}
+
+/* Reads the code labels and the code line ranges of a debug file, sorted by address */
+static void load_debug(
+	FILE *debug,
+	char *filename,
+	profile_label_t **labels,
+	int *n_labels,
+	profile_line_t **lines,
+	int *n_lines
+) {
+	char line[LINE_LEN];
+	char name[LINE_LEN];
+	char storage[LINE_LEN];
+	int address, length, source_line, macro_line;
+	int labels_capacity = 0;
+	int lines_capacity = 0;
+	int n_fields;
+
+	*labels = NULL;
+	*lines = NULL;
+	*n_labels = 0;
+	*n_lines = 0;
+	strcpy(filename, "line");
+
+	while (debug && fgets(line, LINE_LEN, debug)) {
+		/* Source file record */
+		if (sscanf(line, "file %s", name) == 1) {
+			strcpy(filename, name);
+		}
+		/* Code label record */
+		else if (sscanf(line, "symbol %s %d %s", name, &address, storage) == 3) {
+			if (strcmp(storage, "code") != 0) {
+				continue;
+			}
+			if (*n_labels == labels_capacity) {
+				profile_label_t *grown;
+				labels_capacity = labels_capacity ? labels_capacity * 2 : 64;
+				grown = (profile_label_t *)realloc(*labels, labels_capacity * sizeof(profile_label_t));
+				if (!grown) {
+					break;
+				}
+				*labels = grown;
+			}
+			(*labels)[*n_labels].name = my_strdup(name);
+			(*labels)[*n_labels].address = address;
+			(*labels)[*n_labels].count = 0;
+			(*n_labels)++;
+		}
+		/* Line range record, with an optional macro origin */
+		else if ((n_fields = sscanf(line, "lines %d %d %d %s %d", &address, &length, &source_line, name, &macro_line)) >= 3) {
+			if (*n_lines == lines_capacity) {
+				profile_line_t *grown;
+				lines_capacity = lines_capacity ? lines_capacity * 2 : 256;
+				grown = (profile_line_t *)realloc(*lines, lines_capacity * sizeof(profile_line_t));
+				if (!grown) {
+					break;
+				}
+				*lines = grown;
+			}
+			(*lines)[*n_lines].address = address;
+			(*lines)[*n_lines].length = length;
+			(*lines)[*n_lines].source_line = source_line;
+			(*lines)[*n_lines].macro = n_fields == 5 ? my_strdup(name) : NULL;
+			(*lines)[*n_lines].macro_line = n_fields == 5 ? macro_line : 0;
+			(*lines)[*n_lines].count = 0;
+			(*n_lines)++;
+		}
+	}
+
+	qsort(*labels, *n_labels, sizeof(profile_label_t), compare_label_address);
+}
+
+/* Finds the line range holding an address, -1 if there is none.
+   Code ranges are written in address order. */
+static int find_line(profile_line_t *lines, int n_lines, int address) {
+	int low = 0;
+	int high = n_lines - 1;
+	while (low <= high) {
+		int middle = (low + high) / 2;
+		if (address < lines[middle].address) {
+			high = middle - 1;
+		}
+		else if (address >= lines[middle].address + lines[middle].length) {
+			low = middle + 1;
+		}
+		else {
+			return middle;
+		}
+	}
+	return -1;
+}
+
+/* Finds the last label at or before an address, -1 if there is none */
+static int find_label(profile_label_t *labels, int n_labels, int address) {
+	int low = 0;
+	int high = n_labels - 1;
+	int found = -1;
+	while (low <= high) {
+		int middle = (low + high) / 2;
+		if (labels[middle].address <= address) {
+			found = middle;
+			low = middle + 1;
+		}
+		else {
+			high = middle - 1;
+		}
+	}
+	return found;
+}
+
+/* Formats an address as label+offset */
+static void format_location(char *location, profile_label_t *labels, int n_labels, int address) {
+	int label = find_label(labels, n_labels, address);
+	if (label < 0) {
+		sprintf(location, "%07d", address);
+	}
+	else if (labels[label].address == address) {
+		sprintf(location, "%s", labels[label].name);
+	}
+	else {
+		sprintf(location, "%s+%d", labels[label].name, address - labels[label].address);
+	}
+}
+
+void print_profile(machine_t *machine, FILE *debug, FILE *file) {
+	profile_label_t *labels;
+	profile_line_t *lines;
+	profile_address_t *addresses;
+	char location[3 * LINE_LEN];
+	char filename[LINE_LEN];
+	int n_labels, n_lines, n_addresses = 0;
+	long unlabeled = 0;
+	double total = machine->instructions ? (double)machine->instructions : 1;
+	int address;
+	int i;
+
+	if (!machine->profile) {
+		return;
+	}
+
+	load_debug(debug, filename, &labels, &n_labels, &lines, &n_lines);
+	/* Without memory for the addresses, only labels and lines are reported */
+	addresses = (profile_address_t *)malloc(machine->code_end * sizeof(profile_address_t));
+
+	/* Sum the executions under each label and line, and collect the executed addresses */
+	for (address = IC_BASE; address < machine->code_end; address++) {
+		long count = machine->profile[address];
+		if (count == 0) {
+			continue;
+		}
+		i = find_label(labels, n_labels, address);
+		if (i >= 0) {
+			labels[i].count += count;
+		}
+		else {
+			unlabeled += count;
+		}
+		i = find_line(lines, n_lines, address);
+		if (i >= 0) {
+			lines[i].count += count;
+		}
+		if (addresses) {
+			addresses[n_addresses].address = address;
+			addresses[n_addresses].count = count;
+			n_addresses++;
+		}
+	}
+
+	fprintf(file, "Profile of %ld instructions\n", machine->instructions);
+
+	/* Hottest labels */
+	if (n_labels > 0) {
+		qsort(labels, n_labels, sizeof(profile_label_t), compare_label_count);
+		fprintf(file, "%14s %8s  %s\n", "instructions", "share", "label");
+		for (i = 0; i < n_labels && i < REPORT_LINES && labels[i].count > 0; i++) {
+			fprintf(file, "%14ld %7.2f%%  %s\n", labels[i].count, labels[i].count * 100 / total, labels[i].name);
+		}
+		if (unlabeled > 0) {
+			fprintf(file, "%14ld %7.2f%%  %s\n", unlabeled, unlabeled * 100 / total, "(no label)");
+		}
+		qsort(labels, n_labels, sizeof(profile_label_t), compare_label_address);
+	}
+
+	/* Hottest source lines */
+	if (n_lines > 0) {
+		qsort(lines, n_lines, sizeof(profile_line_t), compare_line_count);
+		fprintf(file, "%14s %8s  %s\n", "instructions", "share", "source line");
+		for (i = 0; i < n_lines && i < REPORT_LINES && lines[i].count > 0; i++) {
+			if (lines[i].macro) {
+				sprintf(location, "%s:%d (macro %s line %d)", filename, lines[i].source_line, lines[i].macro, lines[i].macro_line);
+			}
+			else {
+				sprintf(location, "%s:%d", filename, lines[i].source_line);
+			}
+			fprintf(file, "%14ld %7.2f%%  %s\n", lines[i].count, lines[i].count * 100 / total, location);
+		}
+	}
+
+	/* Hottest instructions */
+	qsort(addresses, n_addresses, sizeof(profile_address_t), compare_address_count);
+	fprintf(file, "%14s %8s  %-7s  %s\n", "instructions", "share", "address", "location");
+	for (i = 0; i < n_addresses && i < REPORT_LINES; i++) {
+		format_location(location, labels, n_labels, addresses[i].address);
+		fprintf(file, "%14ld %7.2f%%  %07d  %s\n",
+			addresses[i].count, addresses[i].count * 100 / total, addresses[i].address, location);
+	}
+
+	for (i = 0; i < n_labels; i++) {
+		free(labels[i].name);
+	}
+	for (i = 0; i < n_lines; i++) {
+		free(lines[i].macro);
+	}
+	free(labels);
+	free(lines);
+	free(addresses);
+}
@@ -0,0 +1,17 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include "machine.h"
+
+/**
+Prints a report of where a profiled program spent its instructions.
+Code labels are ranked by the instructions executed from them up to the next label,
+followed by the hottest source lines and the hottest instruction addresses.
+	@param machine: The machine after the run, with profiling started.
+	@param debug: The opened debug file (.dbg) of the program, or NULL when there are no labels.
+	@param file: The file to write the report to.
+*/
+void print_profile(machine_t *machine, FILE *debug, FILE *file);
+
+#endif /* PROFILE_H */
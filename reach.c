@@ -0,0 +1,211 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "language.h"
+#include "reach.h"
+
+/* A decoded instruction of the image */
+typedef struct {
+	int length;
+	int n_operands;             /* Operands held in their own word */
+	int targets[MAX_OPERANDS];  /* Word index referenced by each operand word, or -1 */
+	int relational[MAX_OPERANDS];
+	int falls_through;          /* Zero for jmp, rts and stop */
+} decoded_t;
+
+/* Decodes the instruction at a word index of the code */
+static ErrorCode decode(assembly_t *image, int code_size, int n_words, int index, decoded_t *decoded) {
+	assembly_t word = image[index];
+	instruction_t *instruction;
+	int modes[MAX_OPERANDS];
+	int n, i;
+
+	if (word.instruction.ARE != CODING_A ||
+		get_instruction_by_code(word.instruction.opcode, word.instruction.funct, &instruction) != SUCCESS
+	) {
+		return ERR_OBJECT_ILLEGAL;
+	}
+
+	/* With a single operand, it is the destination */
+	n = instruction->number_of_operands;
+	modes[0] = n == 2 ? word.instruction.src_addr : word.instruction.dst_addr;
+	modes[1] = word.instruction.dst_addr;
+
+	decoded->length = 1;
+	decoded->n_operands = 0;
+	for (i = 0; i < n; i++) {
+		assembly_t operand;
+		int target = -1;
+
+		/* Registers are encoded in the instruction word */
+		if (modes[i] == REG) {
+			continue;
+		}
+		if (index + decoded->length >= code_size) {
+			return ERR_OBJECT_ILLEGAL;
+		}
+		operand = image[index + decoded->length];
+		decoded->length++;
+
+		if (modes[i] == RELATIONAL) {
+			target = index + operand.operand.value;
+		}
+		else if (operand.operand.ARE == CODING_R) {
+			target = operand.operand.value - IC_BASE;
+		}
+		decoded->targets[decoded->n_operands] = (target >= 0 && target < n_words) ? target : -1;
+		decoded->relational[decoded->n_operands] = (modes[i] == RELATIONAL);
+		decoded->n_operands++;
+	}
+
+	decoded->falls_through = !(
+		(instruction->opcode == 9 && instruction->funct == 1) || /* jmp */
+		instruction->opcode == 14 ||                               /* rts */
+		instruction->opcode == 15                                  /* stop */
+	);
+	return SUCCESS;
+}
+
+ErrorCode strip_unreachable(assembly_t *image, int *code_size, int *data_size) {
+	int n_words = *code_size + *data_size;
+	char *is_instruction_start;
+	char *is_referenced;
+	int *block_of;   /* Block of each word, and later the new index of each word */
+	int *block_start;
+	char *is_live;
+	int *stack;
+	int n_blocks = 0;
+	int n_stack = 0;
+	int new_code_size = 0;
+	int new_data_size = 0;
+	decoded_t decoded;
+	ErrorCode error = SUCCESS;
+	int i, j;
+
+	if (*code_size == 0) {
+		return SUCCESS;
+	}
+
+	is_instruction_start = (char *)calloc(n_words + 1, 1);
+	is_referenced = (char *)calloc(n_words + 1, 1);
+	block_of = (int *)malloc(n_words * sizeof(int));
+	block_start = (int *)malloc((n_words + 1) * sizeof(int));
+	is_live = (char *)calloc(n_words + 1, 1);
+	stack = (int *)malloc((n_words + 1) * sizeof(int));
+	if (!is_instruction_start || !is_referenced || !block_of || !block_start || !is_live || !stack) {
+		error = ERR_OUT_OF_MEMORY;
+	}
+
+	/* Find the instructions, and the addresses referenced by them */
+	for (i = 0; i < *code_size && error == SUCCESS; i += decoded.length) {
+		error = decode(image, *code_size, n_words, i, &decoded);
+		if (error != SUCCESS) {
+			break;
+		}
+		is_instruction_start[i] = 1;
+		for (j = 0; j < decoded.n_operands; j++) {
+			if (decoded.targets[j] >= 0) {
+				is_referenced[decoded.targets[j]] = 1;
+			}
+		}
+		/* Code after jmp, rts or stop is only entered by reference */
+		if (!decoded.falls_through) {
+			is_referenced[i + decoded.length] = 1;
+		}
+	}
+
+	/* Split the image into blocks at referenced instructions and data, and after jmp, rts and stop */
+	if (error == SUCCESS) {
+		for (i = 0; i < n_words; i++) {
+			if (i == 0 || i == *code_size ||
+				(is_referenced[i] && (i > *code_size || is_instruction_start[i]))
+			) {
+				block_start[n_blocks++] = i;
+			}
+			block_of[i] = n_blocks - 1;
+		}
+		block_start[n_blocks] = n_words;
+
+		/* Mark the blocks reachable from the start of the code */
+		is_live[0] = 1;
+		stack[n_stack++] = 0;
+		while (n_stack > 0) {
+			int block = stack[--n_stack];
+
+			/* Data blocks hold no references */
+			if (block_start[block] >= *code_size) {
+				continue;
+			}
+
+			decoded.falls_through = 1;
+			for (i = block_start[block]; i < block_start[block + 1] && i < *code_size; i += decoded.length) {
+				decode(image, *code_size, n_words, i, &decoded);
+				for (j = 0; j < decoded.n_operands; j++) {
+					int target = decoded.targets[j] >= 0 ? block_of[decoded.targets[j]] : -1;
+					if (target >= 0 && !is_live[target]) {
+						is_live[target] = 1;
+						stack[n_stack++] = target;
+					}
+				}
+			}
+
+			/* The last instruction may run into the next code block */
+			if (decoded.falls_through && block_start[block + 1] < *code_size && !is_live[block + 1]) {
+				is_live[block + 1] = 1;
+				stack[n_stack++] = block + 1;
+			}
+		}
+
+		/* Assign the new index of each remaining word */
+		for (i = 0; i < n_words; i++) {
+			int live = is_live[block_of[i]];
+			block_of[i] = -1;
+			if (live) {
+				block_of[i] = i < *code_size ? new_code_size++ : *code_size + new_data_size++;
+			}
+		}
+		for (i = *code_size; i < n_words; i++) {
+			if (block_of[i] >= 0) {
+				block_of[i] -= *code_size - new_code_size;
+			}
+		}
+
+		/* Move the remaining words down, with their references.
+		   Words only move to lower indices, so the words ahead are still intact. */
+		for (i = 0; i < *code_size; i += decoded.length) {
+			decode(image, *code_size, n_words, i, &decoded);
+			if (block_of[i] < 0) {
+				continue;
+			}
+			image[block_of[i]] = image[i];
+			for (j = 0; j < decoded.n_operands; j++) {
+				assembly_t operand = image[i + 1 + j];
+				int target = decoded.targets[j];
+
+				if (target >= 0 && decoded.relational[j]) {
+					operand.operand.value = block_of[target] - block_of[i];
+				}
+				else if (target >= 0 && operand.operand.ARE == CODING_R) {
+					operand.operand.value = IC_BASE + block_of[target];
+				}
+				image[block_of[i] + 1 + j] = operand;
+			}
+		}
+		for (i = *code_size; i < n_words; i++) {
+			if (block_of[i] >= 0) {
+				image[block_of[i]] = image[i];
+			}
+		}
+
+		*code_size = new_code_size;
+		*data_size = new_data_size;
+	}
+
+	free(is_instruction_start);
+	free(is_referenced);
+	free(block_of);
+	free(block_start);
+	free(is_live);
+	free(stack);
+	return error;
+}
@@ -0,0 +1,20 @@
+#ifndef REACH_H
+#define REACH_H
+
+#include "error_codes.h"
+#include "assemble.h"
+
+/**
+Removes the code and data that cannot be reached from the start of a linked image.
+The image is split into blocks at every address referenced by an operand word, and after every jmp, rts and stop.
+A block is reachable from the first block of the code, from a reachable block that references it,
+and from the block before it, if that block does not end with jmp, rts or stop.
+Unreachable blocks are removed, and the remaining references are moved to the new addresses.
+	@param image: The code words followed by the data words. External references must already be resolved.
+	@param code_size: A pointer to the number of code words, updated to the number of remaining ones.
+	@param data_size: A pointer to the number of data words, updated to the number of remaining ones.
+	@return: ERR_OBJECT_ILLEGAL if the code cannot be decoded, error or SUCCESS otherwise.
+*/
+ErrorCode strip_unreachable(assembly_t *image, int *code_size, int *data_size);
+
+#endif /* REACH_H */
@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "error_codes.h"
+#include "utils.h"
+#include "macro.h"
+#include "process.h"
+#include "symbols.h"
+#include "machine.h"
+#include "parallel.h"
+#include "runner.h"
+
+#define BATCH_SIZE 64 /* Programs assembled before running them, bounds open files */
+#define INSTRUCTION_LIMIT 100000000L
+
+/* Result of a test program */
+typedef enum {
+	TEST_PASS,
+	TEST_FAIL,
+	TEST_ERROR
+} test_status_t;
+
+/* A test program and its result */
+typedef struct {
+	char *name;
+	FILE *object;         /* Assembled .ob image */
+	test_status_t status;
+	ErrorCode error;      /* Runtime error */
+	int error_address;
+	int difference_line;  /* First output line that differs from the expected */
+	long instructions;
+	double assemble_time;
+	double run_time;
+} test_t;
+
+/* Assembles a program into a temporary .ob image, without writing any files */
+static int assemble_test(test_t *test) {
+	char source_filename[MAX_FILE_NAME];
+	char expanded_filename[MAX_FILE_NAME];
+	FILE *source, *expanded;
+	int error;
+
+	if (is_filename_too_long(test->name)) {
+		is_error(ERR_FILE_NAME_TOO_LONG, NULL, test->name, 0, NULL);
+		return 1;
+	}
+	get_filename(test->name, "as", source_filename);
+	source = fopen(source_filename, "r");
+	if (!source) {
+		is_error(ERR_FILE_NOT_EXIST, NULL, source_filename, 0, NULL);
+		return 1;
+	}
+	expanded = tmpfile();
+	if (!expanded) {
+		fclose(source);
+		is_error(ERR_FILE_CANNOT_CREATE, NULL, source_filename, 0, NULL);
+		return 1;
+	}
+
+	/* Same phases as the assembler, on temporary files */
+	error = macro_process(source_filename, source, expanded);
+	fclose(source);
+	get_filename(test->name, "am", expanded_filename);
+	if (!error) {
+		rewind(expanded);
+		error = first_process(expanded_filename, expanded);
+	}
+	if (!error) {
+		rewind(expanded);
+		error = second_process(expanded_filename, expanded);
+	}
+	fclose(expanded);
+
+	if (!error) {
+		test->object = tmpfile();
+		if (!test->object) {
+			is_error(ERR_FILE_CANNOT_CREATE, NULL, source_filename, 0, NULL);
+			error = 1;
+		}
+	}
+	purge_and_dump_assembly(error ? NULL : test->object);
+	purge_macros();
+	purge_symbols();
+
+	if (test->object) {
+		rewind(test->object);
+	}
+	return error;
+}
+
+/* Compares the output of a program with the expected file.
+   Returns 0 if they are the same, otherwise the first line that differs. */
+static int compare_output(FILE *output, FILE *expected) {
+	int line_number = 1;
+	int c, e;
+
+	rewind(output);
+	do {
+		c = fgetc(output);
+		e = expected ? fgetc(expected) : EOF;
+		if (c != e) {
+			return line_number;
+		}
+		if (c == '\n') {
+			line_number++;
+		}
+	} while (c != EOF);
+	return 0;
+}
+
+/* Runs an assembled program and checks its output */
+static void run_test(void *context, int index) {
+	test_t *test = (test_t *)context + index;
+	char filename[MAX_FILE_NAME];
+	FILE *input, *output, *expected;
+	machine_t machine;
+	int line_number;
+	double start = get_seconds();
+
+	/* Programs that failed to assemble are not run */
+	if (!test->object) {
+		return;
+	}
+
+	get_filename(test->name, "in", filename);
+	input = fopen(filename, "r");
+	output = tmpfile();
+
+	test->error = output ? machine_init(&machine, input, output) : ERR_FILE_CANNOT_CREATE;
+	if (test->error == SUCCESS) {
+		test->error = machine_load(&machine, test->object, &line_number);
+		if (test->error == SUCCESS) {
+			test->error = machine_run(&machine, INSTRUCTION_LIMIT);
+		}
+		test->instructions = machine.instructions;
+		test->error_address = machine.pc;
+		machine_purge(&machine);
+	}
+
+	if (test->error == SUCCESS) {
+		get_filename(test->name, "out", filename);
+		expected = fopen(filename, "r");
+		test->difference_line = compare_output(output, expected);
+		test->status = test->difference_line ? TEST_FAIL : TEST_PASS;
+		if (expected) {
+			fclose(expected);
+		}
+	}
+	else {
+		test->status = TEST_ERROR;
+	}
+
+	if (input) {
+		fclose(input);
+	}
+	if (output) {
+		fclose(output);
+	}
+	test->run_time = get_seconds() - start;
+}
+
+/* Prints the result of a single program */
+static void print_result(test_t *test) {
+	char filename[MAX_FILE_NAME];
+	char error_context[LINE_LEN];
+
+	switch (test->status) {
+		case TEST_PASS:
+			printf("PASS %s", test->name);
+			break;
+		case TEST_FAIL:
+			printf("FAIL %s: output differs at line %d", test->name, test->difference_line);
+			break;
+		default:
+			get_filename(test->name, "ob", filename);
+			sprintf(error_context, "at address %07d", test->error_address);
+			print_error(test->error, filename, 0, error_context);
+			printf("FAIL %s", test->name);
+			break;
+	}
+	printf(" (assemble %.3f ms, run %.3f ms, %ld instructions)\n",
+		test->assemble_time * 1000, test->run_time * 1000, test->instructions);
+}
+
+int runner_process(char **programs, int n_programs) {
+	test_t *tests;
+	int n_passed = 0;
+	double start = get_seconds();
+	int first, last;
+	int i;
+
+	tests = (test_t *)calloc(n_programs, sizeof(test_t));
+	if (!tests) {
+		is_error(ERR_OUT_OF_MEMORY, NULL, programs[0], 0, NULL);
+		return 1;
+	}
+
+	for (first = 0; first < n_programs; first = last) {
+		last = first + BATCH_SIZE < n_programs ? first + BATCH_SIZE : n_programs;
+
+		/* The assembler phases share global tables, assemble one by one */
+		for (i = first; i < last; i++) {
+			double assemble_start = get_seconds();
+			tests[i].name = programs[i];
+			assemble_test(&tests[i]);
+			tests[i].assemble_time = get_seconds() - assemble_start;
+		}
+
+		/* Programs run on independent machines, run the batch in parallel */
+		parallel_for(last - first, run_test, tests + first);
+
+		for (i = first; i < last; i++) {
+			if (tests[i].object) {
+				fclose(tests[i].object);
+				tests[i].object = NULL;
+				print_result(&tests[i]);
+				if (tests[i].status == TEST_PASS) {
+					n_passed++;
+				}
+			}
+			else {
+				printf("FAIL %s: assembly failed\n", tests[i].name);
+			}
+		}
+	}
+
+	printf("Passed %d of %d programs in %.3f s.\n", n_passed, n_programs, get_seconds() - start);
+	free(tests);
+	return n_passed != n_programs;
+}
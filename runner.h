@@ -0,0 +1,17 @@
+#ifndef RUNNER_H
+#define RUNNER_H
+
+/**
+Assembles and runs a batch of test programs, and checks their output.
+Each program is given by its base name. It is assembled in memory from its .as file,
+and run with its optional .in file as input. The output of the program is
+compared with its .out file, a missing .out file expects no output.
+Programs are assembled one after the other, and run on a pool of worker threads.
+A pass/fail line with timings is printed for each program, followed by a summary.
+	@param programs: The base names of the programs.
+	@param n_programs: The number of programs.
+	@return 0 if all the programs passed, 1 otherwise.
+*/
+int runner_process(char **programs, int n_programs);
+
+#endif /* RUNNER_H */
@@ -0,0 +1,1099 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "utils.h"
+#include "language.h"
+#include "json.h"
+#include "server.h"
+
+#define SYMBOL_LEN 31
+#define MACRO_NAME_LEN 31
+#define SYMBOL_BUCKETS 4096
+#define HEADER_LEN 256
+
+/* Open documents --------------------------------------------- */
+
+/* How a name is used on a line */
+typedef enum {
+	NAME_LABEL,   /* Definitions */
+	NAME_EXTERN,
+	NAME_MACRO,
+	NAME_OPERAND, /* References */
+	NAME_ENTRY,
+	NAME_CALL
+} name_kind_t;
+
+#define IS_DEFINITION(kind) ((kind) <= NAME_MACRO)
+
+struct symbol_t;
+
+/* A name defined or referenced on a line */
+typedef struct {
+	struct symbol_t *symbol;
+	name_kind_t kind;
+	int column;
+	ErrorCode error; /* Error that depends on other lines */
+} name_t;
+
+/* A line of a document, with its parsed state */
+typedef struct {
+	char *text;
+	int number;        /* Index of the line, kept up to date on edits */
+	int in_macro;      /* Inside a macro definition at the start of the line */
+	int next_in_macro; /* Inside a macro definition after the line */
+	ErrorCode error;   /* Error of the line itself */
+	name_t *names;
+	int n_names;
+	int stamp;         /* Marks lines already visited by a query */
+} line_t;
+
+/* A symbol or macro name, with the lines that define and reference it */
+typedef struct symbol_t {
+	char *name;
+	line_t **definitions;
+	int n_definitions;
+	int definitions_capacity;
+	line_t **references;
+	int n_references;
+	int references_capacity;
+	int is_dirty;
+	struct symbol_t *next;       /* Next symbol in the hash bucket */
+	struct symbol_t *next_dirty; /* Next symbol to check again */
+} symbol_t;
+
+/* An open document */
+typedef struct document_t {
+	char *uri;
+	line_t **lines;
+	int n_lines;
+	int lines_capacity;
+	symbol_t *symbols[SYMBOL_BUCKETS];
+	symbol_t *dirty;
+	int stamp;
+	struct document_t *next;
+} document_t;
+
+static document_t *documents = NULL;
+
+/* Hashes a name into a symbol bucket */
+static int hash_name(const char *name, int length) {
+	unsigned long hash = 5381;
+	int i;
+	for (i = 0; i < length; i++) {
+		hash = hash * 33 + (unsigned char)name[i];
+	}
+	return (int)(hash % SYMBOL_BUCKETS);
+}
+
+/* Finds a symbol by name, and optionally creates it */
+static symbol_t *find_symbol(document_t *document, const char *name, int length, int create) {
+	int bucket = hash_name(name, length);
+	symbol_t *symbol;
+
+	for (symbol = document->symbols[bucket]; symbol; symbol = symbol->next) {
+		if ((int)strlen(symbol->name) == length && strncmp(symbol->name, name, length) == 0) {
+			return symbol;
+		}
+	}
+	if (!create) {
+		return NULL;
+	}
+
+	symbol = (symbol_t *)calloc(1, sizeof(symbol_t));
+	if (!symbol) {
+		return NULL;
+	}
+	symbol->name = (char *)malloc(length + 1);
+	if (!symbol->name) {
+		free(symbol);
+		return NULL;
+	}
+	memcpy(symbol->name, name, length);
+	symbol->name[length] = '\0';
+	symbol->next = document->symbols[bucket];
+	document->symbols[bucket] = symbol;
+	return symbol;
+}
+
+/* Queues a symbol to be checked again */
+static void mark_dirty(document_t *document, symbol_t *symbol) {
+	if (!symbol->is_dirty) {
+		symbol->is_dirty = 1;
+		symbol->next_dirty = document->dirty;
+		document->dirty = symbol;
+	}
+}
+
+/* Appends a line to a list of lines */
+static ErrorCode add_line_to(line_t ***lines, int *n_lines, int *capacity, line_t *line) {
+	if (*n_lines == *capacity) {
+		line_t **grown;
+		int new_capacity = *capacity ? *capacity * 2 : 4;
+		grown = (line_t **)realloc(*lines, new_capacity * sizeof(line_t *));
+		if (!grown) {
+			return ERR_OUT_OF_MEMORY;
+		}
+		*lines = grown;
+		*capacity = new_capacity;
+	}
+	(*lines)[(*n_lines)++] = line;
+	return SUCCESS;
+}
+
+/* Removes a single occurrence of a line from a list of lines */
+static void remove_line_from(line_t **lines, int *n_lines, line_t *line) {
+	int i;
+	for (i = 0; i < *n_lines; i++) {
+		if (lines[i] == line) {
+			lines[i] = lines[--(*n_lines)];
+			return;
+		}
+	}
+}
+
+/* Line analysis --------------------------------------------- */
+
+/* Records the first error of a line */
+static void set_line_error(line_t *line, ErrorCode error) {
+	if (line->error == SUCCESS) {
+		line->error = error;
+	}
+}
+
+/* Records a name defined or referenced on a line, and adds the line to the symbol index */
+static void add_name(document_t *document, line_t *line, const char *name, name_kind_t kind, int column) {
+	symbol_t *symbol = find_symbol(document, name, strlen(name), 1);
+	name_t *grown;
+	ErrorCode error;
+
+	if (!symbol) {
+		set_line_error(line, ERR_OUT_OF_MEMORY);
+		return;
+	}
+	grown = (name_t *)realloc(line->names, (line->n_names + 1) * sizeof(name_t));
+	if (!grown) {
+		set_line_error(line, ERR_OUT_OF_MEMORY);
+		return;
+	}
+	line->names = grown;
+
+	if (IS_DEFINITION(kind)) {
+		error = add_line_to(&symbol->definitions, &symbol->n_definitions, &symbol->definitions_capacity, line);
+	}
+	else {
+		error = add_line_to(&symbol->references, &symbol->n_references, &symbol->references_capacity, line);
+	}
+	if (error != SUCCESS) {
+		set_line_error(line, error);
+		return;
+	}
+
+	line->names[line->n_names].symbol = symbol;
+	line->names[line->n_names].kind = kind;
+	line->names[line->n_names].column = column;
+	line->names[line->n_names].error = SUCCESS;
+	line->n_names++;
+	mark_dirty(document, symbol);
+}
+
+/* Removes the parsed state of a line, and its names from the symbol index */
+static void forget_line(document_t *document, line_t *line) {
+	int i;
+
+	for (i = 0; i < line->n_names; i++) {
+		symbol_t *symbol = line->names[i].symbol;
+		if (IS_DEFINITION(line->names[i].kind)) {
+			remove_line_from(symbol->definitions, &symbol->n_definitions, line);
+		}
+		else {
+			remove_line_from(symbol->references, &symbol->n_references, line);
+		}
+		mark_dirty(document, symbol);
+	}
+	free(line->names);
+	line->names = NULL;
+	line->n_names = 0;
+	line->error = SUCCESS;
+}
+
+/* Extracts the next word as get_word does, along with its column in the line */
+static ErrorCode read_word(char *start, char **rest, char *word, int is_last, int *column) {
+	char *pos = *rest;
+
+	if (*pos != ',') {
+		while (*pos && isspace((unsigned char)*pos)) {
+			pos++;
+		}
+	}
+	*column = pos - start;
+	return get_word(*rest, word, rest, is_last);
+}
+
+/* Checks the name of a label or external symbol, as the symbol table does */
+static ErrorCode check_symbol_name(char *name) {
+	int i;
+
+	if (is_reserved_word(name)) {
+		return ERR_SYMBOL_RESERVED;
+	}
+	if (strlen(name) > SYMBOL_LEN) {
+		return ERR_SYMBOL_NAME_TOO_LONG;
+	}
+	if (!isalpha((unsigned char)name[0])) {
+		return ERR_SYMBOL_ILLEGAL_NAME;
+	}
+	for (i = 1; name[i]; i++) {
+		if (!isalpha((unsigned char)name[i]) && !isdigit((unsigned char)name[i])) {
+			return ERR_SYMBOL_ILLEGAL_NAME;
+		}
+	}
+	return SUCCESS;
+}
+
+/* Checks the name of a macro, as the macro table does */
+static ErrorCode check_macro_name(char *name) {
+	int i;
+
+	if (is_reserved_word(name)) {
+		return ERR_MACRO_RESERVED;
+	}
+	if (strlen(name) > MACRO_NAME_LEN) {
+		return ERR_MACRO_NAME_TOO_LONG;
+	}
+	for (i = 0; name[i]; i++) {
+		if (!isalpha((unsigned char)name[i]) && name[i] != '_') {
+			return ERR_MACRO_ILLEGAL_NAME;
+		}
+	}
+	return SUCCESS;
+}
+
+/* Checks the operands of an instruction, and records the symbols they reference */
+static ErrorCode analyze_operands(document_t *document, line_t *line, char *start, char *name, char *rest) {
+	instruction_t *instruction;
+	char word[LINE_LEN];
+	int column;
+	int value;
+	ErrorCode error;
+	int i;
+
+	error = get_instruction(name, &instruction);
+	if (error != SUCCESS) {
+		return error;
+	}
+
+	for (i = 0; i < instruction->number_of_operands; i++) {
+		addressing_t addressing;
+
+		error = read_word(start, &rest, word, i == instruction->number_of_operands - 1, &column);
+		if (error != SUCCESS) {
+			return error;
+		}
+		if (strlen(word) == 0) {
+			return ERR_OPERAND_MISSING;
+		}
+
+		if (is_register(word, NULL)) {
+			addressing = REG;
+		}
+		else if (word[0] == '#') {
+			error = get_number(word + 1, &value);
+			if (error != SUCCESS) {
+				return error;
+			}
+			addressing = IMMEDIATE;
+		}
+		else if (word[0] == '&') {
+			add_name(document, line, word + 1, NAME_OPERAND, column + 1);
+			addressing = RELATIONAL;
+		}
+		else {
+			add_name(document, line, word, NAME_OPERAND, column);
+			addressing = DIRECT;
+		}
+		if (!is_valid_addressing(addressing, instruction->allowed_addressing[i])) {
+			return ERR_INSTRUCTION_ADDRESSING_NOT_ALLOWED;
+		}
+
+		if (i < instruction->number_of_operands - 1) {
+			error = get_comma(rest, &rest);
+			if (error != SUCCESS) {
+				return error;
+			}
+		}
+	}
+	return SUCCESS;
+}
+
+/* Checks the values of a .data, .fill or .space directive */
+static ErrorCode analyze_values(char *word, char *rest) {
+	char value_word[LINE_LEN];
+	int value;
+	ErrorCode error;
+
+	/* .data holds a list of numbers */
+	if (is_data(word)) {
+		do {
+			error = get_word(rest, value_word, &rest, LAST_WORD_DONT_CARE);
+			if (error == SUCCESS) {
+				error = get_number(value_word, &value);
+			}
+			if (error == SUCCESS && !is_whitespaces(rest)) {
+				error = get_comma(rest, &rest);
+			}
+		} while (*rest && error == SUCCESS);
+		return error;
+	}
+
+	/* .fill and .space hold a count, and .fill a value */
+	error = get_word(rest, value_word, &rest, is_space(word));
+	if (error != SUCCESS) {
+		return error;
+	}
+	if (strlen(value_word) == 0) {
+		return ERR_OPERAND_MISSING;
+	}
+	error = get_number(value_word, &value);
+	if (error != SUCCESS) {
+		return error;
+	}
+	if (value <= 0) {
+		return ERR_NUMBER_OUT_OF_RANGE;
+	}
+	if (is_fill(word)) {
+		error = get_comma(rest, &rest);
+		if (error == SUCCESS) {
+			error = get_word(rest, value_word, &rest, LAST_WORD);
+		}
+		if (error == SUCCESS && strlen(value_word) == 0) {
+			error = ERR_OPERAND_MISSING;
+		}
+		if (error == SUCCESS) {
+			error = get_number(value_word, &value);
+		}
+	}
+	return error;
+}
+
+/* Checks a statement, a line outside of macro definitions or a line of a macro body */
+static void analyze_statement(document_t *document, line_t *line, char *start, char *word, int column, char *rest) {
+	char label[LINE_LEN];
+	int label_column = column;
+	ErrorCode error;
+
+	label[0] = '\0';
+	if (is_label(word)) {
+		strcpy(label, word);
+		label[strlen(label) - 1] = '\0';
+		error = read_word(start, &rest, word, LAST_WORD_DONT_CARE, &column);
+		if (error != SUCCESS) {
+			set_line_error(line, error);
+			return;
+		}
+		if (strlen(word) == 0) {
+			set_line_error(line, ERR_SYMBOL_ILLEGAL);
+			return;
+		}
+	}
+
+	/* .include names a library, its names are not known to the server */
+	if (is_include(word)) {
+		error = get_word(rest, word, &rest, LAST_WORD);
+		if (error == SUCCESS && (strlen(word) < 3 || word[0] != '"' || word[strlen(word) - 1] != '"')) {
+			error = ERR_STRING_ILLEGAL;
+		}
+		set_line_error(line, error);
+		return;
+	}
+
+	/* .extern and .entry name a symbol, their label is ignored */
+	if (is_extern(word) || is_entry(word)) {
+		int extern_directive = is_extern(word);
+		error = read_word(start, &rest, word, LAST_WORD, &column);
+		if (error == SUCCESS && extern_directive) {
+			error = check_symbol_name(word);
+		}
+		if (error != SUCCESS) {
+			set_line_error(line, error);
+			return;
+		}
+		add_name(document, line, word, extern_directive ? NAME_EXTERN : NAME_ENTRY, column);
+		return;
+	}
+
+	if (!is_data(word) && !is_string(word) && !is_fill(word) && !is_space(word) && !is_instruction(word)) {
+		/* A single word is a macro call */
+		if (!*label && is_whitespaces(rest)) {
+			add_name(document, line, word, NAME_CALL, column);
+		}
+		else {
+			set_line_error(line, ERR_INSTRUCTION_INVALID);
+		}
+		return;
+	}
+
+	/* Data and instructions define their label */
+	if (*label) {
+		error = check_symbol_name(label);
+		if (error != SUCCESS) {
+			set_line_error(line, error);
+			return;
+		}
+		add_name(document, line, label, NAME_LABEL, label_column);
+	}
+
+	if (is_string(word)) {
+		error = get_word(rest, word, &rest, LAST_WORD);
+		if (error == SUCCESS && (strlen(word) < 2 || word[0] != '"' || word[strlen(word) - 1] != '"')) {
+			error = ERR_STRING_ILLEGAL;
+		}
+	}
+	else if (is_instruction(word)) {
+		error = analyze_operands(document, line, start, word, rest);
+	}
+	else {
+		error = analyze_values(word, rest);
+	}
+	set_line_error(line, error);
+}
+
+/* Parses a line, given the macro definition state before it */
+static void analyze_line(document_t *document, line_t *line, int in_macro) {
+	char buffer[LINE_LEN];
+	char word[LINE_LEN];
+	char *rest = buffer;
+	int column;
+	int length = strlen(line->text);
+	ErrorCode error;
+
+	line->in_macro = in_macro;
+	line->next_in_macro = in_macro;
+
+	/* Lines are kept without their line break */
+	if (length > 0 && line->text[length - 1] == '\r') {
+		length--;
+	}
+	if (length > LINE_LEN - 2) {
+		set_line_error(line, ERR_LINE_TOO_LONG);
+		return;
+	}
+	memcpy(buffer, line->text, length);
+	buffer[length] = '\0';
+
+	if (buffer[0] == ';' || is_whitespaces(buffer)) {
+		return;
+	}
+
+	error = read_word(buffer, &rest, word, LAST_WORD_DONT_CARE, &column);
+	if (error != SUCCESS) {
+		set_line_error(line, error);
+		return;
+	}
+
+	/* Macro definitions */
+	if (in_macro && strcmp(word, "mcroend") == 0) {
+		line->next_in_macro = 0;
+		if (!is_whitespaces(rest)) {
+			set_line_error(line, ERR_TRAILING_TEXT);
+		}
+		return;
+	}
+	if (!in_macro && strcmp(word, "mcro") == 0) {
+		error = read_word(buffer, &rest, word, LAST_WORD, &column);
+		if (error == SUCCESS && strlen(word) == 0) {
+			error = ERR_MACRO_MISSING_NAME;
+		}
+		if (error == SUCCESS) {
+			error = check_macro_name(word);
+		}
+		if (error != SUCCESS) {
+			set_line_error(line, error);
+			return;
+		}
+		add_name(document, line, word, NAME_MACRO, column);
+		line->next_in_macro = 1;
+		return;
+	}
+
+	/* Macro bodies are checked as the statements they expand to */
+	analyze_statement(document, line, buffer, word, column, rest);
+}
+
+/* Checks the names of a symbol against each other, after lines that use it changed */
+static void check_symbol(symbol_t *symbol) {
+	line_t *first = NULL;
+	name_kind_t first_kind = NAME_LABEL;
+	int has_label = 0;
+	int i, j;
+
+	/* Find the first definition of the symbol */
+	for (i = 0; i < symbol->n_definitions; i++) {
+		line_t *line = symbol->definitions[i];
+		for (j = 0; j < line->n_names; j++) {
+			if (line->names[j].symbol == symbol && IS_DEFINITION(line->names[j].kind)) {
+				if (!first || line->number < first->number) {
+					first = line;
+					first_kind = line->names[j].kind;
+				}
+				if (line->names[j].kind == NAME_LABEL) {
+					has_label = 1;
+				}
+			}
+		}
+	}
+
+	/* Definitions after the first one are redefinitions */
+	for (i = 0; i < symbol->n_definitions; i++) {
+		line_t *line = symbol->definitions[i];
+		for (j = 0; j < line->n_names; j++) {
+			name_t *name = &line->names[j];
+			if (name->symbol != symbol || !IS_DEFINITION(name->kind)) {
+				continue;
+			}
+			name->error = SUCCESS;
+			if (line == first) {
+				continue;
+			}
+			if ((name->kind == NAME_MACRO) != (first_kind == NAME_MACRO)) {
+				name->error = ERR_SYMBOL_AS_MACRO;
+			}
+			else {
+				name->error = name->kind == NAME_MACRO ? ERR_MACRO_REDEFINITION : ERR_SYMBOL_REDEFINITION;
+			}
+		}
+	}
+
+	/* References must have a matching definition */
+	for (i = 0; i < symbol->n_references; i++) {
+		line_t *line = symbol->references[i];
+		for (j = 0; j < line->n_names; j++) {
+			name_t *name = &line->names[j];
+			if (name->symbol != symbol || IS_DEFINITION(name->kind)) {
+				continue;
+			}
+			name->error = SUCCESS;
+			if (name->kind == NAME_OPERAND && (!first || first_kind == NAME_MACRO)) {
+				name->error = ERR_SYMBOL_UNDEFINED;
+			}
+			else if (name->kind == NAME_ENTRY && !has_label) {
+				name->error = ERR_SYMBOL_ENTRY_UNDEFINED;
+			}
+			/* Macros are expanded in a single pass, so they are defined before they are used */
+			else if (name->kind == NAME_CALL && (!first || first_kind != NAME_MACRO || first->number > line->number)) {
+				name->error = ERR_INSTRUCTION_INVALID;
+			}
+		}
+	}
+}
+
+/* Checks all the symbols used by changed lines */
+static void check_dirty_symbols(document_t *document) {
+	while (document->dirty) {
+		symbol_t *symbol = document->dirty;
+		document->dirty = symbol->next_dirty;
+		symbol->is_dirty = 0;
+		check_symbol(symbol);
+	}
+}
+
+/* Documents --------------------------------------------- */
+
+/* Allocates a line with a copy of the given text */
+static line_t *new_line(const char *text, int length) {
+	line_t *line = (line_t *)calloc(1, sizeof(line_t));
+	if (!line) {
+		return NULL;
+	}
+	line->text = (char *)malloc(length + 1);
+	if (!line->text) {
+		free(line);
+		return NULL;
+	}
+	memcpy(line->text, text, length);
+	line->text[length] = '\0';
+	return line;
+}
+
+static void free_line(line_t *line) {
+	free(line->names);
+	free(line->text);
+	free(line);
+}
+
+/* Replaces the lines [first, last] of a document with the lines of a text, and parses them */
+static ErrorCode replace_lines(document_t *document, int first, int last, const char *text) {
+	int n_old = last - first + 1;
+	int n_new = 1;
+	int in_macro;
+	const char *pos;
+	int i;
+
+	for (pos = text; *pos; pos++) {
+		if (*pos == '\n') {
+			n_new++;
+		}
+	}
+
+	/* Make room for the new lines */
+	if (document->n_lines - n_old + n_new > document->lines_capacity) {
+		int capacity = document->lines_capacity ? document->lines_capacity : 64;
+		line_t **grown;
+		while (capacity < document->n_lines - n_old + n_new) {
+			capacity *= 2;
+		}
+		grown = (line_t **)realloc(document->lines, capacity * sizeof(line_t *));
+		if (!grown) {
+			return ERR_OUT_OF_MEMORY;
+		}
+		document->lines = grown;
+		document->lines_capacity = capacity;
+	}
+
+	for (i = first; i <= last; i++) {
+		forget_line(document, document->lines[i]);
+		free_line(document->lines[i]);
+	}
+	memmove(document->lines + first + n_new, document->lines + last + 1, (document->n_lines - last - 1) * sizeof(line_t *));
+	document->n_lines += n_new - n_old;
+
+	/* Split the text into lines */
+	pos = text;
+	for (i = first; i < first + n_new; i++) {
+		const char *end = strchr(pos, '\n');
+		int length = end ? end - pos : (int)strlen(pos);
+		document->lines[i] = new_line(pos, length);
+		if (!document->lines[i]) {
+			document->lines[i] = new_line("", 0);
+			if (!document->lines[i]) {
+				return ERR_OUT_OF_MEMORY;
+			}
+		}
+		pos += length + (end ? 1 : 0);
+	}
+
+	/* Only lines after an insertion or deletion move */
+	for (i = first; i < (n_new == n_old ? first + n_new : document->n_lines); i++) {
+		document->lines[i]->number = i;
+	}
+
+	/* Parse the new lines, then the following ones as long as their macro state changes */
+	in_macro = first > 0 ? document->lines[first - 1]->next_in_macro : 0;
+	for (i = first; i < document->n_lines; i++) {
+		line_t *line = document->lines[i];
+		if (i >= first + n_new) {
+			if (line->in_macro == in_macro) {
+				break;
+			}
+			forget_line(document, line);
+		}
+		analyze_line(document, line, in_macro);
+		in_macro = line->next_in_macro;
+	}
+
+	check_dirty_symbols(document);
+	return SUCCESS;
+}
+
+static document_t *find_document(const char *uri) {
+	document_t *document;
+	for (document = documents; document; document = document->next) {
+		if (strcmp(document->uri, uri) == 0) {
+			return document;
+		}
+	}
+	return NULL;
+}
+
+static void close_document(const char *uri) {
+	document_t **link = &documents;
+	document_t *document;
+	int i;
+
+	while (*link && strcmp((*link)->uri, uri) != 0) {
+		link = &(*link)->next;
+	}
+	document = *link;
+	if (!document) {
+		return;
+	}
+	*link = document->next;
+
+	for (i = 0; i < document->n_lines; i++) {
+		free_line(document->lines[i]);
+	}
+	for (i = 0; i < SYMBOL_BUCKETS; i++) {
+		symbol_t *symbol = document->symbols[i];
+		while (symbol) {
+			symbol_t *next = symbol->next;
+			free(symbol->definitions);
+			free(symbol->references);
+			free(symbol->name);
+			free(symbol);
+			symbol = next;
+		}
+	}
+	free(document->lines);
+	free(document->uri);
+	free(document);
+}
+
+static document_t *open_document(const char *uri, const char *text) {
+	document_t *document;
+
+	close_document(uri);
+	document = (document_t *)calloc(1, sizeof(document_t));
+	if (!document) {
+		return NULL;
+	}
+	document->uri = my_strdup((char *)uri);
+	document->lines = (line_t **)malloc(sizeof(line_t *));
+	document->lines_capacity = 1;
+	if (!document->uri || !document->lines) {
+		free(document->uri);
+		free(document->lines);
+		free(document);
+		return NULL;
+	}
+
+	/* A new document holds a single empty line, replaced by the text */
+	document->lines[0] = new_line("", 0);
+	document->n_lines = 1;
+	document->next = documents;
+	documents = document;
+	if (!document->lines[0] || replace_lines(document, 0, 0, text) != SUCCESS) {
+		close_document(uri);
+		return NULL;
+	}
+	return document;
+}
+
+/* Applies a text change, given as a range of the document and its new text */
+static ErrorCode change_document(document_t *document, int start_line, int start_character, int end_line, int end_character, const char *text) {
+	line_t *start, *end;
+	char *replaced;
+	int start_length, end_length;
+	ErrorCode error;
+
+	/* Positions past the end are clamped to the end */
+	if (start_line >= document->n_lines) {
+		start_line = document->n_lines - 1;
+		start_character = strlen(document->lines[start_line]->text);
+	}
+	if (end_line >= document->n_lines) {
+		end_line = document->n_lines - 1;
+		end_character = strlen(document->lines[end_line]->text);
+	}
+	start = document->lines[start_line];
+	end = document->lines[end_line];
+	start_length = strlen(start->text);
+	end_length = strlen(end->text);
+	if (start_character > start_length) {
+		start_character = start_length;
+	}
+	if (end_character > end_length) {
+		end_character = end_length;
+	}
+
+	/* The changed lines are the start of the first one, the text, and the end of the last one */
+	replaced = (char *)malloc(start_character + strlen(text) + end_length - end_character + 1);
+	if (!replaced) {
+		return ERR_OUT_OF_MEMORY;
+	}
+	memcpy(replaced, start->text, start_character);
+	strcpy(replaced + start_character, text);
+	strcat(replaced, end->text + end_character);
+
+	error = replace_lines(document, start_line, end_line, replaced);
+	free(replaced);
+	return error;
+}
+
+/* Protocol --------------------------------------------- */
+
+/* Reads the body of the next message, NULL at the end of the input */
+static char *read_message(FILE *input) {
+	char header[HEADER_LEN];
+	long length = -1;
+	char *body;
+
+	while (fgets(header, HEADER_LEN, input)) {
+		if (strcmp(header, "\r\n") == 0 || strcmp(header, "\n") == 0) {
+			if (length < 0) {
+				continue;
+			}
+			body = (char *)malloc(length + 1);
+			if (!body) {
+				return NULL;
+			}
+			if (fread(body, 1, length, input) != (size_t)length) {
+				free(body);
+				return NULL;
+			}
+			body[length] = '\0';
+			return body;
+		}
+		if (strncmp(header, "Content-Length:", 15) == 0) {
+			length = atol(header + 15);
+		}
+	}
+	return NULL;
+}
+
+/* Sends the message written to the body file */
+static void send_message(FILE *output, FILE *body) {
+	long length = ftell(body);
+	char buffer[4096];
+
+	fprintf(output, "Content-Length: %ld\r\n\r\n", length);
+	rewind(body);
+	while (length > 0) {
+		size_t n = fread(buffer, 1, length < (long)sizeof(buffer) ? (size_t)length : sizeof(buffer), body);
+		if (n == 0) {
+			break;
+		}
+		fwrite(buffer, 1, n, output);
+		length -= n;
+	}
+	fflush(output);
+	rewind(body);
+}
+
+/* Writes the id of a request, as it was received */
+static void write_id(FILE *body, json_t *id) {
+	if (id && id->type == JSON_STRING) {
+		json_write_string(body, id->string);
+	}
+	else if (id && id->type == JSON_NUMBER) {
+		fprintf(body, "%.0f", id->number);
+	}
+	else {
+		fputs("null", body);
+	}
+}
+
+/* Writes a range within a single line */
+static void write_range(FILE *body, int line, int start, int end) {
+	fprintf(body, "{\"start\":{\"line\":%d,\"character\":%d},\"end\":{\"line\":%d,\"character\":%d}}", line, start, line, end);
+}
+
+/* Writes a diagnostic of a range within a line */
+static void write_diagnostic(FILE *body, int *count, int line, int start, int end, ErrorCode error) {
+	const char *message = get_error_message(error);
+
+	fputs(*count ? "," : "", body);
+	fputs("{\"range\":", body);
+	write_range(body, line, start, end);
+	fputs(",\"severity\":1,\"source\":\"assembler\",\"message\":", body);
+	json_write_string(body, message ? message : "unknown error");
+	fputs("}", body);
+	(*count)++;
+}
+
+/* Sends all the diagnostics of a document */
+static void publish_diagnostics(FILE *output, FILE *body, document_t *document) {
+	int count = 0;
+	int i, j;
+
+	fputs("{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\",\"params\":{\"uri\":", body);
+	json_write_string(body, document->uri);
+	fputs(",\"diagnostics\":[", body);
+	for (i = 0; i < document->n_lines; i++) {
+		line_t *line = document->lines[i];
+		if (line->error != SUCCESS) {
+			write_diagnostic(body, &count, i, 0, strlen(line->text), line->error);
+		}
+		for (j = 0; j < line->n_names; j++) {
+			name_t *name = &line->names[j];
+			if (name->error != SUCCESS) {
+				write_diagnostic(body, &count, i, name->column, name->column + strlen(name->symbol->name), name->error);
+			}
+		}
+	}
+	fputs("]}}", body);
+	send_message(output, body);
+}
+
+/* Finds the symbol of the name at a position */
+static symbol_t *symbol_at(document_t *document, json_t *params) {
+	json_t *position = json_get(params, "position");
+	int line_number = json_get_int(position, "line", -1);
+	int character = json_get_int(position, "character", -1);
+	char *text;
+	int start, end;
+
+	if (line_number < 0 || line_number >= document->n_lines || character < 0) {
+		return NULL;
+	}
+	text = document->lines[line_number]->text;
+	if (character > (int)strlen(text)) {
+		return NULL;
+	}
+	for (start = character; start > 0 && (isalnum((unsigned char)text[start - 1]) || text[start - 1] == '_'); start--);
+	for (end = character; text[end] && (isalnum((unsigned char)text[end]) || text[end] == '_'); end++);
+	if (start == end) {
+		return NULL;
+	}
+	return find_symbol(document, text + start, end - start, 0);
+}
+
+/* Writes the locations of a symbol's definitions and/or references on its lines */
+static void write_locations(FILE *body, document_t *document, symbol_t *symbol, line_t **lines, int n_lines, int definitions, int *count) {
+	int i, j;
+
+	/* A line may use the same name more than once, visit each line once */
+	document->stamp++;
+	for (i = 0; i < n_lines; i++) {
+		line_t *line = lines[i];
+		if (line->stamp == document->stamp) {
+			continue;
+		}
+		line->stamp = document->stamp;
+		for (j = 0; j < line->n_names; j++) {
+			name_t *name = &line->names[j];
+			if (name->symbol != symbol || IS_DEFINITION(name->kind) != definitions) {
+				continue;
+			}
+			fputs((*count)++ ? ",{\"uri\":" : "{\"uri\":", body);
+			json_write_string(body, document->uri);
+			fputs(",\"range\":", body);
+			write_range(body, line->number, name->column, name->column + strlen(symbol->name));
+			fputs("}", body);
+		}
+	}
+}
+
+/* Answers a definition or references request */
+static void send_locations(FILE *output, FILE *body, json_t *id, json_t *params, int references) {
+	document_t *document = find_document(json_get_string(json_get(params, "textDocument"), "uri"));
+	symbol_t *symbol = document ? symbol_at(document, params) : NULL;
+	json_t *include_declaration = json_get(json_get(params, "context"), "includeDeclaration");
+	int count = 0;
+
+	fputs("{\"jsonrpc\":\"2.0\",\"id\":", body);
+	write_id(body, id);
+	fputs(",\"result\":[", body);
+	if (symbol && (!references || (include_declaration && include_declaration->number))) {
+		write_locations(body, document, symbol, symbol->definitions, symbol->n_definitions, 1, &count);
+	}
+	if (symbol && references) {
+		write_locations(body, document, symbol, symbol->references, symbol->n_references, 0, &count);
+	}
+	fputs("]}", body);
+	send_message(output, body);
+}
+
+/* Answers a request with a result given as JSON text */
+static void send_result(FILE *output, FILE *body, json_t *id, const char *result) {
+	fputs("{\"jsonrpc\":\"2.0\",\"id\":", body);
+	write_id(body, id);
+	fprintf(body, ",\"result\":%s}", result);
+	send_message(output, body);
+}
+
+/* Answers an unknown request */
+static void send_method_not_found(FILE *output, FILE *body, json_t *id) {
+	fputs("{\"jsonrpc\":\"2.0\",\"id\":", body);
+	write_id(body, id);
+	fputs(",\"error\":{\"code\":-32601,\"message\":\"method not found\"}}", body);
+	send_message(output, body);
+}
+
+/* Applies the changes of a didChange notification */
+static void apply_changes(document_t *document, json_t *changes) {
+	json_t *change;
+
+	for (change = changes ? changes->child : NULL; change; change = change->next) {
+		json_t *range = json_get(change, "range");
+		char *text = json_get_string(change, "text");
+
+		if (!text) {
+			continue;
+		}
+		/* A change without a range replaces the whole document */
+		if (!range) {
+			change_document(document, 0, 0, document->n_lines, 0, text);
+		}
+		else {
+			json_t *start = json_get(range, "start");
+			json_t *end = json_get(range, "end");
+			change_document(document,
+				json_get_int(start, "line", 0), json_get_int(start, "character", 0),
+				json_get_int(end, "line", 0), json_get_int(end, "character", 0),
+				text);
+		}
+	}
+}
+
+int server_process(FILE *input, FILE *output) {
+	FILE *body = tmpfile();
+	char *message;
+	int shutdown = 0;
+
+	if (!body) {
+		is_error(ERR_FILE_CANNOT_CREATE, NULL, "server", 0, NULL);
+		return 1;
+	}
+
+	while ((message = read_message(input))) {
+		json_t *request = json_parse(message);
+		json_t *params = json_get(request, "params");
+		json_t *id = json_get(request, "id");
+		char *method = json_get_string(request, "method");
+		char *uri = json_get_string(json_get(params, "textDocument"), "uri");
+		document_t *document;
+
+		free(message);
+		if (!method) {
+			json_free(request);
+			continue;
+		}
+
+		if (strcmp(method, "initialize") == 0) {
+			send_result(output, body, id,
+				"{\"capabilities\":{\"textDocumentSync\":{\"openClose\":true,\"change\":2},"
+				"\"definitionProvider\":true,\"referencesProvider\":true},"
+				"\"serverInfo\":{\"name\":\"assembler\"}}");
+		}
+		else if (strcmp(method, "shutdown") == 0) {
+			shutdown = 1;
+			send_result(output, body, id, "null");
+		}
+		else if (strcmp(method, "exit") == 0) {
+			json_free(request);
+			break;
+		}
+		else if (strcmp(method, "textDocument/didOpen") == 0 && uri) {
+			char *text = json_get_string(json_get(params, "textDocument"), "text");
+			document = open_document(uri, text ? text : "");
+			if (document) {
+				publish_diagnostics(output, body, document);
+			}
+		}
+		else if (strcmp(method, "textDocument/didChange") == 0 && uri && (document = find_document(uri))) {
+			apply_changes(document, json_get(params, "contentChanges"));
+			publish_diagnostics(output, body, document);
+		}
+		else if (strcmp(method, "textDocument/didClose") == 0 && uri) {
+			close_document(uri);
+		}
+		else if (strcmp(method, "textDocument/definition") == 0) {
+			send_locations(output, body, id, params, 0);
+		}
+		else if (strcmp(method, "textDocument/references") == 0) {
+			send_locations(output, body, id, params, 1);
+		}
+		/* Other requests are answered with an error, other notifications are ignored */
+		else if (id) {
+			send_method_not_found(output, body, id);
+		}
+		json_free(request);
+	}
+
+	while (documents) {
+		close_document(documents->uri);
+	}
+	fclose(body);
+	return !shutdown;
+}
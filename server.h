@@ -0,0 +1,19 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdio.h>
+
+/**
+Runs a language server over the Language Server Protocol, until the client exits.
+Open documents are kept in memory as lines, each with its own parsed state, together with
+an index of the symbols and macros defined and referenced in them.
+On each edit only the changed lines are parsed again, along with the following lines
+whose macro definition state changed, and only the symbols used by these lines are checked again.
+Serves diagnostics, go to definition and find references.
+	@param input: The stream of client messages.
+	@param output: The stream of server messages.
+	@return 0 if the client asked to shut down before exiting, 1 otherwise.
+*/
+int server_process(FILE *input, FILE *output);
+
+#endif /* SERVER_H */
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error_codes.h"
+#include "utils.h"
+#include "machine.h"
+#include "profile.h"
+
+/**
+ * This program runs assembled programs on a simulation of the target machine.
+ * Usage: simulator [--interpret] [--profile] <program> [<program> ...]
+ * Each program is given by its base name, and is loaded from its .ob file.
+ * Code is run from a cache of decoded basic blocks, --interpret runs it on the plain interpreter instead.
+ * With --profile, a report of the hottest labels and instructions is printed after each program.
+ * Labels are read from the program's debug file (.dbg), written by the assembler's -g option.
+ * The red and prn instructions read from the standard input and write to the standard output.
+ * After a program stops, the number of executed instructions and cycles is printed.
+ */
+int main(int argc, char **argv)
+{
+	FILE *file;
+	machine_t machine;
+	char filename[MAX_FILE_NAME];
+	char error_context[LINE_LEN];
+	int line_number;
+	int error_state = 0;
+	int cache_blocks = 1;
+	int profile = 0;
+	ErrorCode error;
+	int i;
+
+	/* Check if at least one program is provided */
+	if (argc == 1)
+	{
+		printf("No input file provided.\n");
+		exit(1);
+	}
+
+	/* Iterate over all programs */
+	for (i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--interpret") == 0) {
+			cache_blocks = 0;
+			continue;
+		}
+		if (strcmp(argv[i], "--profile") == 0) {
+			profile = 1;
+			continue;
+		}
+		if (is_filename_too_long(argv[i])) {
+			is_error(ERR_FILE_NAME_TOO_LONG, &error_state, argv[i], 0, NULL);
+			continue;
+		}
+		get_filename(argv[i], "ob", filename);
+		file = fopen(filename, "r");
+		if (!file) {
+			is_error(ERR_FILE_NOT_EXIST, &error_state, filename, 0, NULL);
+			continue;
+		}
+
+		error = machine_init(&machine, stdin, stdout);
+		if (is_error(error, &error_state, filename, 0, NULL)) {
+			fclose(file);
+			continue;
+		}
+		machine.cache_blocks = cache_blocks;
+
+		/* Load the program */
+		error = machine_load(&machine, file, &line_number);
+		fclose(file);
+		if (is_error(error, &error_state, filename, line_number, NULL)) {
+			machine_purge(&machine);
+			continue;
+		}
+
+		if (profile) {
+			error = machine_profile(&machine);
+			if (is_error(error, &error_state, filename, 0, NULL)) {
+				machine_purge(&machine);
+				continue;
+			}
+		}
+
+		/* Run till the program stops */
+		error = machine_run(&machine, 0);
+		fflush(stdout);
+		sprintf(error_context, "at address %07d", machine.pc);
+		is_error(error, &error_state, filename, 0, error_context);
+		printf("Executed %ld instructions in %ld cycles.\n", machine.instructions, machine.cycles);
+
+		/* Report the profile, with labels from the debug file if it exists */
+		if (profile) {
+			get_filename(argv[i], "dbg", filename);
+			file = fopen(filename, "r");
+			print_profile(&machine, file, stdout);
+			if (file) {
+				fclose(file);
+			}
+		}
+
+		machine_purge(&machine);
+	}
+
+	return error_state;
+}
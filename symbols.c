@@ -4,7 +4,7 @@
 #include <ctype.h>
 
 #include "utils.h"
-#include "language.h"
+#include "intern.h"
 #include "macro.h"
 #include "symbols.h"
 
@@ -12,37 +12,79 @@
 
 #define SYMBOL_LEN 31
 
-/* A symbol definition */ 
-typedef struct symbol_t {
-	char *name;
-	int address;
-	storage_t storage;
-    int is_entry;
-    struct symbol_t *next;
+/* Fields of a packed symbol word: the address in the low bits, then the storage and the entry flag */
+#define ADDRESS_BITS 26
+#define ADDRESS_MASK ((1u << ADDRESS_BITS) - 1)
+#define STORAGE_SHIFT ADDRESS_BITS
+#define STORAGE_MASK (3u << STORAGE_SHIFT)
+#define ENTRY_FLAG (1u << (ADDRESS_BITS + 2))
+
+#define SYMBOL_ADDRESS(symbol) ((int)((symbol)->word & ADDRESS_MASK))
+#define SYMBOL_STORAGE(symbol) ((storage_t)(((symbol)->word & STORAGE_MASK) >> STORAGE_SHIFT))
+#define IS_SYMBOL_ENTRY(symbol) (((symbol)->word & ENTRY_FLAG) != 0)
+
+/* A symbol definition, 8 bytes, the name is interned */ 
+typedef struct {
+	name_id_t name;
+	unsigned int word;      /* Address, storage and entry flag */
 } symbol_t;
 
-/* Linked list of symbols */
-static symbol_t *symbol_list_head = NULL;
-static symbol_t *symbol_list_tail = NULL;
+/* Array of symbols, in definition order */
+static symbol_t *symbols = NULL;
+static int n_symbols = 0;
+static int symbols_capacity = 0;
+
+/* Positions of symbols in the array plus 1 by name id, 0 for names that are not symbols */
+static int *symbol_index = NULL;
+static int symbol_index_size = 0;
+
+/* A reference to an external symbol */
+typedef struct {
+	name_id_t name;
+	int address;
+} extern_reference_t;
 
 /* External symbols usage */
-char *external_symbol_references;
+static extern_reference_t *extern_references = NULL;
+static int n_extern_references = 0;
+static int extern_references_capacity = 0;
 
-ErrorCode add_symbol(char *name, int address, storage_t storage, int is_entry) {
+/* Returns the symbol of a name, or NULL */
+static symbol_t *find_symbol(char *name) {
+	name_id_t id = find_name(name);
+
+	if (id == NO_NAME || id >= symbol_index_size || symbol_index[id] == 0) {
+		return NULL;
+	}
+	return &symbols[symbol_index[id] - 1];
+}
+
+/* Makes room in the index for a name id */
+static ErrorCode grow_symbol_index(name_id_t id) {
+	int *grown;
+	int size = symbol_index_size ? symbol_index_size : 256;
+
+	while (size <= id) {
+		size *= 2;
+	}
+	grown = (int *)realloc(symbol_index, size * sizeof(int));
+	if (!grown) {
+		return ERR_OUT_OF_MEMORY;
+	}
+	memset(grown + symbol_index_size, 0, (size - symbol_index_size) * sizeof(int));
+	symbol_index = grown;
+	symbol_index_size = size;
+	return SUCCESS;
+}
+
+ErrorCode check_symbol_name(char *name) {
 	int i;
-	symbol_t *symbol;
 
-    /* Validate symbol name */
-    /* Check if the symbol name is a reserved word */
-    if (is_reserved_word(name)) {
+    /* Check if the symbol name is a reserved word, without interning it */
+    if (is_reserved_name(find_name(name))) {
         return ERR_SYMBOL_RESERVED;
     }
     
-    /* Check if this is a macro name */
-    if (is_macro(name)) {
-        return ERR_SYMBOL_AS_MACRO;
-    }
-    
     /* Ensure the symbol name is within the allowed length */
     if (strlen(name) > SYMBOL_LEN) {
         return ERR_SYMBOL_NAME_TOO_LONG;
@@ -59,6 +101,24 @@ ErrorCode add_symbol(char *name, int address, storage_t storage, int is_entry) {
 			return ERR_SYMBOL_ILLEGAL_NAME;
 		}
 	}
+	return SUCCESS;
+}
+
+ErrorCode add_symbol(char *name, int address, storage_t storage, int is_entry) {
+	symbol_t *symbol;
+	name_id_t id;
+	ErrorCode error;
+
+    /* Check if this is a macro name, macro names are never reserved words */
+    if (is_macro(name)) {
+        return ERR_SYMBOL_AS_MACRO;
+    }
+
+    /* Validate symbol name */
+	error = check_symbol_name(name);
+	if (error != SUCCESS) {
+		return error;
+	}
     
     /* If this is just a symbol reference (and not a definition), do not add */
     if (address < 0) {
@@ -66,145 +126,181 @@ ErrorCode add_symbol(char *name, int address, storage_t storage, int is_entry) {
     }
 
     /* Check if symbol already defined */
-    if (get_symbol(name, NULL, NULL) == SUCCESS) {
+    id = intern_name(name);
+    if (id == NO_NAME) {
+        return ERR_OUT_OF_MEMORY;
+    }
+    if (id < symbol_index_size && symbol_index[id]) {
         return ERR_SYMBOL_REDEFINITION;
     }
-
-    /* Allocate and insert a new symbol */
-    symbol = (symbol_t *)malloc(sizeof(symbol_t));
-    if (!symbol) {
+    if (id >= symbol_index_size && grow_symbol_index(id) != SUCCESS) {
         return ERR_OUT_OF_MEMORY;
     }
 
-    symbol->name = my_strdup(name);
-	symbol->address = address;
-    symbol->storage = storage;
-    symbol->is_entry = is_entry;
-    symbol->next = NULL;
-
-    /* Insert symbol into the linked list */
-    if (!symbol_list_head) {
-        symbol_list_head = symbol;
-        symbol_list_tail = symbol;
-    }
-    else {
-        symbol_list_tail->next = symbol;
-        symbol_list_tail = symbol;
+    /* Grow the array of symbols */
+    if (n_symbols == symbols_capacity) {
+        int capacity = symbols_capacity ? symbols_capacity * 2 : 64;
+        symbol_t *grown = (symbol_t *)realloc(symbols, capacity * sizeof(symbol_t));
+        if (!grown) {
+            return ERR_OUT_OF_MEMORY;
+        }
+        symbols = grown;
+        symbols_capacity = capacity;
     }
 
+    /* Append the new symbol */
+    symbol = &symbols[n_symbols++];
+    symbol->name = id;
+    symbol->word = ((unsigned int)address & ADDRESS_MASK) |
+        ((unsigned int)storage << STORAGE_SHIFT) |
+        (is_entry ? ENTRY_FLAG : 0);
+    symbol_index[id] = n_symbols;
+
     return SUCCESS;
 }
 
 ErrorCode get_symbol(char *name, int *address, storage_t *storage) {
-    symbol_t *current = symbol_list_head;
-    /* Search for the symbol in the symbol list. */
-    while (current) {
-        if (strcmp(current->name, name) == 0) {
-            /* Set the address if requested */
-            if (address) {
-                *address = current->address;
-            }
-            /* Set the storage type if requested */
-            if (storage) {
-                *storage = current->storage;
-            }
-            return SUCCESS;
-        }
-        current = current->next;
+    symbol_t *symbol = find_symbol(name);
+
+    if (!symbol) {
+        return ERR_SYMBOL_UNDEFINED;
+    }
+    /* Set the address if requested */
+    if (address) {
+        *address = SYMBOL_ADDRESS(symbol);
     }
-    return ERR_SYMBOL_UNDEFINED;
+    /* Set the storage type if requested */
+    if (storage) {
+        *storage = SYMBOL_STORAGE(symbol);
+    }
+    return SUCCESS;
 }
 
 ErrorCode set_symbol_entry(char *name) {
-    symbol_t *current = symbol_list_head;
-    /* Search for symbol in the symbol list. */
-    while (current) {
-        if (strcmp(current->name, name) == 0) {
-            /* Set the symbol as an entry point */
-            current->is_entry = 1;
-            return SUCCESS;
-        }
-        current = current->next;
+    symbol_t *symbol = find_symbol(name);
+
+    if (!symbol) {
+        return ERR_SYMBOL_ENTRY_UNDEFINED;
     }
-    return ERR_SYMBOL_ENTRY_UNDEFINED;
+    /* Set the symbol as an entry point */
+    symbol->word |= ENTRY_FLAG;
+    return SUCCESS;
 }
 
-void add_external_symbol_references(char *name, int address) {
-    char line[LINE_LEN];
-    /* Format the external symbol reference */
-    sprintf(line, "%s %07d\n", name, address);
+ErrorCode set_symbol_address(char *name, int address) {
+    symbol_t *symbol = find_symbol(name);
 
-    /* Allocate memory for the first reference */
-    if (!external_symbol_references) {
-        external_symbol_references = (char *)malloc(strlen(line) + 1);
-        strcpy(external_symbol_references, line);
+    if (!symbol) {
+        return ERR_SYMBOL_UNDEFINED;
     }
-    /* Append the new reference to the existing list*/
-    else {
-        external_symbol_references = (char *)realloc(external_symbol_references, strlen(external_symbol_references) + strlen(line) + 1);
-        strcat(external_symbol_references, line);
+    symbol->word = (symbol->word & ~ADDRESS_MASK) | ((unsigned int)address & ADDRESS_MASK);
+    return SUCCESS;
+}
+
+ErrorCode add_external_symbol_references(char *name, int address) {
+    /* Grow the references */
+    if (n_extern_references == extern_references_capacity) {
+        int capacity = extern_references_capacity ? extern_references_capacity * 2 : 64;
+        extern_reference_t *grown = (extern_reference_t *)realloc(extern_references, capacity * sizeof(extern_reference_t));
+        if (!grown) {
+            return ERR_OUT_OF_MEMORY;
+        }
+        extern_references = grown;
+        extern_references_capacity = capacity;
+    }
+    /* The name is formatted only when the references are written */
+    extern_references[n_extern_references].name = intern_name(name);
+    extern_references[n_extern_references].address = address;
+    if (extern_references[n_extern_references].name == NO_NAME) {
+        return ERR_OUT_OF_MEMORY;
     }
+    n_extern_references++;
+    return SUCCESS;
 }
 
 void fix_symbols_by_IC(int IC) {
-    symbol_t *current = symbol_list_head;
-    /* Traverse the symbol list and adjust the address of data symbols */
-    while (current) {
-        if (current->storage == DATA) {
-            /* Adjust the address by adding the IC */
-            current->address += IC;
+    int i;
+    /* Adjust the address of data symbols by adding the IC, the address is in the low bits */
+    for (i = 0; i < n_symbols; i++) {
+        if (SYMBOL_STORAGE(&symbols[i]) == DATA) {
+            symbols[i].word += IC;
         }
-        current = current->next;
     }
 }
 
 int has_extern() {
-    return external_symbol_references != NULL;
+    return n_extern_references > 0;
 }
 
 int has_entry() {
-    symbol_t *current = symbol_list_head;
-    while (current) {
-        if (current->is_entry) {
+    int i;
+    for (i = 0; i < n_symbols; i++) {
+        if (IS_SYMBOL_ENTRY(&symbols[i])) {
             return 1;
         }
-        current = current->next;
     }
     return 0;
 }
 
 void dump_extern(FILE* file) {
+    char line[LINE_LEN];
+    int i;
+
     /* Write external references to the file */
-    fputs(external_symbol_references, file);
+    for (i = 0; i < n_extern_references; i++) {
+        sprintf(line, "%s %07d\n", get_name(extern_references[i].name), extern_references[i].address);
+        fputs(line, file);
+    }
 }
 
 void dump_entry(FILE* file) {
     char line[LINE_LEN];
-    symbol_t *current = symbol_list_head;
-    while (current) {
-        if (current->is_entry) {
+    int i;
+    for (i = 0; i < n_symbols; i++) {
+        if (IS_SYMBOL_ENTRY(&symbols[i])) {
             /* Format the entry symbol */
-            sprintf(line, "%s %07d\n", current->name, current->address);
+            sprintf(line, "%s %07d\n", get_name(symbols[i].name), SYMBOL_ADDRESS(&symbols[i]));
             /* Write the entry symbol to the file */
             fputs(line, file);
         }
-        current = current->next;
+    }
+}
+
+void dump_symbols(FILE* file) {
+    static char *storage_names[] = { "code", "data", "extern" };
+    char line[LINE_LEN];
+    int i;
+    for (i = 0; i < n_symbols; i++) {
+        /* Format the symbol record */
+        sprintf(line, "symbol %s %07d %s%s\n",
+            get_name(symbols[i].name),
+            SYMBOL_ADDRESS(&symbols[i]),
+            storage_names[SYMBOL_STORAGE(&symbols[i])],
+            IS_SYMBOL_ENTRY(&symbols[i]) ? " entry" : "");
+        fputs(line, file);
+    }
+}
+
+void dump_extern_names(FILE* file) {
+    int i;
+    for (i = 0; i < n_symbols; i++) {
+        if (SYMBOL_STORAGE(&symbols[i]) == EXTERN) {
+            fprintf(file, " %s", get_name(symbols[i].name));
+        }
     }
 }
 
 void purge_symbols() {
-    symbol_t *current = symbol_list_head;
-    /* Free the symbol table*/
-    while (current) {
-        symbol_t *next = current->next;
-        free(current->name);
-        free(current);
-        current = next;
+    int i;
+    /* Clear the index of the symbols, and keep the array for the next file */
+    for (i = 0; i < n_symbols; i++) {
+        symbol_index[symbols[i].name] = 0;
     }
-    symbol_list_head = NULL;
-    symbol_list_tail = NULL;
+    n_symbols = 0;
 
     /* Free memory for external references */
-    free(external_symbol_references);
-    external_symbol_references = NULL;
+    free(extern_references);
+    extern_references = NULL;
+    n_extern_references = 0;
+    extern_references_capacity = 0;
 }
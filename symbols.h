@@ -11,6 +11,13 @@ typedef enum {
     EXTERN
 } storage_t;
 
+/**
+Checks that a name is a valid symbol name
+    @param name: The name to check.
+    @return SUCCESS if the name is valid, error otherwise.
+*/
+ErrorCode check_symbol_name(char *name);
+
 /**
 Adds a new symbol to the symbol table
     @param name: The symbol name.
@@ -30,6 +37,14 @@ Retrieves the address and storage type of a symbol
 */
 ErrorCode get_symbol(char *name, int *address, storage_t *storage);
 
+/**
+Moves a symbol to a new address
+    @param name Symbol name.
+    @param address The new address.
+    @return SUCCESS if successful, error otherwise.
+*/
+ErrorCode set_symbol_address(char *name, int address);
+
 /**
 Marks a symbol as an entry
     @param name Symbol name.
@@ -41,8 +56,9 @@ ErrorCode set_symbol_entry(char *name);
 Records a reference to an external symbol
     @param name Symbol name.
     @param address Address where the symbol is referenced.
+    @return SUCCESS if successful, ERR_OUT_OF_MEMORY otherwise.
 */
-void add_external_symbol_references(char *name, int address);
+ErrorCode add_external_symbol_references(char *name, int address);
 
 /** Adjusts symbols' addresses based on the instruction counter (IC). */
 void fix_symbols_by_IC();
@@ -71,6 +87,19 @@ Writes all entry symbols to a file.
 */
 void dump_entry(FILE* file);
 
+/**
+Writes all symbols, including non-entry labels, to a debug file.
+Each symbol is written as a "symbol <name> <address> <storage> [entry]" record.
+    @param file File pointer to write to.
+*/
+void dump_symbols(FILE* file);
+
+/**
+Writes the names of all external symbols, each preceded by a space.
+    @param file File pointer to write to.
+*/
+void dump_extern_names(FILE* file);
+
 /**
 Clears all stored symbols from the symbol table.
 */
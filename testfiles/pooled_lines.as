@@ -0,0 +1,10 @@
+; DUP shares the block of MSG, and is copied when the next line continues it
+MAIN:   lea MSG, r1
+        lea DUP, r2
+        lea TAIL, r3
+        stop
+MSG:    .string "hello"
+        .data 1
+TAIL:   .string "llo"
+DUP:    .string "hello"
+        .data 7
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "error_codes.h"
+#include "utils.h"
+#include "machine.h"
+
+/**
+ * Tests of the simulated machine.
+ * Usage: machine_test
+ * Prints a pass/fail line for each test, and exits with 1 if any test failed.
+ */
+
+/*
+ * Prints "A" three times in a loop:
+ *	MAIN:   mov #3, r1
+ *	LOOP:   prn #65
+ *	        dec r1
+ *	        cmp r1, #0
+ *	        bne &LOOP
+ *	        stop
+ */
+static const char loop_program[] =
+	"     10 0     \n"
+	"0000100 001904\n"
+	"0000101 00001c\n"
+	"0000102 340004\n"
+	"0000103 00020c\n"
+	"0000104 141924\n"
+	"0000105 072004\n"
+	"0000106 000004\n"
+	"0000107 241014\n"
+	"0000108 ffffdc\n"
+	"0000109 3c0004\n";
+
+/*
+ * Prints "h" and a new line:
+ *	MAIN:   mov #2, r2
+ *	        add #102, r2
+ *	        prn r2
+ *	        prn #10
+ *	        stop
+ */
+static const char add_program[] =
+	"      8 0     \n"
+	"0000100 001a04\n"
+	"0000101 000014\n"
+	"0000102 081a0c\n"
+	"0000103 000334\n"
+	"0000104 341a04\n"
+	"0000105 340004\n"
+	"0000106 000054\n"
+	"0000107 3c0004\n";
+
+/*
+ * Prints "ABCB" and a new line, patching "inc r3" into "dec r3" between two loops:
+ *	MAIN:   mov #65, r3
+ *	        mov #2, r1
+ *	LOOP:   prn r3
+ *	PATCH:  inc r3
+ *	        dec r1
+ *	        cmp r1, #0
+ *	        bne &LOOP
+ *	        cmp r4, #0
+ *	        bne &DONE
+ *	        mov #1, r4
+ *	        mov DECW, PATCH
+ *	        mov #2, r1
+ *	        jmp &LOOP
+ *	DONE:   prn #10
+ *	        stop
+ *	DECW:   dec r3
+ */
+static const char patch_program[] =
+	"     28 0     \n"
+	"0000100 001b04\n"
+	"0000101 00020c\n"
+	"0000102 001904\n"
+	"0000103 000014\n"
+	"0000104 341b04\n"
+	"0000105 141b1c\n"
+	"0000106 141924\n"
+	"0000107 072004\n"
+	"0000108 000004\n"
+	"0000109 241014\n"
+	"0000110 ffffdc\n"
+	"0000111 078004\n"
+	"0000112 000004\n"
+	"0000113 241014\n"
+	"0000114 00005c\n"
+	"0000115 001c04\n"
+	"0000116 00000c\n"
+	"0000117 010804\n"
+	"0000118 0003fa\n"
+	"0000119 00034a\n"
+	"0000120 001904\n"
+	"0000121 000014\n"
+	"0000122 24100c\n"
+	"0000123 ffff74\n"
+	"0000124 340004\n"
+	"0000125 000054\n"
+	"0000126 3c0004\n"
+	"0000127 141b24\n";
+
+
+/* Loads an object image into the machine, and runs it till it stops */
+static ErrorCode load_and_run(machine_t *machine, const char *image) {
+	FILE *file = tmpfile();
+	ErrorCode error;
+	int line_number;
+
+	if (!file) {
+		return ERR_FILE_CANNOT_CREATE;
+	}
+	fputs(image, file);
+	rewind(file);
+	error = machine_load(machine, file, &line_number);
+	fclose(file);
+	if (error != SUCCESS) {
+		return error;
+	}
+	return machine_run(machine, 0);
+}
+
+/* Checks that the output written so far is the expected text */
+static int has_output(FILE *output, const char *expected) {
+	char text[LINE_LEN];
+	size_t length;
+
+	rewind(output);
+	length = fread(text, 1, LINE_LEN - 1, output);
+	text[length] = '\0';
+	return strcmp(text, expected) == 0;
+}
+
+/* Runs two programs, one after the other, on the same machine */
+static int test_reload(int cache_blocks) {
+	machine_t machine;
+	FILE *output = tmpfile();
+	int passed;
+
+	if (!output || machine_init(&machine, NULL, output) != SUCCESS) {
+		return 0;
+	}
+	machine.cache_blocks = cache_blocks;
+	passed =
+		load_and_run(&machine, loop_program) == SUCCESS &&
+		load_and_run(&machine, add_program) == SUCCESS &&
+		machine.instructions == 5 &&
+		has_output(output, "AAAh\n");
+	machine_purge(&machine);
+	fclose(output);
+	return passed;
+}
+
+/* Runs a program that overwrites its own code, and checks the blocks are built again */
+static int test_patch(int cache_blocks) {
+	machine_t machine;
+	FILE *output = tmpfile();
+	int passed;
+
+	if (!output || machine_init(&machine, NULL, output) != SUCCESS) {
+		return 0;
+	}
+	machine.cache_blocks = cache_blocks;
+	passed =
+		load_and_run(&machine, patch_program) == SUCCESS &&
+		machine.instructions == 32 &&
+		(!cache_blocks || machine.n_blocks > 0) &&
+		has_output(output, "ABCB\n");
+	machine_purge(&machine);
+	fclose(output);
+	return passed;
+}
+
+/* Reports the result of a test, and returns 1 if it failed */
+static int report(const char *name, int passed) {
+	printf("%s %s\n", passed ? "PASS" : "FAIL", name);
+	return !passed;
+}
+
+int main() {
+	int failed = 0;
+
+	failed += report("reload on the interpreter", test_reload(0));
+	failed += report("reload with cached blocks", test_reload(1));
+	failed += report("patched code on the interpreter", test_patch(0));
+	failed += report("patched code with cached blocks", test_patch(1));
+	return failed ? 1 : 0;
+}
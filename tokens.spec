@@ -0,0 +1,56 @@
+# Token classes of assembly lines, compiled into the tokenizer tables by tokgen.
+#
+# Each rule is: <token type> <pattern> [<value>]
+# A word, separated by white space or commas, is of the type of the first rule whose pattern
+# matches all of it, and words that match no rule are of type TOKEN_WORD. Commas are tokens of their own.
+# Patterns are regular expressions: . is any character, [...] and [^...] are character sets,
+# \ escapes the next character, and *, + and ? repeat the previous item.
+# The value is stored in the token: the index of an instruction in the instructions table,
+# the number of a register, or the directive.
+
+# Labels: any word ending with a colon, checked as a symbol name when defined
+TOKEN_LABEL         .*:
+
+# Directives
+TOKEN_DIRECTIVE     \.data          DIRECTIVE_DATA
+TOKEN_DIRECTIVE     \.string        DIRECTIVE_STRING
+TOKEN_DIRECTIVE     \.fill          DIRECTIVE_FILL
+TOKEN_DIRECTIVE     \.space         DIRECTIVE_SPACE
+TOKEN_DIRECTIVE     \.extern        DIRECTIVE_EXTERN
+TOKEN_DIRECTIVE     \.entry         DIRECTIVE_ENTRY
+TOKEN_DIRECTIVE     \.include       DIRECTIVE_INCLUDE
+
+# Instructions, in the order of the instructions table
+TOKEN_MNEMONIC      mov     0
+TOKEN_MNEMONIC      cmp     1
+TOKEN_MNEMONIC      add     2
+TOKEN_MNEMONIC      sub     3
+TOKEN_MNEMONIC      lea     4
+TOKEN_MNEMONIC      clr     5
+TOKEN_MNEMONIC      not     6
+TOKEN_MNEMONIC      inc     7
+TOKEN_MNEMONIC      dec     8
+TOKEN_MNEMONIC      jmp     9
+TOKEN_MNEMONIC      bne     10
+TOKEN_MNEMONIC      jsr     11
+TOKEN_MNEMONIC      red     12
+TOKEN_MNEMONIC      prn     13
+TOKEN_MNEMONIC      rts     14
+TOKEN_MNEMONIC      stop    15
+
+# Registers
+TOKEN_REGISTER      r0      0
+TOKEN_REGISTER      r1      1
+TOKEN_REGISTER      r2      2
+TOKEN_REGISTER      r3      3
+TOKEN_REGISTER      r4      4
+TOKEN_REGISTER      r5      5
+TOKEN_REGISTER      r6      6
+TOKEN_REGISTER      r7      7
+
+# Operands, with the number or the symbol checked when used
+TOKEN_IMMEDIATE     #.*
+TOKEN_RELATIVE      &.*
+TOKEN_STRING        ".*"
+TOKEN_NUMBER        [-+]?[0-9].*
+TOKEN_IDENTIFIER    [A-Za-z][A-Za-z0-9_]*
@@ -0,0 +1,356 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Generates the tokenizer tables from a token spec (see tokens.spec).
+ * The patterns of all the rules are compiled into a single NFA, which is turned into a DFA
+ * by subset construction. Characters with the same transitions in all the DFA states share
+ * a character class, so the transition table has a column per class rather than per character.
+ * Each DFA state accepts the type and value of the first rule it matches.
+ *
+ * Usage: tokgen <spec file> <output file>
+ */
+
+#define MAX_RULES 128
+#define MAX_NFA_STATES 1024
+#define MAX_DFA_STATES 255
+#define MAX_FIELD 64
+#define SPEC_LINE_LEN 256
+
+#define SET_BYTES (MAX_NFA_STATES / 8)
+
+/* A set of characters */
+typedef struct {
+	unsigned char bits[32];
+} charset_t;
+
+/* An NFA state: a move to the next state, a loop to itself, and an empty move to the next state */
+typedef struct {
+	charset_t move;
+	int has_move;
+	charset_t loop;
+	int has_loop;
+	int has_empty;
+	int accept;             /* Index of the rule accepted, -1 if none */
+} nfa_state_t;
+
+/* A rule of the spec */
+typedef struct {
+	char type[MAX_FIELD];
+	char value[MAX_FIELD];
+	int start;              /* The first NFA state of the rule */
+} rule_t;
+
+/* A DFA state, a set of NFA states */
+typedef struct {
+	unsigned char set[SET_BYTES];
+	int accept;
+	unsigned char next[256];
+} dfa_state_t;
+
+static nfa_state_t nfa[MAX_NFA_STATES];
+static int n_nfa = 0;
+static rule_t rules[MAX_RULES];
+static int n_rules = 0;
+static dfa_state_t dfa[MAX_DFA_STATES + 1];
+static int n_dfa = 0;
+
+static void fail(const char *message, int line_number) {
+	fprintf(stderr, "tokgen: line %d: %s\n", line_number, message);
+	exit(1);
+}
+
+static void add_char(charset_t *set, int c) {
+	set->bits[c / 8] |= (unsigned char)(1 << (c % 8));
+}
+
+static int has_char(charset_t *set, int c) {
+	return (set->bits[c / 8] >> (c % 8)) & 1;
+}
+
+/* Reads a character of a pattern, with escapes */
+static int read_char(char **pos, int line_number) {
+	if (**pos == '\\') {
+		(*pos)++;
+	}
+	if (**pos == '\0') {
+		fail("pattern ends with an escape", line_number);
+	}
+	return (unsigned char)*(*pos)++;
+}
+
+/* Reads an item of a pattern: a character, any character, or a character set */
+static void read_item(char **pos, charset_t *set, int line_number) {
+	int negate = 0;
+	int c;
+
+	memset(set, 0, sizeof(charset_t));
+	if (**pos == '.') {
+		(*pos)++;
+		for (c = 1; c < 256; c++) {
+			add_char(set, c);
+		}
+		return;
+	}
+	if (**pos != '[') {
+		add_char(set, read_char(pos, line_number));
+		return;
+	}
+
+	(*pos)++;
+	if (**pos == '^') {
+		negate = 1;
+		(*pos)++;
+	}
+	while (**pos != ']') {
+		int first, last;
+		if (**pos == '\0') {
+			fail("unterminated character set", line_number);
+		}
+		first = read_char(pos, line_number);
+		last = first;
+		if (**pos == '-' && (*pos)[1] != ']' && (*pos)[1] != '\0') {
+			(*pos)++;
+			last = read_char(pos, line_number);
+		}
+		for (c = first; c <= last; c++) {
+			add_char(set, c);
+		}
+	}
+	(*pos)++;
+	if (negate) {
+		for (c = 1; c < 256; c++) {
+			set->bits[c / 8] ^= (unsigned char)(1 << (c % 8));
+		}
+		set->bits[0] &= (unsigned char)~1;
+	}
+}
+
+/* Adds an NFA state */
+static int new_nfa_state(int line_number) {
+	if (n_nfa == MAX_NFA_STATES) {
+		fail("too many states", line_number);
+	}
+	memset(&nfa[n_nfa], 0, sizeof(nfa_state_t));
+	nfa[n_nfa].accept = -1;
+	return n_nfa++;
+}
+
+/* Compiles the pattern of a rule into a chain of NFA states */
+static void compile_pattern(char *pattern, int rule, int line_number) {
+	char *pos = pattern;
+	int state = new_nfa_state(line_number);
+
+	rules[rule].start = state;
+	while (*pos) {
+		charset_t set;
+		char repeat;
+
+		read_item(&pos, &set, line_number);
+		repeat = *pos;
+		if (repeat == '*' || repeat == '+' || repeat == '?') {
+			pos++;
+		}
+
+		/* x+ is x followed by x* */
+		if (repeat != '*') {
+			nfa[state].move = set;
+			nfa[state].has_move = 1;
+			nfa[state].has_empty = (repeat == '?');
+			state = new_nfa_state(line_number);
+		}
+		if (repeat == '*' || repeat == '+') {
+			nfa[state].loop = set;
+			nfa[state].has_loop = 1;
+			nfa[state].has_empty = 1;
+			state = new_nfa_state(line_number);
+		}
+	}
+	nfa[state].accept = rule;
+}
+
+/* Reads the rules of the spec */
+static void read_spec(FILE *spec) {
+	char line[SPEC_LINE_LEN];
+	char pattern[MAX_FIELD];
+	int line_number = 0;
+	int n_fields;
+
+	while (fgets(line, sizeof(line), spec)) {
+		line_number++;
+		if (line[0] == '#') {
+			continue;
+		}
+		if (n_rules == MAX_RULES) {
+			fail("too many rules", line_number);
+		}
+		n_fields = sscanf(line, "%63s %63s %63s", rules[n_rules].type, pattern, rules[n_rules].value);
+		if (n_fields <= 0) {
+			continue;
+		}
+		if (n_fields == 1) {
+			fail("missing pattern", line_number);
+		}
+		if (n_fields == 2) {
+			strcpy(rules[n_rules].value, "0");
+		}
+		compile_pattern(pattern, n_rules, line_number);
+		n_rules++;
+	}
+}
+
+/* Adds the states reached by empty moves, which always lead to the following state */
+static void close_set(unsigned char *set) {
+	int i;
+
+	for (i = 0; i < n_nfa; i++) {
+		if ((set[i / 8] >> (i % 8)) & 1 && nfa[i].has_empty) {
+			set[(i + 1) / 8] |= (unsigned char)(1 << ((i + 1) % 8));
+		}
+	}
+}
+
+/* Returns the DFA state of a set of NFA states, adding it if new */
+static int find_dfa_state(unsigned char *set) {
+	int i;
+
+	for (i = 0; i < n_dfa; i++) {
+		if (memcmp(dfa[i].set, set, SET_BYTES) == 0) {
+			return i;
+		}
+	}
+	if (n_dfa > MAX_DFA_STATES) {
+		fprintf(stderr, "tokgen: too many tokenizer states\n");
+		exit(1);
+	}
+	memcpy(dfa[n_dfa].set, set, SET_BYTES);
+	/* Rules are compiled in order, so the first accepting state is of the first rule */
+	dfa[n_dfa].accept = -1;
+	for (i = 0; i < n_nfa && dfa[n_dfa].accept < 0; i++) {
+		if ((set[i / 8] >> (i % 8)) & 1) {
+			dfa[n_dfa].accept = nfa[i].accept;
+		}
+	}
+	return n_dfa++;
+}
+
+/* Builds the DFA: state 0 is the empty set, state 1 starts all the rules */
+static void build_dfa() {
+	unsigned char set[SET_BYTES];
+	int state, c, i;
+
+	memset(set, 0, SET_BYTES);
+	find_dfa_state(set);
+	for (i = 0; i < n_rules; i++) {
+		set[rules[i].start / 8] |= (unsigned char)(1 << (rules[i].start % 8));
+	}
+	close_set(set);
+	find_dfa_state(set);
+
+	for (state = 0; state < n_dfa; state++) {
+		for (c = 0; c < 256; c++) {
+			memset(set, 0, SET_BYTES);
+			for (i = 0; i < n_nfa; i++) {
+				if (!((dfa[state].set[i / 8] >> (i % 8)) & 1)) {
+					continue;
+				}
+				if (nfa[i].has_move && has_char(&nfa[i].move, c)) {
+					set[(i + 1) / 8] |= (unsigned char)(1 << ((i + 1) % 8));
+				}
+				if (nfa[i].has_loop && has_char(&nfa[i].loop, c)) {
+					set[i / 8] |= (unsigned char)(1 << (i % 8));
+				}
+			}
+			close_set(set);
+			dfa[state].next[c] = (unsigned char)find_dfa_state(set);
+		}
+	}
+}
+
+/* Writes the tables */
+static void write_tables(FILE *output, char *spec_name) {
+	int classes[256];
+	int representatives[256];
+	int n_classes = 0;
+	int state, c, i;
+
+	/* Characters with the same column of transitions share a class */
+	for (c = 0; c < 256; c++) {
+		for (i = 0; i < n_classes; i++) {
+			for (state = 0; state < n_dfa; state++) {
+				if (dfa[state].next[c] != dfa[state].next[representatives[i]]) {
+					break;
+				}
+			}
+			if (state == n_dfa) {
+				break;
+			}
+		}
+		if (i == n_classes) {
+			representatives[n_classes++] = c;
+		}
+		classes[c] = i;
+	}
+
+	fprintf(output, "/* Generated by tokgen from %s, do not edit */\n\n", spec_name);
+	fprintf(output, "#include \"language.h\"\n#include \"lexer.h\"\n\n");
+	fprintf(output, "/* %d states, %d character classes */\n", n_dfa, n_classes);
+	fprintf(output, "const int lexer_n_classes = %d;\n\n", n_classes);
+
+	fprintf(output, "const unsigned char lexer_char_classes[256] = {");
+	for (c = 0; c < 256; c++) {
+		fprintf(output, "%s%d%s", c % 16 ? " " : "\n\t", classes[c], c < 255 ? "," : "\n");
+	}
+	fprintf(output, "};\n\n");
+
+	fprintf(output, "const unsigned char lexer_transitions[] = {\n");
+	for (state = 0; state < n_dfa; state++) {
+		fprintf(output, "\t");
+		for (i = 0; i < n_classes; i++) {
+			fprintf(output, "%d%s", dfa[state].next[representatives[i]],
+				state < n_dfa - 1 || i < n_classes - 1 ? ", " : "");
+		}
+		fprintf(output, "\n");
+	}
+	fprintf(output, "};\n\n");
+
+	fprintf(output, "const lexer_accept_t lexer_accepts[] = {\n");
+	for (state = 0; state < n_dfa; state++) {
+		if (dfa[state].accept < 0) {
+			fprintf(output, "\t{ TOKEN_WORD, 0 }");
+		}
+		else {
+			fprintf(output, "\t{ %s, %s }", rules[dfa[state].accept].type, rules[dfa[state].accept].value);
+		}
+		fprintf(output, "%s\n", state < n_dfa - 1 ? "," : "");
+	}
+	fprintf(output, "};\n");
+}
+
+int main(int argc, char **argv) {
+	FILE *spec, *output;
+
+	if (argc != 3) {
+		fprintf(stderr, "Usage: tokgen <spec file> <output file>\n");
+		return 1;
+	}
+	spec = fopen(argv[1], "r");
+	if (!spec) {
+		fprintf(stderr, "tokgen: cannot open %s\n", argv[1]);
+		return 1;
+	}
+	read_spec(spec);
+	fclose(spec);
+
+	build_dfa();
+
+	output = fopen(argv[2], "w");
+	if (!output) {
+		fprintf(stderr, "tokgen: cannot create %s\n", argv[2]);
+		return 1;
+	}
+	write_tables(output, argv[1]);
+	fclose(output);
+	return 0;
+}
@@ -1,6 +1,9 @@
+#define _POSIX_C_SOURCE 200112L
+
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <time.h>
 #include "utils.h"
 
 #ifdef _WIN32
@@ -69,23 +72,77 @@ ErrorCode get_comma(char *line, char ** next_word) {
     return SUCCESS;
 }
 
+/* The value of each character as a digit, 255 for characters that are not digits in any base up to 16 */
+static const unsigned char digit_values[256] = {
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 255, 255, 255, 255, 255, 255,
+    255, 10, 11, 12, 13, 14, 15, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 10, 11, 12, 13, 14, 15, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255
+};
+
+/* Magnitude of the smallest negative number, the numbers of the assembler are 21 bit signed integers */
+#define NUMBER_LIMIT (1UL << 20)
+
 ErrorCode get_number(char *word, int *value) {
-    char *endptr;
-    long result = strtol(word, &endptr, 10);
+    char *pos = word;
+    char *digits;
+    unsigned long magnitude = 0;
+    unsigned int base = 10;
+    unsigned int digit;
+    int is_negative = 0;
+
+    /* Skip leading spaces, and take the sign */
+    while (*pos && isspace((unsigned char)*pos)) pos++;
+    if (*pos == '-' || *pos == '+') {
+        is_negative = (*pos == '-');
+        pos++;
+    }
 
-    if (endptr == word && *endptr != '\0') {
-		return ERR_NUMBER_ILLEGAL;
+    /* Hexadecimal (0x) and binary (0b) forms, a prefix without digits is the decimal 0 */
+    if (pos[0] == '0' && (pos[1] == 'x' || pos[1] == 'X') && digit_values[(unsigned char)pos[2]] < 16) {
+        base = 16;
+        pos += 2;
+    }
+    else if (pos[0] == '0' && (pos[1] == 'b' || pos[1] == 'B') && digit_values[(unsigned char)pos[2]] < 2) {
+        base = 2;
+        pos += 2;
     }
 
-	/* Ensure the number is within the acceptable range for the assembler */
-    if ((result >= -(1 << 20)) && (result < (1 << 20))) {
-		*value = (int)result;
-		return SUCCESS;
-	}
-	else {
-		return ERR_NUMBER_OUT_OF_RANGE;
-	}
+    /* Accumulate the digits, the magnitude stops growing past the limit so it never overflows */
+    for (digits = pos; (digit = digit_values[(unsigned char)*pos]) < base; pos++) {
+        magnitude = magnitude * base + digit;
+        if (magnitude > NUMBER_LIMIT) {
+            magnitude = NUMBER_LIMIT + 1;
+        }
+    }
 
+    /* No digits: an empty word is 0 */
+    if (pos == digits) {
+        if (*word != '\0') {
+            return ERR_NUMBER_ILLEGAL;
+        }
+        *value = 0;
+        return SUCCESS;
+    }
+
+	/* Ensure the number is within the acceptable range for the assembler */
+    if (magnitude < NUMBER_LIMIT || (is_negative && magnitude == NUMBER_LIMIT)) {
+        *value = is_negative ? -(int)magnitude : (int)magnitude;
+        return SUCCESS;
+    }
+    return ERR_NUMBER_OUT_OF_RANGE;
 }
 
 int is_filename_too_long(char *base) {
@@ -118,6 +175,16 @@ int is_line_too_long(FILE *file, char *line) {
     return 0;
 }
 
+double get_seconds() {
+#if !defined(_WIN32) && defined(CLOCK_MONOTONIC)
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
 char * my_strdup(char *string) {
     char *copy;
     if (string == NULL) {
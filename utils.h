@@ -40,6 +40,8 @@ ErrorCode get_comma(char *line, char ** next_word);
 
 /**
 Parses a numeric operand and extracts its value.
+The number is decimal, hexadecimal with a 0x prefix, or binary with a 0b prefix, with an optional sign,
+and must fit in 21 signed bits.
 	@param word: The operand string containing a number.
 	@param value: A pointer to store the extracted numeric value.
 	@return An error code indicating success or failure.
@@ -69,6 +71,12 @@ Checks if a line exceeds the allowed length.
 */
 int is_line_too_long(FILE *file, char *line);
 
+/**
+Returns a monotonic wall clock time, for measuring elapsed time.
+   @return The time in seconds.
+*/
+double get_seconds();
+
 /**
 Implement strdup since it is not defined for ANSI C
  */
@@ -0,0 +1,294 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+	#include <unistd.h>
+	#include <sys/types.h>
+	#include <sys/stat.h>
+	#include <sys/wait.h>
+#endif
+#ifdef __linux__
+	#include <poll.h>
+	#include <sys/inotify.h>
+#endif
+
+#include "error_codes.h"
+#include "utils.h"
+#include "parallel.h"
+#include "watch.h"
+
+/* Time to wait for more changes after a change, in milliseconds */
+#define DEBOUNCE_MS 10
+/* Time between checks of modification times, when changes cannot be waited for */
+#define POLL_MS 50
+
+/* State of a watched file */
+typedef struct {
+	char *base;                       /* File name without extension */
+	build_options_t *options;
+	char source[MAX_FILE_NAME];       /* Source file name */
+	const char *name;                 /* Source file name inside its directory */
+	time_t modified;                  /* Last seen modification time */
+	int watch;                        /* inotify watch descriptor of its directory */
+	int dirty;                        /* Nonzero if the file changed since it was built */
+	double changed;                   /* Time of the first change since it was built */
+} watched_t;
+
+#ifndef _WIN32
+
+/* Returns a monotonic time in milliseconds */
+static double now_ms() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec * 1000.0 + time.tv_nsec / 1000000.0;
+}
+
+/* Marks a file as changed, keeping the time of its first change */
+static void mark_dirty(watched_t *file) {
+	if (!file->dirty) {
+		file->dirty = 1;
+		file->changed = now_ms();
+	}
+}
+
+/* Reports the result of a rebuild */
+static void report(watched_t *file, int error) {
+	printf("%s %s in %.1f ms.\n", error ? "Failed" : "Rebuilt", file->source, now_ms() - file->changed);
+	fflush(stdout);
+}
+
+/**
+Builds the changed files again.
+A single file is built in this process. Otherwise each file is built by a child process,
+as the tables of the assembler modules are shared by the whole process, with up to one child per processor.
+*/
+static void rebuild(watched_t *files, int n_files) {
+	pid_t *children;
+	int n_dirty = 0;
+	int workers = get_number_of_workers();
+	int running = 0;
+	int status;
+	int i, j;
+
+	for (i = 0; i < n_files; i++) {
+		n_dirty += files[i].dirty;
+	}
+	if (n_dirty == 0) {
+		return;
+	}
+
+	children = (pid_t *)calloc(n_files, sizeof(pid_t));
+	if (n_dirty == 1 || workers == 1 || !children) {
+		for (i = 0; i < n_files; i++) {
+			if (files[i].dirty) {
+				files[i].dirty = 0;
+				report(&files[i], build_file(files[i].base, files[i].options));
+			}
+		}
+		free(children);
+		return;
+	}
+
+	/* Flush pending output, so it is not written again by the children */
+	fflush(stdout);
+	for (i = 0; i < n_files || running > 0; ) {
+		pid_t pid;
+
+		/* Start a build while there are free workers */
+		if (i < n_files && running < workers) {
+			if (!files[i].dirty) {
+				i++;
+				continue;
+			}
+			files[i].dirty = 0;
+			pid = fork();
+			if (pid == 0) {
+				status = build_file(files[i].base, files[i].options);
+				fflush(stdout);
+				_exit(status);
+			}
+			if (pid < 0) {
+				report(&files[i], build_file(files[i].base, files[i].options));
+			}
+			else {
+				children[i] = pid;
+				running++;
+			}
+			i++;
+			continue;
+		}
+
+		/* Wait for a build to finish */
+		pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			break;
+		}
+		for (j = 0; j < n_files; j++) {
+			if (children[j] == pid) {
+				children[j] = 0;
+				running--;
+				report(&files[j], !WIFEXITED(status) || WEXITSTATUS(status) != 0);
+				break;
+			}
+		}
+	}
+	free(children);
+}
+
+/* Marks the files whose modification time changed */
+static void check_modified(watched_t *files, int n_files) {
+	struct stat info;
+	int i;
+
+	for (i = 0; i < n_files; i++) {
+		if (stat(files[i].source, &info) == 0 && info.st_mtime != files[i].modified) {
+			files[i].modified = info.st_mtime;
+			mark_dirty(&files[i]);
+		}
+	}
+}
+
+/* Waits for changes by polling the modification times of the files */
+static void poll_loop(watched_t *files, int n_files) {
+	struct timespec delay;
+
+	delay.tv_sec = 0;
+	delay.tv_nsec = POLL_MS * 1000000L;
+	while (1) {
+		nanosleep(&delay, NULL);
+		check_modified(files, n_files);
+		rebuild(files, n_files);
+	}
+}
+
+#ifdef __linux__
+
+/* Reads the pending events, and marks the files they name */
+static void read_events(int notify, watched_t *files, int n_files) {
+	union {
+		struct inotify_event event; /* Aligns the buffer for events */
+		char bytes[4096];
+	} buffer;
+	ssize_t length;
+	char *pos;
+	int i;
+
+	length = read(notify, buffer.bytes, sizeof(buffer.bytes));
+	for (pos = buffer.bytes; length > 0 && pos < buffer.bytes + length; ) {
+		struct inotify_event *event = (struct inotify_event *)pos;
+		if (event->len > 0) {
+			for (i = 0; i < n_files; i++) {
+				if (files[i].watch == event->wd && strcmp(files[i].name, event->name) == 0) {
+					mark_dirty(&files[i]);
+				}
+			}
+		}
+		pos += sizeof(struct inotify_event) + event->len;
+	}
+}
+
+/**
+Waits for changes with inotify.
+The directories of the files are watched, not the files, as editors often save by
+writing a new file and renaming it over the old one.
+Returns only if inotify cannot be used.
+*/
+static void notify_loop(watched_t *files, int n_files) {
+	struct pollfd poll_fd;
+	char directory[MAX_FILE_NAME];
+	int notify;
+	int i;
+
+	notify = inotify_init();
+	if (notify < 0) {
+		return;
+	}
+	for (i = 0; i < n_files; i++) {
+		size_t length = files[i].name - files[i].source;
+		if (length == 0) {
+			strcpy(directory, ".");
+		}
+		else {
+			strncpy(directory, files[i].source, length);
+			directory[length] = '\0';
+		}
+		/* The same directory gets the same watch descriptor */
+		files[i].watch = inotify_add_watch(notify, directory, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+		if (files[i].watch < 0) {
+			close(notify);
+			return;
+		}
+	}
+
+	poll_fd.fd = notify;
+	poll_fd.events = POLLIN;
+	while (1) {
+		poll(&poll_fd, 1, -1);
+		read_events(notify, files, n_files);
+
+		/* Collect the changes that follow closely, such as several files saved together */
+		while (poll(&poll_fd, 1, DEBOUNCE_MS) > 0) {
+			read_events(notify, files, n_files);
+		}
+		rebuild(files, n_files);
+	}
+}
+
+#endif /* __linux__ */
+
+int watch_process(char **files, build_options_t *options, int n_files) {
+	watched_t *watched;
+	int i;
+
+	watched = (watched_t *)calloc(n_files ? n_files : 1, sizeof(watched_t));
+	if (!watched) {
+		is_error(ERR_OUT_OF_MEMORY, NULL, "watch", 0, NULL);
+		return 1;
+	}
+
+	for (i = 0; i < n_files; i++) {
+		const char *slash;
+
+		if (is_filename_too_long(files[i])) {
+			is_error(ERR_FILE_NAME_TOO_LONG, NULL, files[i], 0, NULL);
+			free(watched);
+			return 1;
+		}
+		watched[i].base = files[i];
+		watched[i].options = &options[i];
+		get_filename(files[i], "as", watched[i].source);
+		slash = strrchr(watched[i].source, '/');
+		watched[i].name = slash ? slash + 1 : watched[i].source;
+		watched[i].watch = -1;
+	}
+
+	/* Build everything once, then only what changes */
+	check_modified(watched, n_files);
+	for (i = 0; i < n_files; i++) {
+		watched[i].dirty = 0;
+		build_file(watched[i].base, watched[i].options);
+	}
+	printf("Watching %d files for changes...\n", n_files);
+	fflush(stdout);
+
+#ifdef __linux__
+	notify_loop(watched, n_files);
+#endif
+	poll_loop(watched, n_files);
+
+	free(watched);
+	return 1;
+}
+
+#else /* _WIN32 */
+
+int watch_process(char **files, build_options_t *options, int n_files) {
+	printf("Watching files is not supported on this platform.\n");
+	return 1;
+}
+
+#endif /* _WIN32 */
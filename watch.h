@@ -0,0 +1,18 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "build.h"
+
+/**
+Builds the given files, then keeps running and builds each file again whenever its source changes.
+Changes are waited for with inotify where available, and by polling modification times otherwise.
+Changes that arrive close together are collected and rebuilt as one batch, on worker processes
+when more than one file changed.
+	@param files: The file names without the .as extension.
+	@param options: The build options of each file.
+	@param n_files: The number of files.
+	@return: 1 if watching could not start, otherwise does not return.
+*/
+int watch_process(char **files, build_options_t *options, int n_files);
+
+#endif /* WATCH_H */